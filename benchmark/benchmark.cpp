@@ -0,0 +1,1089 @@
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include "targetver.h"
+#endif
+
+#include "alarm-engine.h"
+#include "calculated-tags.h"
+#include "change-bus.h"
+#include "change-detector.h"
+#include "deadband.h"
+#include "opc_types.h"
+#include "proxy-server.h"
+#include "simulated-source.h"
+#include "stale-watchdog.h"
+#include "value-cache.h"
+#include "write-coalescer.h"
+
+using namespace opc;
+using namespace std;
+using boost::asio::ip::tcp;
+
+typedef chrono::steady_clock Clock;
+
+// runs of each measure, the median one is kept...
+static int const RUNS = 5;
+
+// a calibration run must take this share of a run before it is trusted...
+static double const CALIBRATION_SHARE = 0.1;
+
+// a tenth of the items change between two batches of the change detection...
+static size_t const CHANGED_SHARE = 10;
+
+// items of the cache read and loopback measures...
+static size_t const BENCHMARK_TAGS = 100000;
+
+// round trips of each loopback measure, after the warm up ones...
+static size_t const ROUND_TRIPS = 20000;
+static size_t const WARM_UP_TRIPS = 1000;
+
+static size_t const READ_SIZE = 4096;
+
+// reactors of the proxy and clients of a loopback run. The first run is the latency of
+// a single client, the others how the proxy scales with the reactors...
+struct LoopbackRun
+{
+  unsigned reactors;
+  unsigned clients;
+};
+
+static LoopbackRun const LOOPBACK_RUNS[] = { { 1, 1 }, { 1, 8 }, { 2, 8 }, { 4, 8 }, { 4, 32 } };
+
+// a measure, lower is better...
+struct Result
+{
+  string name;
+  double value;
+  string unit;
+};
+
+struct Options
+{
+  string filter;
+  double seconds;
+  int port;
+  string output;
+  string baseline;
+  double threshold;
+};
+
+// keeps the compiler from dropping the measured work...
+static volatile size_t sink;
+
+// swallows what is written to it...
+class NullBuffer : public streambuf
+{
+protected:
+  int overflow(int c)
+  {
+    return traits_type::not_eof(c);
+  }
+};
+
+
+// the measures whose name contains the filter are run, each for about the given time.
+// The results are printed as name \t value \t unit as they come.
+class Suite
+{
+public:
+  Suite(Options const & options) :
+    options(options)
+  {
+  }
+
+  bool selected(string const & name) const
+  {
+    return name.find(options.filter) != string::npos;
+  }
+
+  // body runs the operation count times. The count is doubled until a run is long
+  // enough to be timed, then set so a run takes its share of the time. The result is
+  // the median time of an operation, times scale...
+  void run(string const & name, function<void(size_t count)> const & body, string const & unit = "ns/op", double scale = 1)
+  {
+    if (!selected(name))
+      return;
+
+    double target = options.seconds / RUNS;
+    size_t count = 1;
+    double elapsed;
+
+    for (;;)
+    {
+      elapsed = timed(body, count);
+
+      if (elapsed >= target * CALIBRATION_SHARE || count >= (size_t(1) << 40))
+        break;
+
+      count *= 2;
+    }
+
+    count = max<size_t>(1, static_cast<size_t>(count * target / max(elapsed, 1e-9)));
+
+    vector<double> runs;
+
+    for (int r = 0; r < RUNS; r++)
+      runs.push_back(timed(body, count) * 1e9 / count);
+
+    sort(runs.begin(), runs.end());
+
+    add(name, runs[RUNS / 2] * scale, unit);
+  }
+
+  void add(string const & name, double value, string const & unit)
+  {
+    cout << name << '\t' << fixed << setprecision(3) << value << '\t' << unit << endl;
+
+    results.push_back(Result{ name, value, unit });
+  }
+
+  vector<Result> const & all() const
+  {
+    return results;
+  }
+
+private:
+  Options options;
+  vector<Result> results;
+
+  // seconds taken by count operations...
+  static double timed(function<void(size_t count)> const & body, size_t count)
+  {
+    Clock::time_point start = Clock::now();
+    body(count);
+
+    return chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count() / 1e9;
+  }
+};
+
+
+void benchParsing(Suite & suite)
+{
+  vector<boost::string_ref> tokens;
+
+  string read = "READ|Channel1.Device1.Tag42";
+  string write = "WRITE|Channel1.Device1.Tag42|1234.5678";
+  string subscribe = "SUBSCRIBE|DEADBAND=0.5";
+
+  for (int i = 0; i < 10; i++)
+    subscribe += "|Channel1.Device1.Tag" + to_string(i);
+
+  suite.run("parse/read", [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      ProxyServer::tokenizer(read, tokens);
+      sink += tokens.size();
+    }
+  });
+
+  suite.run("parse/write", [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      ProxyServer::tokenizer(write, tokens);
+      sink += tokens.size();
+    }
+  });
+
+  suite.run("parse/subscribe-10", [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      ProxyServer::tokenizer(subscribe, tokens);
+      sink += tokens.size();
+    }
+  });
+
+  // the value of a WRITE, parsed as the item's type...
+  Value value;
+
+  suite.run("parse/value-r8", [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+      sink += parseValue("1234.5678", 9, TYPE_R8, value);
+  });
+
+  suite.run("parse/value-i4", [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+      sink += parseValue("-123456", 7, TYPE_I4, value);
+  });
+}
+
+
+void benchFormatting(Suite & suite)
+{
+  char buffer[VALUE_TEXT_SIZE];
+
+  Value real;
+  real.type = TYPE_R8;
+  real.real = 1234.5678;
+
+  Value integer;
+  integer.type = TYPE_I4;
+  integer.integer = -123456;
+
+  Value boolean;
+  boolean.type = TYPE_BOOL;
+  boolean.integer = 1;
+
+  Value text;
+  text.type = TYPE_STRING;
+  text.text = "Channel1.Device1.Running";
+
+  Value const * values[] = { &real, &integer, &boolean, &text };
+  char const * names[] = { "format/r8", "format/i4", "format/bool", "format/string" };
+
+  for (int v = 0; v < 4; v++)
+  {
+    Value const & value = *values[v];
+
+    suite.run(names[v], [&](size_t count) {
+      for (size_t i = 0; i < count; i++)
+        sink += formatValue(value, buffer, sizeof(buffer));
+    });
+  }
+
+  // the number of a CHANGE and of the history...
+  string output;
+
+  suite.run("format/number", [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      output.clear();
+      appendNumber(output, 1234.5678 + i);
+      sink += output.size();
+    }
+  });
+
+  // a READ answered from the cache...
+  ValueCache cache(1);
+  cache.update(0, real, QUALITY_GOOD);
+
+  CachedValue cached;
+  cache.get(0, cached);
+
+  suite.run("format/response", [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      output.clear();
+      formatCachedValue(cached, output);
+      sink += output.size();
+    }
+  });
+}
+
+
+// the change detection of the data change callback: the detector splits a batch into
+// its changes and its repeats, the repeats refresh the cache and the changes are
+// stored and formatted for the subscribers. Two batches of all the items take turns,
+// a tenth of the values differ between them. The time is per batch...
+void benchChangeDetection(Suite & suite, size_t tags)
+{
+  string name = "change/" + (tags >= 1000 ? to_string(tags / 1000) + "k" : to_string(tags));
+
+  if (!suite.selected(name))
+    return;
+
+  vector<unique_ptr<ItemValue>> batches[2];
+
+  for (int b = 0; b < 2; b++)
+  {
+    for (size_t i = 0; i < tags; i++)
+    {
+      unique_ptr<ItemValue> value(new ItemValue());
+      value->handle = static_cast<ItemHandle>(i + 1);
+      value->index = static_cast<int>(i);
+      value->quality = QUALITY_GOOD;
+      value->timestamp = 0;
+      value->value.type = TYPE_R8;
+      value->value.real = i + (b == 1 && i % CHANGED_SHARE == 0 ? 0.5 : 0);
+
+      batches[b].push_back(move(value));
+    }
+  }
+
+  ValueCache cache(tags);
+  ChangeDetector detector;
+  ChangeSet changes;
+
+  detector.detect(batches[0], changes);
+
+  for (auto c = changes.changed.begin(); c != changes.changed.end(); ++c)
+    cache.update((*c)->index, (*c)->value, (*c)->quality);
+
+  vector<Change> published;
+  CachedValue cached;
+  int next = 1;
+
+  suite.run(name, [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      detector.detect(batches[next], changes);
+      next ^= 1;
+
+      published.clear();
+
+      for (auto r = changes.repeated.begin(); r != changes.repeated.end(); ++r)
+        cache.touch(*r);
+
+      for (auto c = changes.changed.begin(); c != changes.changed.end(); ++c)
+        cache.update((*c)->index, (*c)->value, (*c)->quality);
+
+      for (auto c = changes.changed.begin(); c != changes.changed.end(); ++c)
+      {
+        if (cache.get((*c)->index, cached))
+          published.push_back(Change{ (*c)->index, formatCachedValue(cached), cached.number });
+      }
+
+      sink += published.size();
+    }
+  }, "us/batch", 1e-3);
+}
+
+
+// batches of changes through a bus with the stages of the gateway: two independent
+// ones and one depending on the first. The time is per change, from its publication
+// until the last stage has handled it...
+void benchChangeBus(Suite & suite, size_t batchSize)
+{
+  string name = "bus/3-stages";
+
+  if (!suite.selected(name))
+    return;
+
+  vector<unique_ptr<ItemValue>> batch;
+  vector<ItemValue const *> values;
+
+  for (size_t i = 0; i < batchSize; i++)
+  {
+    unique_ptr<ItemValue> value(new ItemValue());
+    value->index = static_cast<int>(i);
+    value->quality = QUALITY_GOOD;
+    value->value.type = TYPE_R8;
+    value->value.real = static_cast<double>(i);
+
+    values.push_back(value.get());
+    batch.push_back(move(value));
+  }
+
+  ChangeBus bus(CHANGE_BUS_SIZE);
+  atomic<size_t> handled(0);
+
+  int first = bus.add_consumer("first", [&](ChangeEvent const & event, bool) { sink += event.index; });
+  bus.add_consumer("second", [&](ChangeEvent const & event, bool) { sink += event.quality; });
+  bus.add_consumer("third", [&](ChangeEvent const &, bool) { handled.fetch_add(1, memory_order_release); }, vector<int>(1, first));
+
+  bus.start();
+
+  suite.run(name, [&](size_t count) {
+    size_t expected = handled.load() + count * batchSize;
+
+    for (size_t i = 0; i < count; i++)
+      bus.publish(values, 0);
+
+    while (handled.load(memory_order_acquire) < expected)
+      boost::this_thread::yield();
+  }, "ns/change", 1.0 / batchSize);
+
+  bus.stop();
+}
+
+
+// the deadband compare over a batch of values, with SSE2 when it is built in and
+// without, and the filter of the subscriptions gathering their lanes first. Every
+// other value is out of its deadband. The time is per value...
+void benchDeadband(Suite & suite, size_t count)
+{
+  string suffix = to_string(count / 1000000) + "M";
+
+  vector<double> values(count);
+  vector<double> last(count);
+  vector<double> absolute(count, 0.5);
+  vector<double> relative(count, 0.01);
+  vector<unsigned char> pass(count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    last[i] = static_cast<double>(i % 100);
+    values[i] = last[i] + (i % 2 == 0 ? 0.25 : 2);
+  }
+
+  if (DeadbandTable::vectorized())
+  {
+    suite.run("deadband/sse2-" + suffix, [&](size_t runs) {
+      for (size_t r = 0; r < runs; r++)
+      {
+        DeadbandTable::compare(count, values.data(), last.data(), absolute.data(), relative.data(), pass.data());
+        sink += pass[r % count];
+      }
+    }, "ns/value", 1.0 / count);
+  }
+
+  suite.run("deadband/scalar-" + suffix, [&](size_t runs) {
+    for (size_t r = 0; r < runs; r++)
+    {
+      DeadbandTable::compare_scalar(count, values.data(), last.data(), absolute.data(), relative.data(), pass.data());
+      sink += pass[r % count];
+    }
+  }, "ns/value", 1.0 / count);
+
+  string name = "deadband/filter-" + suffix;
+
+  if (!suite.selected(name))
+    return;
+
+  // a subscription per value, the filtered values going back and forth so the same
+  // ones pass in every run...
+  DeadbandTable table;
+  vector<int> ids(count);
+  vector<double> moves[2] = { values, last };
+
+  for (size_t i = 0; i < count; i++)
+    ids[i] = table.add(absolute[i], relative[i]);
+
+  table.filter(count, ids.data(), last.data(), pass.data());
+
+  int next = 0;
+
+  suite.run(name, [&](size_t runs) {
+    for (size_t r = 0; r < runs; r++)
+    {
+      table.filter(count, ids.data(), moves[next].data(), pass.data());
+      next ^= 1;
+
+      sink += pass[r % count];
+    }
+  }, "ns/value", 1.0 / count);
+}
+
+
+// the stamp every value gives the watchdog, over all the items, while its thread
+// rearms the timers of the ones that got values...
+void benchWatchdog(Suite & suite, size_t tags)
+{
+  string name = "stale/seen-" + to_string(tags / 1000) + "k";
+
+  if (!suite.selected(name))
+    return;
+
+  StaleWatchdog watchdog(tags, [](int) { return string(); }, [](vector<int> const &) {});
+  watchdog.set_timeout(60000);
+  watchdog.start();
+
+  size_t index = 0;
+
+  suite.run(name, [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      watchdog.seen(static_cast<int>(index));
+
+      if (++index == tags)
+        index = 0;
+    }
+  });
+
+  watchdog.stop();
+}
+
+
+// batches of changes of a tenth of the items, all with limits, through the alarm
+// engine. Every other batch moves the values across the HI limit and back, so each
+// batch raises or clears an alarm per change. The time is per change...
+void benchAlarms(Suite & suite, size_t tags)
+{
+  string name = "alarm/evaluate-" + to_string(tags / 1000) + "k";
+
+  if (!suite.selected(name))
+    return;
+
+  AlarmLimits limits;
+  parseLimits("hihi:95,hi:90,lo:10,lolo:5,sp:50,dev:45,roc:1000,hys:1", limits);
+
+  AlarmEngine engine([](int) { return string(); });
+  engine.set_limits(limits);
+
+  size_t batchSize = tags / CHANGED_SHARE;
+  vector<int> indexes(batchSize);
+  vector<double> values[2] = { vector<double>(batchSize), vector<double>(batchSize) };
+  vector<long long> times(batchSize);
+  vector<AlarmTransition> transitions;
+
+  for (size_t i = 0; i < batchSize; i++)
+  {
+    indexes[i] = static_cast<int>(i * CHANGED_SHARE);
+    values[0][i] = 50 + static_cast<double>(i % 10);
+    values[1][i] = 91 + static_cast<double>(i % 3);
+  }
+
+  long long time = 0;
+  int next = 0;
+
+  suite.run(name, [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      // a second apart, so the rates stay under their limit...
+      time += 1000;
+      fill(times.begin(), times.end(), time);
+
+      transitions.clear();
+      engine.evaluate(batchSize, indexes.data(), values[next].data(), times.data(), transitions);
+      next ^= 1;
+
+      sink += transitions.size();
+    }
+  }, "ns/change", 1.0 / batchSize);
+}
+
+
+// batches of changes of a tenth of the items through calculated tags, one for each
+// ten items and using three of them, and a second level averaging two of the first.
+// A change reaches three tags of the first level. The time is per batch...
+void benchCalculatedTags(Suite & suite, size_t tags)
+{
+  string name = "calc/update-" + to_string(tags / 1000) + "k";
+
+  if (!suite.selected(name))
+    return;
+
+  CalculatedTags calculated(static_cast<int>(tags * 2));
+  string error;
+
+  for (size_t t = 0; t < tags / CHANGED_SHARE; t++)
+  {
+    string a = "ITEM" + to_string(t * CHANGED_SHARE);
+    string b = "ITEM" + to_string((t * CHANGED_SHARE + 10) % tags);
+    string c = "ITEM" + to_string((t * CHANGED_SHARE + 20) % tags);
+
+    calculated.define("CALC" + to_string(t), "(" + a + " + " + b + ") * 0.5 - max(" + c + ", 0) / 3.6", error);
+  }
+
+  for (size_t t = 0; t + 1 < tags / CHANGED_SHARE; t += 2)
+    calculated.define("AVG" + to_string(t), "(CALC" + to_string(t) + " + CALC" + to_string(t + 1) + ") / 2", error);
+
+  calculated.set_resolver([](string const & itemId) { return atoi(itemId.c_str() + 4); });
+
+  vector<unique_ptr<ItemValue>> batches[2];
+  ChangeSet changes;
+
+  for (int b = 0; b < 2; b++)
+  {
+    for (size_t i = 0; i < tags; i += CHANGED_SHARE)
+    {
+      unique_ptr<ItemValue> value(new ItemValue());
+      value->index = static_cast<int>(i);
+      value->quality = QUALITY_GOOD;
+      value->timestamp = 0;
+      value->value.type = TYPE_R8;
+      value->value.real = i + b * 0.5;
+
+      batches[b].push_back(move(value));
+    }
+  }
+
+  int next = 0;
+
+  suite.run(name, [&](size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      changes.clear();
+
+      for (auto v = batches[next].begin(); v != batches[next].end(); ++v)
+        changes.changed.push_back(v->get());
+
+      calculated.update(changes);
+      next ^= 1;
+
+      sink += changes.changed.size();
+    }
+  }, "us/batch", 1e-3);
+}
+
+
+// readers get the items in a scattered order while a writer keeps updating them. The
+// time is per read of a reader, so it stays flat as long as the readers don't slow
+// each other down...
+void benchCacheContention(Suite & suite, unsigned readers)
+{
+  string name = "cache/read-" + to_string(readers);
+
+  if (!suite.selected(name))
+    return;
+
+  ValueCache cache(BENCHMARK_TAGS);
+
+  Value value;
+  value.type = TYPE_R8;
+
+  for (size_t i = 0; i < BENCHMARK_TAGS; i++)
+  {
+    value.real = static_cast<double>(i);
+    cache.update(static_cast<int>(i), value, QUALITY_GOOD);
+  }
+
+  suite.run(name, [&](size_t count) {
+    atomic<bool> done(false);
+
+    boost::thread writer([&]() {
+      Value written;
+      written.type = TYPE_R8;
+
+      for (size_t i = 0; !done.load(memory_order_relaxed); i++)
+      {
+        written.real = static_cast<double>(i);
+        cache.update(static_cast<int>(i % BENCHMARK_TAGS), written, QUALITY_GOOD);
+      }
+    });
+
+    boost::thread_group group;
+
+    for (unsigned r = 0; r < readers; r++)
+    {
+      group.create_thread([&, r]() {
+        CachedValue cached;
+        size_t found = 0;
+        size_t index = r;
+
+        for (size_t i = 0; i < count; i++)
+        {
+          // a stride prime to the item count visits all of them...
+          index = (index + 7919) % BENCHMARK_TAGS;
+          found += cache.get(static_cast<int>(index), cached);
+        }
+
+        sink += found;
+      });
+    }
+
+    group.join_all();
+
+    done = true;
+    writer.join();
+  });
+}
+
+
+// the round trip of one request on an open connection, in microseconds...
+bool roundTrip(tcp::socket & socket, string const & request, char * buffer, long long & latency)
+{
+  boost::system::error_code error;
+  Clock::time_point sent = Clock::now();
+
+  boost::asio::write(socket, boost::asio::buffer(request), error);
+
+  if (error)
+    return false;
+
+  // a response fits in one read...
+  size_t length = socket.read_some(boost::asio::buffer(buffer, READ_SIZE), error);
+
+  if (error || length == 0)
+    return false;
+
+  latency = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - sent).count();
+
+  return true;
+}
+
+
+long long percentile(vector<long long> const & sorted, double fraction)
+{
+  size_t position = static_cast<size_t>(fraction * sorted.size());
+
+  return sorted[min(position, sorted.size() - 1)];
+}
+
+
+// clients sending their requests one after the other on their own connection, each
+// doing a share of the round trips after warming up. The measured trips start together
+// and the elapsed time is the one of all of them...
+boost::system::error_code loopbackClients(unsigned short port, unsigned clients, bool reads, vector<long long> & latencies, double & elapsed)
+{
+  boost::barrier started(clients + 1);
+  vector<vector<long long>> measured(clients);
+  vector<boost::system::error_code> errors(clients);
+  boost::thread_group group;
+
+  size_t warmUp = max<size_t>(1, WARM_UP_TRIPS / clients);
+  size_t trips = max<size_t>(1, ROUND_TRIPS / clients);
+
+  for (unsigned c = 0; c < clients; c++)
+  {
+    group.create_thread([&, c]() {
+      boost::asio::io_service service;
+      tcp::socket socket(service);
+      boost::system::error_code & error = errors[c];
+
+      socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), error);
+
+      if (!error)
+        socket.set_option(tcp::no_delay(true));
+
+      char buffer[READ_SIZE];
+      long long latency;
+
+      for (size_t i = 0; i < warmUp + trips; i++)
+      {
+        // a client that failed still meets the others...
+        if (i == warmUp)
+          started.wait();
+
+        if (error)
+          continue;
+
+        string tag = "SIM.TAG" + to_string((i * clients + c) % BENCHMARK_TAGS);
+        string request = reads ? "READ|" + tag : "WRITE|" + tag + "|" + to_string(i);
+
+        if (!roundTrip(socket, request, buffer, latency))
+          error = boost::asio::error::connection_aborted;
+        else if (i >= warmUp)
+          measured[c].push_back(latency);
+      }
+
+      boost::system::error_code ignored;
+      socket.close(ignored);
+    });
+  }
+
+  started.wait();
+
+  Clock::time_point start = Clock::now();
+  group.join_all();
+  elapsed = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count() / 1e9;
+
+  for (unsigned c = 0; c < clients; c++)
+  {
+    if (errors[c])
+      return errors[c];
+
+    latencies.insert(latencies.end(), measured[c].begin(), measured[c].end());
+  }
+
+  return boost::system::error_code();
+}
+
+
+// a proxy on the loopback serving a simulated source the way the gateway does: a READ
+// is answered from the cache, a WRITE goes through the coalescer to the source and
+// waits for its result. Each run has its reactors and clients, see LOOPBACK_RUNS, and
+// the sessions are on the given transport...
+void benchLoopback(Suite & suite, Options const & options, TransportType transport)
+{
+  string prefix = string("loopback/") + (transport == URING_TRANSPORT ? "uring" : "asio") + "/";
+  char const * commands[] = { "read", "write" };
+  vector<string> names[2];
+  bool selected = false;
+
+  for (int c = 0; c < 2; c++)
+  {
+    for (size_t r = 0; r < sizeof(LOOPBACK_RUNS) / sizeof(LOOPBACK_RUNS[0]); r++)
+    {
+      string name = prefix + commands[c];
+
+      if (LOOPBACK_RUNS[r].reactors > 1 || LOOPBACK_RUNS[r].clients > 1)
+        name += "-r" + to_string(LOOPBACK_RUNS[r].reactors) + "-c" + to_string(LOOPBACK_RUNS[r].clients);
+
+      names[c].push_back(name);
+      selected = selected || suite.selected(name);
+    }
+  }
+
+  if (!selected)
+    return;
+
+  SimulationSettings settings;
+  parseSimulation("", settings);
+  settings.tags = BENCHMARK_TAGS;
+  settings.types.assign(1, TYPE_R8);
+
+  ValueCache cache(BENCHMARK_TAGS);
+
+  SimulatedSource source(settings, [](string const &) {}, [&](vector<unique_ptr<ItemValue>> const & data) {
+    for (auto d = data.begin(); d != data.end(); ++d)
+      cache.update((*d)->index, (*d)->value, (*d)->quality);
+  }, [](unsigned long, Status) {});
+
+  source.connect("");
+
+  // the values only change with the writes...
+  source.set_active(false);
+
+  for (size_t i = 0; i < BENCHMARK_TAGS; i++)
+  {
+    ItemInfo item = source.item_info(i);
+    ItemValue value;
+
+    if (source.read(item, value) == STATUS_OK)
+      cache.update(item.index, value.value, value.quality);
+  }
+
+  WriteCoalescer coalescer([&](vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results) {
+    source.write(items, values, results);
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      if (results[i] == STATUS_OK)
+        cache.update(items[i].index, values[i], QUALITY_GOOD);
+    }
+  }, 0);
+
+  ReadHandler read = [&](boost::string_ref itemId, bool, string & response) {
+    ItemInfo item;
+    CachedValue cached;
+
+    if (source.item_info(itemId.to_string(), item) != STATUS_OK || !cache.get(item.index, cached))
+      response.append("READ_FAIL");
+    else
+      formatCachedValue(cached, response);
+  };
+
+  WriteHandler write = [&](boost::string_ref itemId, boost::string_ref text) {
+    ItemInfo item;
+    Value value;
+
+    if (source.item_info(itemId.to_string(), item) != STATUS_OK || parseValue(text.data(), text.size(), item.dataType, value) != STATUS_OK)
+      return false;
+
+    return coalescer.submit(item, value).get() == STATUS_OK;
+  };
+
+  ResolveHandler resolve = [&](boost::string_ref itemId) {
+    ItemInfo item;
+
+    return source.item_info(itemId.to_string(), item) == STATUS_OK ? item.index : -1;
+  };
+
+  AsyncWriteHandler asyncWrite = [](boost::string_ref, boost::string_ref, unsigned long) { return false; };
+  HistoryHandler history = [](boost::string_ref, long long, long long, string & response) { response.append("HIST_FAIL"); };
+
+  // the proxy logs every request, the log would bury the results...
+  NullBuffer discard;
+  streambuf * console = cout.rdbuf(&discard);
+  streambuf * errors = cerr.rdbuf(&discard);
+
+  map<string, vector<long long>> latencies;
+  map<string, double> throughputs;
+  boost::system::error_code error;
+
+  for (int c = 0; c < 2 && !error; c++)
+  {
+    for (size_t r = 0; r < names[c].size(); r++)
+    {
+      LoopbackRun const & run = LOOPBACK_RUNS[r];
+      string const & name = names[c][r];
+
+      if (!suite.selected(name))
+        continue;
+
+      unique_ptr<ProxyServer> proxy(new ProxyServer(options.port, transport, run.reactors, false, read, write, resolve, asyncWrite, history));
+      proxy->cached_reads([](boost::string_ref) { return true; });
+
+      boost::thread server(boost::bind(&ProxyServer::start, proxy.get()));
+
+      vector<long long> & measured = latencies[name];
+      double elapsed = 0;
+
+      error = loopbackClients(static_cast<unsigned short>(options.port), run.clients, c == 0, measured, elapsed);
+
+      proxy->stop();
+      server.join();
+      proxy.reset();
+
+      if (error)
+        break;
+
+      if (run.clients > 1)
+        throughputs[name] = elapsed * 1e9 / measured.size();
+    }
+  }
+
+  cout.rdbuf(console);
+  cerr.rdbuf(errors);
+
+  source.disconnect();
+
+  if (error)
+  {
+    cerr << "The " << prefix << " measures failed on port " << options.port << ": " << error.message() << endl;
+    return;
+  }
+
+  for (auto l = latencies.begin(); l != latencies.end(); ++l)
+  {
+    sort(l->second.begin(), l->second.end());
+
+    suite.add(l->first + "/p50", percentile(l->second, 0.5) / 1e3, "us");
+    suite.add(l->first + "/p99", percentile(l->second, 0.99) / 1e3, "us");
+    suite.add(l->first + "/p999", percentile(l->second, 0.999) / 1e3, "us");
+
+    // the time of the whole run over its requests, the inverse of the throughput...
+    if (throughputs.count(l->first) != 0)
+      suite.add(l->first + "/request", throughputs[l->first], "ns");
+  }
+}
+
+
+bool saveResults(string const & path, vector<Result> const & results)
+{
+  ofstream file(path.c_str());
+
+  if (!file.good())
+    return false;
+
+  for (auto r = results.begin(); r != results.end(); ++r)
+    file << r->name << '\t' << fixed << setprecision(3) << r->value << '\t' << r->unit << '\n';
+
+  return file.good();
+}
+
+
+bool loadResults(string const & path, map<string, Result> & results)
+{
+  ifstream file(path.c_str());
+
+  if (!file.good())
+    return false;
+
+  string line;
+
+  // name \t value \t unit, as printed...
+  while (getline(file, line))
+  {
+    size_t first = line.find('\t');
+    size_t second = first == string::npos ? string::npos : line.find('\t', first + 1);
+
+    if (second == string::npos)
+      continue;
+
+    string name = line.substr(0, first);
+    results[name] = Result{ name, atof(line.c_str() + first + 1), line.substr(second + 1) };
+  }
+
+  return true;
+}
+
+
+// prints the change of each measure against the baseline. A measure slower by more
+// than the threshold is a regression. Returns the number of regressions...
+int compareResults(vector<Result> const & results, map<string, Result> const & baseline, double threshold)
+{
+  int regressions = 0;
+
+  cout << endl << "name\tbaseline\tcurrent\tunit\tchange" << endl;
+
+  for (auto r = results.begin(); r != results.end(); ++r)
+  {
+    auto b = baseline.find(r->name);
+
+    if (b == baseline.end() || b->second.unit != r->unit || b->second.value <= 0)
+    {
+      cout << r->name << "\t-\t" << r->value << '\t' << r->unit << "\tnew" << endl;
+      continue;
+    }
+
+    double change = (r->value - b->second.value) * 100 / b->second.value;
+    bool regressed = change > threshold;
+
+    cout << r->name << '\t' << b->second.value << '\t' << r->value << '\t' << r->unit << '\t'
+      << showpos << setprecision(1) << change << noshowpos << setprecision(3) << '%' << (regressed ? "\tREGRESSION" : "") << endl;
+
+    if (regressed)
+      regressions++;
+  }
+
+  return regressions;
+}
+
+
+int main(int argc, char * argv[])
+{
+  Options options{ "", 1, 9102, "", "", 10 };
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-?") == 0 || i + 1 >= argc)
+    {
+      cout << "usage: benchmark [-f filter] [-d seconds] [-p port] [-o results] [-b baseline] [-t threshold]" << endl;
+      cout << "  runs the measures whose name contains the filter, each for about the given seconds" << endl;
+      cout << "  -o saves the results, -b compares them with saved ones and fails when one is" << endl;
+      cout << "  more than threshold % slower (10 by default)" << endl;
+      return 1;
+    }
+
+    if (strcmp(argv[i], "-f") == 0)
+      options.filter = argv[++i];
+    else if (strcmp(argv[i], "-d") == 0)
+      options.seconds = max(atof(argv[++i]), 0.01);
+    else if (strcmp(argv[i], "-p") == 0)
+      options.port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0)
+      options.output = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0)
+      options.baseline = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0)
+      options.threshold = atof(argv[++i]);
+    else
+      i++;
+  }
+
+  map<string, Result> baseline;
+
+  if (!options.baseline.empty() && !loadResults(options.baseline, baseline))
+  {
+    cerr << "Cannot read the baseline " << options.baseline << endl;
+    return 1;
+  }
+
+  Suite suite(options);
+
+  benchParsing(suite);
+  benchFormatting(suite);
+
+  benchChangeDetection(suite, 1000);
+  benchChangeDetection(suite, 10000);
+  benchChangeDetection(suite, 100000);
+
+  benchChangeBus(suite, 1000);
+
+  benchDeadband(suite, 1000000);
+
+  benchWatchdog(suite, 100000);
+  benchAlarms(suite, 100000);
+  benchCalculatedTags(suite, 100000);
+
+  // one writer plus the readers, up to a reader per remaining core...
+  unsigned cores = max(boost::thread::hardware_concurrency(), 2u);
+
+  for (unsigned readers = 1; readers < cores; readers *= 2)
+    benchCacheContention(suite, readers);
+
+  benchLoopback(suite, options, ASIO_TRANSPORT);
+
+#ifdef GATEWAY_IO_URING
+  benchLoopback(suite, options, URING_TRANSPORT);
+#endif
+
+  if (!options.output.empty() && !saveResults(options.output, suite.all()))
+  {
+    cerr << "Cannot write the results to " << options.output << endl;
+    return 1;
+  }
+
+  if (!options.baseline.empty())
+    return compareResults(suite.all(), baseline, options.threshold) > 0 ? 1 : 0;
+
+  return 0;
+}
@@ -0,0 +1,471 @@
+#include "alarm-engine.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ALARM_SSE2
+#endif
+
+// the lane of an item not looked up yet, and of one without limits...
+static int const LANE_UNKNOWN = -2;
+static int const NO_LANE = -1;
+
+AlarmLimits noLimits()
+{
+  double none = numeric_limits<double>::quiet_NaN();
+
+  return AlarmLimits{ none, none, none, none, none, none, none, 0 };
+}
+
+
+bool parseLimits(string const & text, AlarmLimits & limits)
+{
+  limits = noLimits();
+
+  size_t start = 0;
+
+  while (start < text.size())
+  {
+    size_t end = text.find(',', start);
+
+    if (end == string::npos)
+      end = text.size();
+
+    string option = text.substr(start, end - start);
+    size_t colon = option.find(':');
+
+    start = end + 1;
+
+    if (colon == string::npos)
+      return false;
+
+    string name = option.substr(0, colon);
+    double value = atof(option.c_str() + colon + 1);
+
+    if (name == "hihi")
+      limits.hihi = value;
+    else if (name == "hi")
+      limits.hi = value;
+    else if (name == "lo")
+      limits.lo = value;
+    else if (name == "lolo")
+      limits.lolo = value;
+    else if (name == "sp")
+      limits.setpoint = value;
+    else if (name == "dev")
+      limits.deviation = value;
+    else if (name == "roc")
+      limits.rate = value;
+    else if (name == "hys")
+      limits.hysteresis = value;
+    else
+      return false;
+  }
+
+  return limits.hysteresis >= 0;
+}
+
+
+char const * alarmName(AlarmKind kind)
+{
+  switch (kind)
+  {
+  case ALARM_HIHI:
+    return "HIHI";
+  case ALARM_HI:
+    return "HI";
+  case ALARM_LO:
+    return "LO";
+  case ALARM_LOLO:
+    return "LOLO";
+  case ALARM_DEVIATION:
+    return "DEV";
+  case ALARM_RATE:
+    return "ROC";
+  }
+
+  return "";
+}
+
+
+void appendAlarm(string & message, string const & itemId, AlarmTransition const & transition)
+{
+  message.append("ALARM|").append(itemId).append("|").append(alarmName(transition.kind));
+  message.append(transition.active ? "|ACTIVE|" : "|CLEAR|");
+  appendNumber(message, transition.value);
+  message.append("|");
+  appendNumber(message, transition.limit);
+  message.append("|");
+  appendInteger(message, transition.time);
+}
+
+
+bool hasLimits(AlarmLimits const & limits)
+{
+  // a NaN is never equal to itself...
+  bool deviation = limits.setpoint == limits.setpoint && limits.deviation == limits.deviation;
+
+  return limits.hihi == limits.hihi || limits.hi == limits.hi || limits.lo == limits.lo || limits.lolo == limits.lolo || limits.rate == limits.rate || deviation;
+}
+
+
+void AlarmEngine::Lanes::resize(size_t size)
+{
+  hihi.resize(size);
+  hi.resize(size);
+  lo.resize(size);
+  lolo.resize(size);
+  setpoint.resize(size);
+  deviation.resize(size);
+  rate.resize(size);
+  hysteresis.resize(size);
+}
+
+
+void AlarmEngine::Lanes::copy(size_t to, Lanes const & from, size_t lane)
+{
+  hihi[to] = from.hihi[lane];
+  hi[to] = from.hi[lane];
+  lo[to] = from.lo[lane];
+  lolo[to] = from.lolo[lane];
+  setpoint[to] = from.setpoint[lane];
+  deviation[to] = from.deviation[lane];
+  rate[to] = from.rate[lane];
+  hysteresis[to] = from.hysteresis[lane];
+}
+
+
+void AlarmEngine::Lanes::set(size_t lane, AlarmLimits const & limits)
+{
+  hihi[lane] = limits.hihi;
+  hi[lane] = limits.hi;
+  lo[lane] = limits.lo;
+  lolo[lane] = limits.lolo;
+  setpoint[lane] = limits.setpoint;
+  deviation[lane] = limits.deviation;
+  rate[lane] = limits.rate;
+  hysteresis[lane] = limits.hysteresis;
+}
+
+
+AlarmEngine::AlarmEngine(function<string(int index)> itemIdFn) :
+default_limits(noLimits()),
+itemId(itemIdFn),
+batches(1),
+active_alarms(0),
+evaluations(0)
+{
+}
+
+
+void AlarmEngine::set_limits(AlarmLimits const & limits)
+{
+  default_limits = limits;
+}
+
+
+void AlarmEngine::set_limits(string const & prefix, AlarmLimits const & limits)
+{
+  classes.push_back(make_pair(prefix, limits));
+
+  // the longest prefixes are tried first...
+  stable_sort(classes.begin(), classes.end(), [](pair<string, AlarmLimits> const & a, pair<string, AlarmLimits> const & b) { return a.first.size() > b.first.size(); });
+}
+
+
+void AlarmEngine::evaluate(size_t count, int const * indexes, double const * values, long long const * times, vector<AlarmTransition> & transitions)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (values[i] != values[i])
+      continue;
+
+    int l = lane(indexes[i]);
+
+    if (l < 0)
+      continue;
+
+    // an item twice in the batch, the first value must be evaluated before the rate
+    // and the state move on...
+    if (marks[l] == batches)
+      flush(transitions);
+
+    marks[l] = batches;
+
+    double rate = numeric_limits<double>::quiet_NaN();
+    long long elapsed = times[i] - last_times[l];
+
+    if (last_values[l] == last_values[l] && elapsed > 0)
+      rate = (values[i] - last_values[l]) * 1000 / static_cast<double>(elapsed);
+
+    batch_lanes.push_back(l);
+    batch_values.push_back(values[i]);
+    batch_rates.push_back(rate);
+
+    last_values[l] = values[i];
+    last_times[l] = times[i];
+
+    if (rate == rate)
+      last_rates[l] = rate;
+  }
+
+  flush(transitions);
+}
+
+
+void AlarmEngine::active(vector<AlarmTransition> & alarms) const
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  for (size_t l = 0; l < states.size(); l++)
+  {
+    for (unsigned k = 0; states[l] != 0 && k < ALARM_KINDS; k++)
+    {
+      AlarmKind kind = static_cast<AlarmKind>(1 << k);
+
+      if (states[l] & kind)
+        alarms.push_back(AlarmTransition{ lane_items[l], kind, true, kind == ALARM_RATE ? last_rates[l] : last_values[l], limit(limits, l, kind), last_times[l] });
+    }
+  }
+}
+
+
+void AlarmEngine::format(vector<AlarmTransition> const & transitions, vector<string> & messages) const
+{
+  for (auto t = transitions.begin(); t != transitions.end(); ++t)
+  {
+    messages.push_back(string());
+    appendAlarm(messages.back(), itemId(t->index), *t);
+  }
+}
+
+
+size_t AlarmEngine::active_count() const
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+  return active_alarms;
+}
+
+
+unsigned long long AlarmEngine::evaluated() const
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+  return evaluations;
+}
+
+
+int AlarmEngine::lane(int index)
+{
+  if (index < 0)
+    return NO_LANE;
+
+  if (static_cast<size_t>(index) >= item_lanes.size())
+    item_lanes.resize(index + 1, LANE_UNKNOWN);
+
+  if (item_lanes[index] != LANE_UNKNOWN)
+    return item_lanes[index];
+
+  // the class of an item is looked up once...
+  AlarmLimits const * found = &default_limits;
+
+  try
+  {
+    found = &find(itemId(index));
+  }
+  catch (exception &)
+  {
+  }
+
+  if (!hasLimits(*found))
+  {
+    item_lanes[index] = NO_LANE;
+    return NO_LANE;
+  }
+
+  size_t l = lane_items.size();
+
+  limits.resize(l + 1);
+  limits.set(l, *found);
+  lane_items.push_back(index);
+  last_values.push_back(numeric_limits<double>::quiet_NaN());
+  last_times.push_back(0);
+  last_rates.push_back(numeric_limits<double>::quiet_NaN());
+  states.push_back(0);
+  marks.push_back(0);
+
+  item_lanes[index] = static_cast<int>(l);
+  return item_lanes[index];
+}
+
+
+AlarmLimits const & AlarmEngine::find(string const & id) const
+{
+  for (auto c = classes.begin(); c != classes.end(); ++c)
+  {
+    if (id.compare(0, c->first.size(), c->first) == 0)
+      return c->second;
+  }
+
+  return default_limits;
+}
+
+
+void AlarmEngine::flush(vector<AlarmTransition> & transitions)
+{
+  size_t count = batch_lanes.size();
+
+  if (count == 0)
+    return;
+
+  batch.resize(count);
+
+  for (size_t i = 0; i < count; i++)
+    batch.copy(i, limits, batch_lanes[i]);
+
+  compare(count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    int l = batch_lanes[i];
+    unsigned char before = states[l];
+    unsigned char state = static_cast<unsigned char>(raise[i] | (before & keep[i]));
+
+    // without a rate, the first value or two in the same ms, the rate alarm stays...
+    if (batch_rates[i] != batch_rates[i])
+      state = static_cast<unsigned char>((state & ~ALARM_RATE) | (before & ALARM_RATE));
+
+    states[l] = state;
+    evaluations++;
+
+    unsigned char changed = before ^ state;
+
+    for (unsigned k = 0; changed != 0 && k < ALARM_KINDS; k++)
+    {
+      AlarmKind kind = static_cast<AlarmKind>(1 << k);
+
+      if ((changed & kind) == 0)
+        continue;
+
+      bool raised = (state & kind) != 0;
+
+      if (raised)
+        active_alarms++;
+      else
+        active_alarms--;
+
+      transitions.push_back(AlarmTransition{ lane_items[l], kind, raised, kind == ALARM_RATE ? batch_rates[i] : batch_values[i], limit(limits, l, kind), last_times[l] });
+    }
+  }
+
+  batch_lanes.clear();
+  batch_values.clear();
+  batch_rates.clear();
+
+  // 0 is never a batch, so a new lane is never taken as gathered...
+  if (++batches == 0)
+    batches = 1;
+}
+
+
+#ifdef ALARM_SSE2
+// sets the bit of the alarm in the two lanes whose compare is true...
+static inline void setBits(__m128d compare, unsigned char bit, unsigned char * lanes)
+{
+  int mask = _mm_movemask_pd(compare);
+
+  lanes[0] |= (mask & 1) ? bit : 0;
+  lanes[1] |= (mask & 2) ? bit : 0;
+}
+#endif
+
+
+void AlarmEngine::compare(size_t count)
+{
+  raise.assign(count, 0);
+  keep.assign(count, 0);
+
+  double const * value = batch_values.data();
+  double const * rate = batch_rates.data();
+  size_t i = 0;
+
+#ifdef ALARM_SSE2
+  __m128d const sign = _mm_set1_pd(-0.0);
+
+  // a NaN limit makes both compares false, so the alarms without one are never raised...
+  for (; i + 2 <= count; i += 2)
+  {
+    __m128d v = _mm_loadu_pd(value + i);
+    __m128d h = _mm_loadu_pd(batch.hysteresis.data() + i);
+    __m128d d = _mm_andnot_pd(sign, _mm_sub_pd(v, _mm_loadu_pd(batch.setpoint.data() + i)));
+    __m128d r = _mm_andnot_pd(sign, _mm_loadu_pd(rate + i));
+
+    __m128d hihi = _mm_loadu_pd(batch.hihi.data() + i);
+    __m128d hi = _mm_loadu_pd(batch.hi.data() + i);
+    __m128d lo = _mm_loadu_pd(batch.lo.data() + i);
+    __m128d lolo = _mm_loadu_pd(batch.lolo.data() + i);
+    __m128d deviation = _mm_loadu_pd(batch.deviation.data() + i);
+    __m128d roc = _mm_loadu_pd(batch.rate.data() + i);
+
+    setBits(_mm_cmpgt_pd(v, hihi), ALARM_HIHI, &raise[i]);
+    setBits(_mm_cmpgt_pd(v, _mm_sub_pd(hihi, h)), ALARM_HIHI, &keep[i]);
+    setBits(_mm_cmpgt_pd(v, hi), ALARM_HI, &raise[i]);
+    setBits(_mm_cmpgt_pd(v, _mm_sub_pd(hi, h)), ALARM_HI, &keep[i]);
+    setBits(_mm_cmplt_pd(v, lo), ALARM_LO, &raise[i]);
+    setBits(_mm_cmplt_pd(v, _mm_add_pd(lo, h)), ALARM_LO, &keep[i]);
+    setBits(_mm_cmplt_pd(v, lolo), ALARM_LOLO, &raise[i]);
+    setBits(_mm_cmplt_pd(v, _mm_add_pd(lolo, h)), ALARM_LOLO, &keep[i]);
+    setBits(_mm_cmpgt_pd(d, deviation), ALARM_DEVIATION, &raise[i]);
+    setBits(_mm_cmpgt_pd(d, _mm_sub_pd(deviation, h)), ALARM_DEVIATION, &keep[i]);
+    setBits(_mm_cmpgt_pd(r, roc), ALARM_RATE, &raise[i]);
+    setBits(_mm_cmpgt_pd(r, _mm_sub_pd(roc, h)), ALARM_RATE, &keep[i]);
+  }
+#endif
+
+  for (; i < count; i++)
+  {
+    double h = batch.hysteresis[i];
+    double d = fabs(value[i] - batch.setpoint[i]);
+    double r = fabs(rate[i]);
+    unsigned char up = 0;
+    unsigned char stay = 0;
+
+    up |= value[i] > batch.hihi[i] ? ALARM_HIHI : 0;
+    stay |= value[i] > batch.hihi[i] - h ? ALARM_HIHI : 0;
+    up |= value[i] > batch.hi[i] ? ALARM_HI : 0;
+    stay |= value[i] > batch.hi[i] - h ? ALARM_HI : 0;
+    up |= value[i] < batch.lo[i] ? ALARM_LO : 0;
+    stay |= value[i] < batch.lo[i] + h ? ALARM_LO : 0;
+    up |= value[i] < batch.lolo[i] ? ALARM_LOLO : 0;
+    stay |= value[i] < batch.lolo[i] + h ? ALARM_LOLO : 0;
+    up |= d > batch.deviation[i] ? ALARM_DEVIATION : 0;
+    stay |= d > batch.deviation[i] - h ? ALARM_DEVIATION : 0;
+    up |= r > batch.rate[i] ? ALARM_RATE : 0;
+    stay |= r > batch.rate[i] - h ? ALARM_RATE : 0;
+
+    raise[i] = up;
+    keep[i] = stay;
+  }
+}
+
+
+double AlarmEngine::limit(Lanes const & lanes, size_t lane, AlarmKind kind)
+{
+  switch (kind)
+  {
+  case ALARM_HIHI:
+    return lanes.hihi[lane];
+  case ALARM_HI:
+    return lanes.hi[lane];
+  case ALARM_LO:
+    return lanes.lo[lane];
+  case ALARM_LOLO:
+    return lanes.lolo[lane];
+  case ALARM_DEVIATION:
+    return lanes.deviation[lane];
+  case ALARM_RATE:
+    return lanes.rate[lane];
+  }
+
+  return numeric_limits<double>::quiet_NaN();
+}
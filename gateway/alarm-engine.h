@@ -0,0 +1,152 @@
+#pragma once
+
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+// the conditions an item may be in, as bits of its alarm state...
+enum AlarmKind
+{
+  ALARM_HIHI = 1,
+  ALARM_HI = 2,
+  ALARM_LO = 4,
+  ALARM_LOLO = 8,
+  ALARM_DEVIATION = 16,
+  ALARM_RATE = 32
+};
+
+static unsigned const ALARM_KINDS = 6;
+
+// the limits of a class of items, NaN where there is none. The deviation is the
+// distance allowed from the setpoint and the rate is in units per second. An alarm
+// clears once the value is back inside its limit by the hysteresis, per second for
+// the rate...
+struct AlarmLimits
+{
+  double hihi;
+  double hi;
+  double lo;
+  double lolo;
+  double setpoint;
+  double deviation;
+  double rate;
+  double hysteresis;
+};
+
+// an alarm raised or cleared. The value is the rate for a rate of change alarm...
+struct AlarmTransition
+{
+  int index;
+  AlarmKind kind;
+  bool active;
+  double value;
+  double limit;
+  long long time;
+};
+
+// limits without any alarm...
+AlarmLimits noLimits();
+
+// parses hihi:95,hi:90,lo:10,lolo:5,sp:50,dev:20,roc:5,hys:1, any of them in any order...
+bool parseLimits(string const & text, AlarmLimits & limits);
+
+// whether some alarm may be raised with the limits...
+bool hasLimits(AlarmLimits const & limits);
+
+char const * alarmName(AlarmKind kind);
+
+// appends ALARM|itemId|kind|ACTIVE or CLEAR|value|limit|time...
+void appendAlarm(string & message, string const & itemId, AlarmTransition const & transition);
+
+// evaluates the limits of the items as their values change. The limits and the state
+// of the items having some are kept as contiguous arrays, one lane per item, and only
+// the lanes of the items changed in a batch are gathered, so a batch costs the same
+// whatever the number of items with limits. The gathered lanes are checked with SIMD
+// compares, two conditions per alarm: the one raising it and the one keeping it, the
+// limit moved back by the hysteresis. The limits of an item come from its class, an
+// item id prefix, the longest matching one wins. Non numeric and bad values leave the
+// alarms as they are.
+class AlarmEngine
+{
+public:
+  AlarmEngine(function<string(int index)> itemIdFn);
+
+  // sets the limits of the items without a class...
+  void set_limits(AlarmLimits const & limits);
+  void set_limits(string const & prefix, AlarmLimits const & limits);
+
+  // evaluates count changed values, NaN for the bad and non numeric ones, and appends
+  // the alarms raised and cleared...
+  void evaluate(size_t count, int const * indexes, double const * values, long long const * times, vector<AlarmTransition> & transitions);
+
+  // appends the alarms active now...
+  void active(vector<AlarmTransition> & alarms) const;
+
+  // appends the ALARM messages of the transitions...
+  void format(vector<AlarmTransition> const & transitions, vector<string> & messages) const;
+
+  size_t active_count() const;
+  unsigned long long evaluated() const;
+
+private:
+  struct Lanes
+  {
+    vector<double> hihi;
+    vector<double> hi;
+    vector<double> lo;
+    vector<double> lolo;
+    vector<double> setpoint;
+    vector<double> deviation;
+    vector<double> rate;
+    vector<double> hysteresis;
+
+    void resize(size_t size);
+    void copy(size_t to, Lanes const & from, size_t lane);
+    void set(size_t lane, AlarmLimits const & limits);
+  };
+
+  AlarmLimits default_limits;
+  vector<pair<string, AlarmLimits>> classes;
+  function<string(int index)> itemId;
+
+  mutable boost::mutex mtx;
+  vector<int> item_lanes;
+
+  // the limits and the state of each lane...
+  Lanes limits;
+  vector<int> lane_items;
+  vector<double> last_values;
+  vector<long long> last_times;
+  vector<double> last_rates;
+  vector<unsigned char> states;
+  vector<unsigned> marks;
+
+  // gathered lanes of the batch being evaluated, kept to reuse their memory...
+  Lanes batch;
+  vector<int> batch_lanes;
+  vector<double> batch_values;
+  vector<double> batch_rates;
+  vector<unsigned char> raise;
+  vector<unsigned char> keep;
+  unsigned batches;
+
+  size_t active_alarms;
+  unsigned long long evaluations;
+
+  int lane(int index);
+  AlarmLimits const & find(string const & itemId) const;
+  void flush(vector<AlarmTransition> & transitions);
+  void compare(size_t count);
+
+  static double limit(Lanes const & lanes, size_t lane, AlarmKind kind);
+};
@@ -0,0 +1,101 @@
+#include "bit-stream.h"
+
+BitWriter::BitWriter() :
+length(0)
+{
+}
+
+
+void BitWriter::write(uint64_t value, int count)
+{
+  while (count > 0)
+  {
+    size_t used = length & 7;
+
+    if (used == 0)
+      buffer.push_back(0);
+
+    // fills what is left of the last byte...
+    int room = 8 - static_cast<int>(used);
+    int taken = count < room ? count : room;
+    uint8_t bits = static_cast<uint8_t>((value >> (count - taken)) & ((1u << taken) - 1));
+
+    buffer.back() |= static_cast<uint8_t>(bits << (room - taken));
+
+    length += taken;
+    count -= taken;
+  }
+}
+
+
+void BitWriter::write_bit(bool bit)
+{
+  write(bit ? 1 : 0, 1);
+}
+
+
+void BitWriter::clear()
+{
+  buffer.clear();
+  length = 0;
+}
+
+
+size_t BitWriter::bits() const
+{
+  return length;
+}
+
+
+vector<uint8_t> const & BitWriter::bytes() const
+{
+  return buffer;
+}
+
+
+BitReader::BitReader(uint8_t const * data, size_t size) :
+data(data),
+size(size),
+position(0),
+past_end(false)
+{
+}
+
+
+uint64_t BitReader::read(int count)
+{
+  uint64_t value = 0;
+
+  while (count > 0)
+  {
+    if (position / 8 >= size)
+    {
+      past_end = true;
+      return count < 64 ? value << count : 0;
+    }
+
+    size_t used = position & 7;
+    int room = 8 - static_cast<int>(used);
+    int taken = count < room ? count : room;
+    uint8_t bits = static_cast<uint8_t>((data[position / 8] >> (room - taken)) & ((1u << taken) - 1));
+
+    value = (value << taken) | bits;
+
+    position += taken;
+    count -= taken;
+  }
+
+  return value;
+}
+
+
+bool BitReader::read_bit()
+{
+  return read(1) != 0;
+}
+
+
+bool BitReader::overrun() const
+{
+  return past_end;
+}
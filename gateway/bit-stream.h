@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// appends bits to a byte buffer, most significant bit first...
+class BitWriter
+{
+public:
+  BitWriter();
+
+  // writes the low count bits of value, count up to 64...
+  void write(uint64_t value, int count);
+  void write_bit(bool bit);
+
+  void clear();
+
+  size_t bits() const;
+  vector<uint8_t> const & bytes() const;
+
+private:
+  vector<uint8_t> buffer;
+  size_t length;
+};
+
+
+// reads the bits written by a BitWriter...
+class BitReader
+{
+public:
+  BitReader(uint8_t const * data, size_t size);
+
+  uint64_t read(int count);
+  bool read_bit();
+
+  // true once a read went past the end of the data...
+  bool overrun() const;
+
+private:
+  uint8_t const * data;
+  size_t size;
+  size_t position;
+  bool past_end;
+};
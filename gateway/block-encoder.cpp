@@ -0,0 +1,287 @@
+#include "block-encoder.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// both take a non zero value...
+static int leading_zeros(uint64_t value)
+{
+#ifdef _MSC_VER
+  unsigned long bit;
+
+  if (_BitScanReverse(&bit, static_cast<unsigned long>(value >> 32)))
+    return 31 - bit;
+
+  _BitScanReverse(&bit, static_cast<unsigned long>(value));
+  return 63 - bit;
+#else
+  return __builtin_clzll(value);
+#endif
+}
+
+
+static int trailing_zeros(uint64_t value)
+{
+#ifdef _MSC_VER
+  unsigned long bit;
+
+  if (_BitScanForward(&bit, static_cast<unsigned long>(value)))
+    return bit;
+
+  _BitScanForward(&bit, static_cast<unsigned long>(value >> 32));
+  return bit + 32;
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+
+// the delta of delta ranges, each with its prefix and the bits of its value...
+struct DeltaRange
+{
+  long long low;
+  long long high;
+  uint64_t prefix;
+  int prefix_bits;
+  int value_bits;
+};
+
+static DeltaRange const DELTA_RANGES[] =
+{
+  { -63, 64, 0x2, 2, 7 },
+  { -255, 256, 0x6, 3, 9 },
+  { -2047, 2048, 0xe, 4, 12 },
+};
+
+
+BlockEncoder::BlockEncoder()
+{
+  clear();
+}
+
+
+void BlockEncoder::append(Sample const & sample)
+{
+  if (samples == 0)
+  {
+    bits.write(static_cast<uint64_t>(sample.timestamp), 64);
+    bits.write(to_bits(sample.number), 64);
+    bits.write(sample.quality, 16);
+
+    first_timestamp = sample.timestamp;
+    previous_timestamp = sample.timestamp;
+    previous_value = to_bits(sample.number);
+    previous_quality = sample.quality;
+  }
+  else
+  {
+    append_timestamp(sample.timestamp);
+    append_value(sample.number);
+
+    if (sample.quality == previous_quality)
+    {
+      bits.write_bit(false);
+    }
+    else
+    {
+      bits.write_bit(true);
+      bits.write(sample.quality, 16);
+      previous_quality = sample.quality;
+    }
+  }
+
+  ++samples;
+}
+
+
+void BlockEncoder::clear()
+{
+  bits.clear();
+  samples = 0;
+  first_timestamp = 0;
+  previous_timestamp = 0;
+  previous_delta = 0;
+  previous_value = 0;
+  previous_leading = -1;
+  previous_trailing = 0;
+  previous_quality = 0;
+}
+
+
+size_t BlockEncoder::count() const
+{
+  return samples;
+}
+
+
+long long BlockEncoder::first() const
+{
+  return first_timestamp;
+}
+
+
+long long BlockEncoder::last() const
+{
+  return previous_timestamp;
+}
+
+
+vector<uint8_t> const & BlockEncoder::bytes() const
+{
+  return bits.bytes();
+}
+
+
+void BlockEncoder::append_timestamp(long long timestamp)
+{
+  long long delta = timestamp - previous_timestamp;
+  long long dod = delta - previous_delta;
+
+  previous_timestamp = timestamp;
+  previous_delta = delta;
+
+  if (dod == 0)
+  {
+    bits.write_bit(false);
+    return;
+  }
+
+  for (size_t i = 0; i < sizeof(DELTA_RANGES) / sizeof(DELTA_RANGES[0]); i++)
+  {
+    DeltaRange const & range = DELTA_RANGES[i];
+
+    if (dod >= range.low && dod <= range.high)
+    {
+      bits.write(range.prefix, range.prefix_bits);
+      bits.write(static_cast<uint64_t>(dod - range.low), range.value_bits);
+      return;
+    }
+  }
+
+  bits.write(0xf, 4);
+  bits.write(static_cast<uint64_t>(dod), 64);
+}
+
+
+void BlockEncoder::append_value(double number)
+{
+  uint64_t value = to_bits(number);
+  uint64_t difference = value ^ previous_value;
+
+  previous_value = value;
+
+  if (difference == 0)
+  {
+    bits.write_bit(false);
+    return;
+  }
+
+  bits.write_bit(true);
+
+  int leading = min(leading_zeros(difference), 31);
+  int trailing = trailing_zeros(difference);
+
+  // the meaningful bits fit in the window of the previous value...
+  if (previous_leading >= 0 && leading >= previous_leading && trailing >= previous_trailing)
+  {
+    bits.write_bit(false);
+    bits.write(difference >> previous_trailing, 64 - previous_leading - previous_trailing);
+    return;
+  }
+
+  int meaningful = 64 - leading - trailing;
+
+  bits.write_bit(true);
+  bits.write(leading, 5);
+  bits.write(meaningful & 63, 6);
+  bits.write(difference >> trailing, meaningful);
+
+  previous_leading = leading;
+  previous_trailing = trailing;
+}
+
+
+void BlockEncoder::decode(uint8_t const * data, size_t size, size_t count, long long from, long long to, vector<Sample> & output)
+{
+  BitReader reader(data, size);
+
+  if (count == 0)
+    return;
+
+  Sample sample;
+  sample.timestamp = static_cast<long long>(reader.read(64));
+  uint64_t value = reader.read(64);
+  sample.number = from_bits(value);
+  sample.quality = static_cast<Quality>(reader.read(16));
+
+  long long delta = 0;
+  int leading = 0;
+  int trailing = 0;
+
+  for (size_t i = 0; ; )
+  {
+    if (sample.timestamp >= from && sample.timestamp <= to)
+      output.push_back(sample);
+
+    // the samples are in order, nothing after this one is in the range...
+    if (sample.timestamp > to || ++i == count || reader.overrun())
+      return;
+
+    long long dod = 0;
+
+    if (reader.read_bit())
+    {
+      size_t r = 0;
+
+      while (r < sizeof(DELTA_RANGES) / sizeof(DELTA_RANGES[0]) && reader.read_bit())
+        r++;
+
+      if (r < sizeof(DELTA_RANGES) / sizeof(DELTA_RANGES[0]))
+        dod = static_cast<long long>(reader.read(DELTA_RANGES[r].value_bits)) + DELTA_RANGES[r].low;
+      else
+        dod = static_cast<long long>(reader.read(64));
+    }
+
+    delta += dod;
+    sample.timestamp += delta;
+
+    if (reader.read_bit())
+    {
+      if (reader.read_bit())
+      {
+        leading = static_cast<int>(reader.read(5));
+        int meaningful = static_cast<int>(reader.read(6));
+
+        if (meaningful == 0)
+          meaningful = 64;
+
+        trailing = 64 - leading - meaningful;
+      }
+
+      value ^= reader.read(64 - leading - trailing) << trailing;
+      sample.number = from_bits(value);
+    }
+
+    if (reader.read_bit())
+      sample.quality = static_cast<Quality>(reader.read(16));
+  }
+}
+
+
+uint64_t BlockEncoder::to_bits(double number)
+{
+  uint64_t value;
+  memcpy(&value, &number, sizeof(value));
+
+  return value;
+}
+
+
+double BlockEncoder::from_bits(uint64_t value)
+{
+  double number;
+  memcpy(&number, &value, sizeof(number));
+
+  return number;
+}
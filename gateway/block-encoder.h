@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bit-stream.h"
+#include "history.h"
+
+using namespace std;
+
+// the samples of one item compressed Gorilla style. The first sample is stored as
+// is, then each timestamp as the delta of its delta and each value as the XOR with
+// the previous one, keeping only the meaningful bits. Regular periods and values
+// that hold take a couple of bits per sample. The quality takes one bit unless it
+// changes.
+class BlockEncoder
+{
+public:
+  BlockEncoder();
+
+  void append(Sample const & sample);
+
+  // starts a new block, the next sample is stored as is...
+  void clear();
+
+  size_t count() const;
+  long long first() const;
+  long long last() const;
+  vector<uint8_t> const & bytes() const;
+
+  // appends the samples of a block with from <= timestamp <= to...
+  static void decode(uint8_t const * data, size_t size, size_t count, long long from, long long to, vector<Sample> & samples);
+
+private:
+  BitWriter bits;
+  size_t samples;
+  long long first_timestamp;
+  long long previous_timestamp;
+  long long previous_delta;
+  uint64_t previous_value;
+  int previous_leading;
+  int previous_trailing;
+  Quality previous_quality;
+
+  void append_timestamp(long long timestamp);
+  void append_value(double number);
+
+  static uint64_t to_bits(double number);
+  static double from_bits(uint64_t bits);
+};
@@ -0,0 +1,328 @@
+#include "calculated-tags.h"
+
+CalculatedTags::CalculatedTags(int firstIndex) :
+first_index(firstIndex),
+unresolved_count(0),
+last_resolve(0),
+batches(0),
+runs(0)
+{
+}
+
+
+bool CalculatedTags::define(string const & id, string const & text, string & error)
+{
+  // a tag used before its definition could close a cycle...
+  if (tag_ids.count(id) != 0 || slot_ids.count(id) != 0)
+  {
+    error = id + " is already used";
+    return false;
+  }
+
+  unique_ptr<Tag> tag(new Tag());
+
+  if (!tag->expression.compile(text, error))
+    return false;
+
+  vector<string> const & inputs = tag->expression.inputs();
+
+  if (find(inputs.begin(), inputs.end(), id) != inputs.end())
+  {
+    error = id + " uses itself";
+    return false;
+  }
+
+  int number = static_cast<int>(tags.size());
+
+  tag->info = CalculatedTag{ id, first_index - number, text, tag->expression.size() };
+  tag->slot = -1;
+  tag->level = 0;
+  tag->known = false;
+  tag->value.handle = 0;
+  tag->value.index = tag->info.index;
+  tag->value.value.type = TYPE_R8;
+  tag->value.value.real = 0;
+  tag->value.quality = QUALITY_BAD;
+  tag->value.timestamp = 0;
+
+  for (auto i = inputs.begin(); i != inputs.end(); ++i)
+  {
+    auto found = slot_ids.find(*i);
+    int s;
+
+    if (found != slot_ids.end())
+      s = found->second;
+    else
+    {
+      s = static_cast<int>(slots.size());
+      slots.push_back(Slot{ *i, -1, QUALITY_BAD, 0, false, vector<int>() });
+      values.push_back(numeric_limits<double>::quiet_NaN());
+      slot_ids[*i] = s;
+
+      auto defined = tag_ids.find(*i);
+
+      // a tag using another one is run when the other one changes...
+      if (defined != tag_ids.end())
+      {
+        slots[s].index = tags[defined->second]->info.index;
+        tags[defined->second]->slot = s;
+      }
+      else
+      {
+        unresolved_slots.push_back(s);
+        unresolved_count++;
+      }
+    }
+
+    slots[s].users.push_back(number);
+    tag->inputs.push_back(s);
+
+    auto used = tag_ids.find(*i);
+
+    if (used != tag_ids.end())
+      tag->level = max(tag->level, tags[used->second]->level + 1);
+  }
+
+  if (tag->level >= levels.size())
+    levels.resize(tag->level + 1);
+
+  tag_ids[id] = number;
+  tags.push_back(move(tag));
+  marks.push_back(0);
+
+  // the inputs of the new tag are looked up with the next batch...
+  last_resolve = 0;
+
+  return true;
+}
+
+
+void CalculatedTags::set_resolver(InputResolver inputResolver)
+{
+  resolver = inputResolver;
+}
+
+
+void CalculatedTags::update(ChangeSet & changes)
+{
+  if (tags.empty())
+    return;
+
+  resolve();
+
+  // 0 is never a batch, so no tag is taken as marked in this one...
+  if (++batches == 0)
+    batches = 1;
+
+  size_t count = changes.changed.size();
+
+  for (size_t c = 0; c < count; c++)
+  {
+    ItemValue const & value = *changes.changed[c];
+
+    if (value.index < 0 || static_cast<size_t>(value.index) >= item_slots.size())
+      continue;
+
+    int s = item_slots[value.index];
+
+    if (s < 0)
+      continue;
+
+    set(s, value);
+    mark(s);
+  }
+
+  for (auto l = levels.begin(); l != levels.end(); ++l)
+  {
+    for (auto t = l->begin(); t != l->end(); ++t)
+    {
+      Tag & tag = *tags[*t];
+
+      if (!run(tag))
+      {
+        if (tag.known)
+          changes.repeated.push_back(tag.info.index);
+
+        continue;
+      }
+
+      changes.changed.push_back(&tag.value);
+
+      // the tags using this one are on higher levels, they run after it...
+      if (tag.slot >= 0)
+      {
+        set(tag.slot, tag.value);
+        mark(tag.slot);
+      }
+    }
+
+    l->clear();
+  }
+}
+
+
+bool CalculatedTags::empty() const
+{
+  return tags.empty();
+}
+
+
+bool CalculatedTags::calculated(int index) const
+{
+  return index <= first_index && index > first_index - static_cast<int>(tags.size());
+}
+
+
+bool CalculatedTags::item_info(string const & id, ItemInfo & item) const
+{
+  if (tag_ids.empty())
+    return false;
+
+  auto found = tag_ids.find(id);
+
+  if (found == tag_ids.end())
+    return false;
+
+  item.id = id;
+  item.handle = 0;
+  item.dataType = TYPE_R8;
+  item.index = tags[found->second]->info.index;
+
+  return true;
+}
+
+
+string CalculatedTags::item_id(int index) const
+{
+  return calculated(index) ? tags[first_index - index]->info.id : string();
+}
+
+
+vector<CalculatedTag> CalculatedTags::list() const
+{
+  vector<CalculatedTag> list;
+
+  for (auto t = tags.begin(); t != tags.end(); ++t)
+    list.push_back((*t)->info);
+
+  return list;
+}
+
+
+unsigned long long CalculatedTags::evaluations() const
+{
+  return runs.load();
+}
+
+
+size_t CalculatedTags::unresolved() const
+{
+  return unresolved_count.load();
+}
+
+
+void CalculatedTags::resolve()
+{
+  if (unresolved_slots.empty() || !resolver)
+    return;
+
+  long long now = boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+
+  if (last_resolve != 0 && now - last_resolve < CALCULATED_RESOLVE_INTERVAL)
+    return;
+
+  last_resolve = now;
+
+  for (size_t u = 0; u < unresolved_slots.size();)
+  {
+    int s = unresolved_slots[u];
+    int index = resolver(slots[s].id);
+
+    if (index < 0)
+    {
+      u++;
+      continue;
+    }
+
+    if (static_cast<size_t>(index) >= item_slots.size())
+      item_slots.resize(index + 1, -1);
+
+    slots[s].index = index;
+    item_slots[index] = s;
+
+    unresolved_slots[u] = unresolved_slots.back();
+    unresolved_slots.pop_back();
+    unresolved_count--;
+  }
+}
+
+
+void CalculatedTags::set(int s, ItemValue const & value)
+{
+  Slot & slot = slots[s];
+  double number = numeric_limits<double>::quiet_NaN();
+
+  // a text is no number, the tags using it go bad...
+  toDouble(value.value, number);
+
+  values[s] = number;
+  slot.quality = number == number ? value.quality : QUALITY_BAD;
+  slot.timestamp = value.timestamp;
+  slot.known = true;
+}
+
+
+void CalculatedTags::mark(int s)
+{
+  vector<int> const & users = slots[s].users;
+
+  for (auto u = users.begin(); u != users.end(); ++u)
+  {
+    if (marks[*u] == batches)
+      continue;
+
+    marks[*u] = batches;
+    levels[tags[*u]->level].push_back(*u);
+  }
+}
+
+
+bool CalculatedTags::run(Tag & tag)
+{
+  Quality quality = QUALITY_GOOD;
+  unsigned long long timestamp = 0;
+
+  for (auto i = tag.inputs.begin(); i != tag.inputs.end(); ++i)
+  {
+    Slot const & slot = slots[*i];
+
+    if (!slot.known)
+      return false;
+
+    // bad, uncertain and good are in this order...
+    if ((slot.quality & QUALITY_MASK) < (quality & QUALITY_MASK))
+      quality = static_cast<Quality>(slot.quality & QUALITY_MASK);
+
+    timestamp = max(timestamp, slot.timestamp);
+  }
+
+  double result = tag.expression.run(values.data(), tag.inputs.data());
+  runs++;
+
+  if (result != result || result == numeric_limits<double>::infinity() || result == -numeric_limits<double>::infinity())
+    quality = QUALITY_BAD;
+
+  // the same value only refreshes the time, as a repeated value of a source item...
+  bool same = tag.known && tag.value.quality == quality && (tag.value.value.real == result || (result != result && tag.value.value.real != tag.value.value.real));
+
+  tag.value.timestamp = timestamp;
+
+  if (same)
+    return false;
+
+  tag.known = true;
+  tag.value.value.real = result;
+  tag.value.quality = quality;
+
+  return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <boost/chrono.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "change-detector.h"
+#include "expression.h"
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+// ms between two lookups of the inputs not found yet...
+static long long const CALCULATED_RESOLVE_INTERVAL = 1000;
+
+// finds the index of a source item by id, -1 when there is none...
+typedef function<int(string const & itemId)> InputResolver;
+
+struct CalculatedTag
+{
+  string id;
+  int index;
+  string text;
+
+  // bytes of compiled code...
+  size_t size;
+};
+
+// virtual items whose values are expressions over other items. A calculated tag takes
+// an index of the cache, from the last one down, so its values go to the cache, the
+// history and the subscribers as the ones of a source item. The inputs of all the
+// tags share slots holding their last values, and each slot lists the tags using it,
+// so a batch only runs the expressions of the tags with a changed input. A tag may use
+// the tags defined before it, so the graph has no cycles. The level of a tag is one
+// more than the highest of the tags it uses, the tags of a batch run level by level,
+// each once, after the ones they use.
+// The result is an R8 with the worst quality of the inputs, bad when it isn't a
+// number, and a tag gets its first value once all its inputs have one.
+class CalculatedTags
+{
+public:
+  // the first tag gets the given index, the next one the index below...
+  CalculatedTags(int firstIndex);
+
+  // defines a tag, fails on a syntax error or an id already used...
+  bool define(string const & id, string const & text, string & error);
+
+  // looks up the inputs that are source items, they may be added later...
+  void set_resolver(InputResolver resolver);
+
+  // takes the changes of a batch and appends the values of the tags they change, the
+  // tags run again to the same value go to the repeated ones. The values stay valid
+  // until the next update...
+  void update(ChangeSet & changes);
+
+  bool empty() const;
+  bool calculated(int index) const;
+
+  // finds a tag by id, as a read only R8 item...
+  bool item_info(string const & id, ItemInfo & item) const;
+  string item_id(int index) const;
+
+  vector<CalculatedTag> list() const;
+
+  // expressions run, and inputs not found yet...
+  unsigned long long evaluations() const;
+  size_t unresolved() const;
+
+private:
+  struct Tag
+  {
+    CalculatedTag info;
+    Expression expression;
+    vector<int> inputs;
+
+    // the slot of the tag when other tags use it, -1 otherwise...
+    int slot;
+    size_t level;
+
+    ItemValue value;
+    bool known;
+  };
+
+  struct Slot
+  {
+    string id;
+    int index;
+    Quality quality;
+    unsigned long long timestamp;
+    bool known;
+    vector<int> users;
+  };
+
+  int first_index;
+  vector<unique_ptr<Tag>> tags;
+  unordered_map<string, int> tag_ids;
+
+  // the values are apart, the expressions read them by slot...
+  vector<Slot> slots;
+  vector<double> values;
+  unordered_map<string, int> slot_ids;
+
+  // the slot of each source item, -1 when no tag uses it...
+  vector<int> item_slots;
+  vector<int> unresolved_slots;
+  atomic<size_t> unresolved_count;
+  InputResolver resolver;
+  long long last_resolve;
+
+  // the tags to run in the batch, by level...
+  vector<vector<int>> levels;
+  vector<unsigned> marks;
+  unsigned batches;
+
+  atomic<unsigned long long> runs;
+
+  void resolve();
+  void set(int slot, ItemValue const & value);
+  void mark(int slot);
+
+  // whether the value of the tag changed...
+  bool run(Tag & tag);
+};
@@ -0,0 +1,296 @@
+#include "capture.h"
+
+template <typename T>
+static void put(string & buffer, T const & value)
+{
+  buffer.append(reinterpret_cast<char const *>(&value), sizeof(value));
+}
+
+
+template <typename T>
+static bool get(ifstream & file, T & value)
+{
+  return file.read(reinterpret_cast<char *>(&value), sizeof(value)).good();
+}
+
+
+// the types saved as the 8 bytes of the value, the others are text...
+static bool isRaw(ValueType type)
+{
+  return type == TYPE_EMPTY || isNumeric(type);
+}
+
+
+CaptureWriter::CaptureWriter(string const & path, function<ItemInfo(size_t index)> itemInfoFn) :
+file(path.c_str(), ios::binary | ios::trunc),
+itemInfo(itemInfoFn),
+start(boost::chrono::steady_clock::now())
+{
+  put(buffer, CAPTURE_MAGIC);
+  file.write(buffer.data(), buffer.size());
+}
+
+
+void CaptureWriter::write(vector<unique_ptr<ItemValue>> const & batch)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  buffer.clear();
+
+  for (auto v = batch.begin(); v != batch.end(); ++v)
+  {
+    int index = (*v)->index;
+
+    if (index >= 0 && (static_cast<size_t>(index) >= described.size() || !described[index]))
+      describe(index);
+  }
+
+  buffer.push_back(CAPTURE_BATCH);
+  put(buffer, static_cast<int64_t>(boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start).count()));
+  put(buffer, static_cast<uint32_t>(batch.size()));
+
+  for (auto v = batch.begin(); v != batch.end(); ++v)
+  {
+    ItemValue & value = **v;
+
+    put(buffer, static_cast<uint32_t>(value.handle));
+    put(buffer, static_cast<int32_t>(value.index));
+    put(buffer, static_cast<uint16_t>(value.value.type));
+    put(buffer, static_cast<uint16_t>(value.quality));
+    put(buffer, static_cast<uint64_t>(value.timestamp));
+
+    if (isRaw(value.value.type))
+    {
+      uint64_t bits;
+      memcpy(&bits, &value.value.natural, sizeof(bits));
+
+      put(buffer, bits);
+    }
+    else
+    {
+      put(buffer, static_cast<uint32_t>(value.value.text.size()));
+      buffer.append(value.value.text);
+    }
+  }
+
+  file.write(buffer.data(), buffer.size());
+}
+
+
+bool CaptureWriter::good() const
+{
+  return file.good();
+}
+
+
+void CaptureWriter::describe(int index)
+{
+  if (static_cast<size_t>(index) >= described.size())
+    described.resize(index + 1, false);
+
+  ItemInfo info = itemInfo(index);
+
+  buffer.push_back(CAPTURE_ITEM);
+  put(buffer, static_cast<int32_t>(index));
+  put(buffer, static_cast<uint32_t>(info.handle));
+  put(buffer, static_cast<uint16_t>(info.dataType));
+  put(buffer, static_cast<uint16_t>(info.id.size()));
+  buffer.append(info.id);
+
+  described[index] = true;
+}
+
+
+CaptureReader::CaptureReader(string const & path) :
+file(path.c_str(), ios::binary),
+valid(false),
+started(false),
+first(0)
+{
+  uint64_t magic = 0;
+
+  if (!get(file, magic) || magic != CAPTURE_MAGIC)
+    return;
+
+  valid = true;
+
+  // a first pass gets the items...
+  long long offset;
+  vector<unique_ptr<ItemValue>> batch;
+
+  while (next(offset, batch))
+    ;
+
+  rewind();
+}
+
+
+bool CaptureReader::good() const
+{
+  return valid;
+}
+
+
+bool CaptureReader::next(long long & offset, vector<unique_ptr<ItemValue>> & batch)
+{
+  batch.clear();
+
+  char type;
+
+  while (valid && get(file, type))
+  {
+    if (type == CAPTURE_ITEM)
+    {
+      if (!read_item())
+        return false;
+
+      continue;
+    }
+
+    if (type != CAPTURE_BATCH)
+      return false;
+
+    int64_t captured;
+    uint32_t count;
+
+    if (!get(file, captured) || !get(file, count))
+      return false;
+
+    if (!started)
+    {
+      started = true;
+      first = captured;
+    }
+
+    offset = captured - first;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t handle;
+      int32_t index;
+      uint16_t type;
+      uint16_t quality;
+      uint64_t timestamp;
+
+      if (!get(file, handle) || !get(file, index) || !get(file, type) || !get(file, quality) || !get(file, timestamp))
+        return false;
+
+      unique_ptr<ItemValue> value = make_unique<ItemValue>();
+      value->handle = handle;
+      value->index = index;
+      value->quality = quality;
+      value->timestamp = timestamp;
+      value->value.type = static_cast<ValueType>(type);
+
+      if (isRaw(value->value.type))
+      {
+        uint64_t bits;
+
+        if (!get(file, bits))
+          return false;
+
+        memcpy(&value->value.natural, &bits, sizeof(bits));
+      }
+      else
+      {
+        uint32_t length;
+
+        if (!get(file, length))
+          return false;
+
+        value->value.text.assign(length, '\0');
+
+        if (length > 0 && !file.read(&value->value.text[0], length))
+          return false;
+      }
+
+      batch.push_back(move(value));
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+
+void CaptureReader::rewind()
+{
+  file.clear();
+  file.seekg(sizeof(CAPTURE_MAGIC));
+
+  started = false;
+}
+
+
+vector<ItemInfo> const & CaptureReader::items() const
+{
+  return table;
+}
+
+
+bool CaptureReader::read_item()
+{
+  int32_t index;
+  uint32_t handle;
+  uint16_t dataType;
+  uint16_t length;
+
+  if (!get(file, index) || !get(file, handle) || !get(file, dataType) || !get(file, length) || index < 0)
+    return false;
+
+  string id(length, '\0');
+
+  if (length > 0 && !file.read(&id[0], length))
+    return false;
+
+  if (static_cast<size_t>(index) >= table.size())
+  {
+    size_t from = table.size();
+    table.resize(index + 1);
+
+    for (size_t i = from; i < table.size(); i++)
+      table[i] = ItemInfo{ string(), 0, TYPE_EMPTY, static_cast<int>(i) };
+  }
+
+  table[index].id = id;
+  table[index].handle = handle;
+  table[index].dataType = static_cast<ValueType>(dataType);
+  table[index].index = index;
+
+  return true;
+}
+
+
+ReplayStats replay(CaptureReader & reader, double speed, DataChangeHandler handler)
+{
+  ReplayStats stats = { 0, 0, 0, 0 };
+
+  long long offset;
+  vector<unique_ptr<ItemValue>> batch;
+  boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+
+  while (reader.next(offset, batch))
+  {
+    if (speed > 0)
+    {
+      boost::chrono::steady_clock::time_point due = start + boost::chrono::microseconds(static_cast<long long>(offset / speed));
+      boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+
+      // a batch fed late tells the pipeline doesn't keep up with the pace...
+      if (due > now)
+        boost::this_thread::sleep_until(due);
+      else
+        stats.max_lag = max(stats.max_lag, static_cast<long long>(boost::chrono::duration_cast<boost::chrono::microseconds>(now - due).count()));
+    }
+
+    handler(batch);
+
+    stats.batches++;
+    stats.values += batch.size();
+  }
+
+  stats.elapsed = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start).count();
+
+  return stats;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+static uint64_t const CAPTURE_MAGIC = 0x3230504143435044ULL;
+
+// the records of a capture file, each starting with its type...
+static char const CAPTURE_ITEM = 'I';
+static char const CAPTURE_BATCH = 'B';
+
+struct ReplayStats
+{
+  unsigned long long batches;
+  unsigned long long values;
+  long long elapsed;
+  long long max_lag;
+};
+
+// saves the data change batches, as the server sent them, to a file. Each batch has
+// the microseconds since the capture started, then the handle, index, type, quality,
+// timestamp and value of every item. The numbers are saved as the 8 bytes of the
+// value, the others as text. An item is described (index, handle, type, id) the first time one
+// of its values is saved, so a replay knows the items without the server.
+class CaptureWriter
+{
+public:
+  CaptureWriter(string const & path, function<ItemInfo(size_t index)> itemInfoFn);
+
+  void write(vector<unique_ptr<ItemValue>> const & batch);
+
+  bool good() const;
+
+private:
+  boost::mutex mtx;
+  ofstream file;
+  function<ItemInfo(size_t index)> itemInfo;
+  vector<bool> described;
+  boost::chrono::steady_clock::time_point start;
+  string buffer;
+
+  void describe(int index);
+};
+
+
+// reads the batches of a capture file back. The items are read when the file is
+// opened, so they are known before the first batch...
+class CaptureReader
+{
+public:
+  CaptureReader(string const & path);
+
+  bool good() const;
+
+  // reads the next batch and the microseconds it came after the first one, false at
+  // the end of the file. The previous batch is cleared...
+  bool next(long long & offset, vector<unique_ptr<ItemValue>> & batch);
+
+  // goes back to the first batch...
+  void rewind();
+
+  // the captured items, by index. An index without values has an empty id...
+  vector<ItemInfo> const & items() const;
+
+private:
+  ifstream file;
+  bool valid;
+  vector<ItemInfo> table;
+
+  // the offset of the first batch, the others are given from it...
+  bool started;
+  long long first;
+
+  bool read_item();
+};
+
+
+// feeds the batches of a capture to the handler, paced as they were captured and sped
+// up by speed. A speed of 0 feeds them as fast as the handler takes them...
+ReplayStats replay(CaptureReader & reader, double speed, DataChangeHandler handler);
@@ -0,0 +1,229 @@
+#include "change-bus.h"
+
+// an idle thread spins, then yields, then parks. A parked thread is woken by the
+// cursor it waits on, the timeout is only a safety net...
+static unsigned const BUS_SPINS = 1000;
+static unsigned const BUS_YIELDS = 100;
+static long long const BUS_PARK_TIME = 1000;
+
+ChangeBus::ChangeBus(size_t size) :
+mask(0),
+running(false),
+full(0),
+sleepers(0)
+{
+  size_t rounded = 1;
+
+  while (rounded < size)
+    rounded <<= 1;
+
+  ring.resize(rounded);
+  mask = rounded - 1;
+}
+
+
+ChangeBus::~ChangeBus()
+{
+  stop();
+}
+
+
+int ChangeBus::add_consumer(string const & name, ChangeEventHandler handler, vector<int> const & dependencies)
+{
+  unique_ptr<Consumer> consumer(new Consumer());
+  consumer->name = name;
+  consumer->handler = handler;
+  consumer->batches = 0;
+
+  for (auto d = dependencies.begin(); d != dependencies.end(); ++d)
+    consumer->dependencies.push_back(consumers.at(*d).get());
+
+  // a consumer added late starts with the next event...
+  consumer->cursor.sequence = published.sequence.load();
+
+  consumers.push_back(move(consumer));
+
+  return static_cast<int>(consumers.size() - 1);
+}
+
+
+void ChangeBus::start()
+{
+  running = true;
+
+  for (auto c = consumers.begin(); c != consumers.end(); ++c)
+    (*c)->thread = boost::thread(boost::bind(&ChangeBus::run, this, boost::ref(**c)));
+}
+
+
+void ChangeBus::stop()
+{
+  if (!running.exchange(false))
+    return;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mtx);
+    cv.notify_all();
+  }
+
+  for (auto c = consumers.begin(); c != consumers.end(); ++c)
+    (*c)->thread.join();
+}
+
+
+void ChangeBus::publish(vector<ItemValue const *> const & values, long long time)
+{
+  long long next = published.sequence.load(memory_order_relaxed);
+  size_t done = 0;
+
+  while (done < values.size())
+  {
+    size_t count = min(values.size() - done, ring.size());
+    long long last = next + static_cast<long long>(count);
+
+    // the slots are free once every consumer has handled what they had...
+    long long wrap = last - static_cast<long long>(ring.size());
+
+    if (slowest() < wrap)
+    {
+      full++;
+      park([&]() { return slowest() >= wrap || !running; });
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+      ItemValue const & value = *values[done + i];
+      ChangeEvent & event = ring[static_cast<size_t>(next + 1 + i) & mask];
+
+      event.index = value.index;
+      event.value = value.value;
+      event.quality = value.quality;
+      event.time = time;
+    }
+
+    published.sequence.store(last, memory_order_release);
+    wake();
+
+    next = last;
+    done += count;
+  }
+}
+
+
+vector<ChangeBusStats> ChangeBus::stats() const
+{
+  vector<ChangeBusStats> stats;
+  long long last = published.sequence.load(memory_order_acquire);
+
+  for (auto c = consumers.begin(); c != consumers.end(); ++c)
+  {
+    long long sequence = (*c)->cursor.sequence.load(memory_order_acquire);
+
+    stats.push_back(ChangeBusStats{ (*c)->name, sequence, max(last - sequence, 0LL), (*c)->batches.load() });
+  }
+
+  return stats;
+}
+
+
+unsigned long long ChangeBus::stalls() const
+{
+  return full.load();
+}
+
+
+void ChangeBus::run(Consumer & consumer)
+{
+  long long next = consumer.cursor.sequence.load(memory_order_relaxed) + 1;
+
+  for (;;)
+  {
+    park([&]() { return available(consumer) >= next || !running; });
+
+    long long last = available(consumer);
+
+    // once stopped, a consumer leaves when it has seen everything published. It may
+    // still be waiting on a consumer it depends on...
+    if (last < next)
+    {
+      if (!running && last >= published.sequence.load(memory_order_acquire))
+        return;
+
+      boost::this_thread::yield();
+      continue;
+    }
+
+    for (long long s = next; s <= last; s++)
+      consumer.handler(ring[static_cast<size_t>(s) & mask], s == last);
+
+    consumer.cursor.sequence.store(last, memory_order_release);
+    consumer.batches++;
+
+    // the consumers depending on this one, or the publisher, may be parked...
+    wake();
+
+    next = last + 1;
+  }
+}
+
+
+long long ChangeBus::available(Consumer const & consumer) const
+{
+  long long last = published.sequence.load(memory_order_acquire);
+
+  for (auto d = consumer.dependencies.begin(); d != consumer.dependencies.end(); ++d)
+    last = min(last, (*d)->cursor.sequence.load(memory_order_acquire));
+
+  return last;
+}
+
+
+long long ChangeBus::slowest() const
+{
+  long long last = published.sequence.load(memory_order_relaxed);
+
+  for (auto c = consumers.begin(); c != consumers.end(); ++c)
+    last = min(last, (*c)->cursor.sequence.load(memory_order_acquire));
+
+  return last;
+}
+
+
+void ChangeBus::park(function<bool()> const & ready)
+{
+  for (unsigned spins = 0; !ready(); spins++)
+  {
+    if (spins < BUS_SPINS)
+      continue;
+
+    if (spins < BUS_SPINS + BUS_YIELDS)
+    {
+      boost::this_thread::yield();
+      continue;
+    }
+
+    boost::unique_lock<boost::mutex> lock(mtx);
+
+    // the cursor may have moved before the count went up, wake takes the lock to
+    // notify, so it can't notify between this check and the wait...
+    sleepers++;
+
+    if (!ready())
+      cv.wait_for(lock, boost::chrono::microseconds(BUS_PARK_TIME));
+
+    sleepers--;
+  }
+}
+
+
+void ChangeBus::wake()
+{
+  // orders the cursor that moved before the count of sleepers is read...
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (sleepers.load(memory_order_relaxed) == 0)
+    return;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+  cv.notify_all();
+}
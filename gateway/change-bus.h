@@ -0,0 +1,121 @@
+#pragma once
+
+#include <boost/thread.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+static size_t const CHANGE_BUS_SIZE = 65536;
+static size_t const CHANGE_BUS_LINE_SIZE = 64;
+
+// a change as the stages see it, copied into a slot of the ring. The slots are reused,
+// so a text value reuses the memory of the one before it...
+struct ChangeEvent
+{
+  int index;
+  Value value;
+  Quality quality;
+
+  // HistoryStore::now() of the batch...
+  long long time;
+};
+
+// called for each event of a batch, last is true on the last one so a stage can
+// flush what it has gathered...
+typedef function<void(ChangeEvent const & event, bool last)> ChangeEventHandler;
+
+struct ChangeBusStats
+{
+  string name;
+
+  // the last event handled, and how far behind the published ones it is...
+  long long sequence;
+  long long lag;
+
+  unsigned long long batches;
+};
+
+// a ring of pre-allocated events with one publisher and independent consumers, each
+// on its own thread with its own cursor. The publisher writes the changes of a batch
+// into the ring and moves the published cursor, a consumer handles everything
+// between its cursor and the published one as a batch, then moves its own. A
+// consumer may depend on others and then only gets the events they have handled.
+// The cursors are the only shared state, so nothing is locked while there is work:
+// an idle consumer parks on a condition after spinning a while, and the publisher
+// waits for the slowest consumer when the ring is full.
+class ChangeBus
+{
+public:
+  // the size is rounded up to a power of two...
+  ChangeBus(size_t size);
+  ~ChangeBus();
+
+  // adds a consumer seeing the events after the given ones, returns its id. The
+  // consumers are all added before the bus starts...
+  int add_consumer(string const & name, ChangeEventHandler handler, vector<int> const & dependencies = vector<int>());
+
+  void start();
+
+  // lets the consumers handle what was published, then stops them...
+  void stop();
+
+  // copies the changes into the ring, a batch larger than the ring goes in parts...
+  void publish(vector<ItemValue const *> const & values, long long time);
+
+  vector<ChangeBusStats> stats() const;
+
+  // times the publisher found the ring full...
+  unsigned long long stalls() const;
+
+private:
+  // a cursor has a cache line of its own, so moving it doesn't slow down the
+  // readers of the others...
+  struct Cursor
+  {
+    atomic<long long> sequence;
+    char padding[CHANGE_BUS_LINE_SIZE - sizeof(atomic<long long>)];
+
+    Cursor() : sequence(-1) {}
+  };
+
+  struct Consumer
+  {
+    Cursor cursor;
+    string name;
+    ChangeEventHandler handler;
+    vector<Consumer *> dependencies;
+    atomic<unsigned long long> batches;
+    boost::thread thread;
+  };
+
+  vector<ChangeEvent> ring;
+  size_t mask;
+
+  Cursor published;
+  vector<unique_ptr<Consumer>> consumers;
+  atomic<bool> running;
+  atomic<unsigned long long> full;
+
+  // the idle threads park here, the cursors are moved without it...
+  boost::mutex mtx;
+  boost::condition_variable cv;
+  atomic<int> sleepers;
+
+  void run(Consumer & consumer);
+
+  // the last event the consumer may handle...
+  long long available(Consumer const & consumer) const;
+
+  // the last event every consumer has handled...
+  long long slowest() const;
+
+  void park(function<bool()> const & ready);
+  void wake();
+};
@@ -0,0 +1,85 @@
+#include "change-detector.h"
+
+ChangeDetector::ChangeDetector() : batches(0)
+{
+}
+
+
+void ChangeDetector::detect(vector<unique_ptr<ItemValue>> const & batch, ChangeSet & changes)
+{
+  changes.clear();
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  // 0 is never a batch, so a new item is never taken as changed in this one...
+  if (++batches == 0)
+    batches = 1;
+
+  for (auto b = batch.begin(); b != batch.end(); ++b)
+  {
+    ItemValue const & value = **b;
+
+    if (value.index < 0)
+      continue;
+
+    size_t index = static_cast<size_t>(value.index);
+
+    if (index >= items.size())
+      items.resize(index + 1, ItemState{ 0, 0, 0, 0, 0, false });
+
+    ItemState & state = items[index];
+    bool text = is_text(value.value.type);
+
+    bool same = state.known && state.quality == value.quality && state.type == value.value.type;
+
+    if (same && text)
+      same = texts[index] == value.value.text;
+    else if (same)
+      same = state.bits == value.value.natural;
+
+    if (same)
+    {
+      changes.repeated.push_back(value.index);
+      continue;
+    }
+
+    state.known = true;
+    state.quality = value.quality;
+    state.type = static_cast<unsigned char>(value.value.type);
+    state.bits = text ? 0 : value.value.natural;
+
+    if (text)
+    {
+      if (index >= texts.size())
+        texts.resize(index + 1);
+
+      texts[index] = value.value.text;
+    }
+
+    // an item changed twice in the batch keeps its place with its newest value...
+    if (state.batch == batches)
+    {
+      changes.changed[state.slot] = &value;
+      continue;
+    }
+
+    state.batch = batches;
+    state.slot = static_cast<unsigned>(changes.changed.size());
+    changes.changed.push_back(&value);
+  }
+}
+
+
+void ChangeDetector::forget(int index)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  if (index >= 0 && static_cast<size_t>(index) < items.size())
+    items[index].known = false;
+}
+
+
+bool ChangeDetector::is_text(ValueType type)
+{
+  return type != TYPE_EMPTY && !isNumeric(type);
+}
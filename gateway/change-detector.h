@@ -0,0 +1,65 @@
+#pragma once
+
+#include <boost/thread/mutex.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+// what a batch changed: the items whose value or quality differs from their last
+// one, each listed once with its newest value, and the items that only repeated
+// their value. The values point into the batch, which must outlive the set...
+struct ChangeSet
+{
+  vector<ItemValue const *> changed;
+  vector<int> repeated;
+
+  void clear()
+  {
+    changed.clear();
+    repeated.clear();
+  }
+};
+
+// keeps the last value and quality of every item, indexed by the item index, so a
+// value is checked against its item's own state with no lookup. Numbers and booleans
+// are compared by type and bits, only the strings and the other text values compare
+// their text. A value equal to the last one is a repeat and doesn't reach the stages
+// after the detection, a NaN equal to the last NaN included.
+class ChangeDetector
+{
+public:
+  ChangeDetector();
+
+  // splits a batch into its changes and its repeats. The set is cleared first...
+  void detect(vector<unique_ptr<ItemValue>> const & batch, ChangeSet & changes);
+
+  // forgets the last value of an item, its next value is a change...
+  void forget(int index);
+
+private:
+  struct ItemState
+  {
+    // the raw union of a number, the text is in texts...
+    unsigned long long bits;
+
+    // the batch that last changed the item and its place in the change set...
+    unsigned batch;
+    unsigned slot;
+
+    Quality quality;
+    unsigned char type;
+    bool known;
+  };
+
+  boost::mutex mtx;
+  vector<ItemState> items;
+  vector<string> texts;
+  unsigned batches;
+
+  static bool is_text(ValueType type);
+};
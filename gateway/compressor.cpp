@@ -0,0 +1,170 @@
+#include "compressor.h"
+
+bool parseCompression(string const & text, CompressionSettings & settings)
+{
+  size_t colon = text.find(':');
+  string type = text.substr(0, colon);
+
+  settings.deviation = colon == string::npos ? 0 : atof(text.c_str() + colon + 1);
+
+  if (type == "none")
+    settings.type = NO_COMPRESSION;
+  else if (type == "sdt")
+    settings.type = SWINGING_DOOR;
+  else if (type == "boxcar")
+    settings.type = BOXCAR_BACKSLOPE;
+  else
+    return false;
+
+  return settings.deviation >= 0;
+}
+
+
+Compressor::Compressor(CompressionSettings const & settings) :
+config(settings),
+has_archived(false),
+has_slope(false),
+slope(0),
+upper(0),
+lower(0)
+{
+  counters.received = 0;
+  counters.archived = 0;
+  counters.max_error = 0;
+  counters.squared_error = 0;
+}
+
+
+void Compressor::append(Sample const & sample, vector<Sample> & archived)
+{
+  counters.received++;
+
+  if (config.type == NO_COMPRESSION)
+  {
+    counters.archived++;
+    archived.push_back(sample);
+    return;
+  }
+
+  Sample const & previous = pending.empty() ? last : pending.back();
+
+  // the steps the lines can't follow are kept as they are...
+  if (!has_archived || sample.quality != previous.quality || sample.timestamp <= previous.timestamp || std::isnan(sample.number) || std::isnan(previous.number))
+  {
+    flush(archived);
+    archive(sample, archived);
+    return;
+  }
+
+  if (!pending.empty() && (pending.size() >= MAX_HELD_SAMPLES || sample.timestamp - last.timestamp > MAX_ARCHIVE_INTERVAL))
+    flush(archived);
+
+  if (pending.empty())
+  {
+    start(sample);
+  }
+  else if (within(sample))
+  {
+    pending.push_back(sample);
+  }
+  else
+  {
+    flush(archived);
+    start(sample);
+  }
+}
+
+
+void Compressor::flush(vector<Sample> & archived)
+{
+  if (pending.empty())
+    return;
+
+  Sample const held = pending.back();
+  double rate = (held.number - last.number) / (held.timestamp - last.timestamp);
+
+  // the dropped samples are read back on the line between the kept ones...
+  for (size_t i = 0; i + 1 < pending.size(); i++)
+  {
+    double error = fabs(pending[i].number - (last.number + rate * (pending[i].timestamp - last.timestamp)));
+
+    counters.max_error = max(counters.max_error, error);
+    counters.squared_error += error * error;
+  }
+
+  archive(held, archived);
+}
+
+
+bool Compressor::held(Sample & sample) const
+{
+  if (pending.empty())
+    return false;
+
+  sample = pending.back();
+  return true;
+}
+
+
+CompressionSettings const & Compressor::settings() const
+{
+  return config;
+}
+
+
+CompressionStats const & Compressor::stats() const
+{
+  return counters;
+}
+
+
+bool Compressor::within(Sample const & sample)
+{
+  double elapsed = static_cast<double>(sample.timestamp - last.timestamp);
+
+  if (config.type == SWINGING_DOOR)
+  {
+    // the doors only close, once they cross no line fits all the samples...
+    double newUpper = min(upper, (sample.number + config.deviation - last.number) / elapsed);
+    double newLower = max(lower, (sample.number - config.deviation - last.number) / elapsed);
+
+    if (newLower > newUpper)
+      return false;
+
+    upper = newUpper;
+    lower = newLower;
+    return true;
+  }
+
+  if (fabs(sample.number - last.number) <= config.deviation)
+    return true;
+
+  return has_slope && fabs(sample.number - (last.number + slope * elapsed)) <= config.deviation;
+}
+
+
+void Compressor::start(Sample const & sample)
+{
+  double elapsed = static_cast<double>(sample.timestamp - last.timestamp);
+
+  upper = (sample.number + config.deviation - last.number) / elapsed;
+  lower = (sample.number - config.deviation - last.number) / elapsed;
+
+  pending.push_back(sample);
+}
+
+
+void Compressor::archive(Sample const & sample, vector<Sample> & archived)
+{
+  has_slope = has_archived && sample.timestamp > last.timestamp && !std::isnan(sample.number) && !std::isnan(last.number);
+
+  if (has_slope)
+    slope = (sample.number - last.number) / (sample.timestamp - last.timestamp);
+
+  last = sample;
+  has_archived = true;
+  pending.clear();
+
+  counters.archived++;
+  archived.push_back(sample);
+}
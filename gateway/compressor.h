@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "history.h"
+
+using namespace std;
+
+static size_t const MAX_HELD_SAMPLES = 1024;
+static long long const MAX_ARCHIVE_INTERVAL = 600000;
+
+enum CompressionType
+{
+  NO_COMPRESSION,
+  SWINGING_DOOR,
+  BOXCAR_BACKSLOPE
+};
+
+struct CompressionSettings
+{
+  CompressionType type;
+  double deviation;
+};
+
+// what the compression of an item did. The error is the distance between each dropped
+// sample and the line between the kept samples around it...
+struct CompressionStats
+{
+  unsigned long long received;
+  unsigned long long archived;
+  double max_error;
+  double squared_error;
+};
+
+// parses none, sdt:deviation or boxcar:deviation...
+bool parseCompression(string const & text, CompressionSettings & settings);
+
+// decides which samples of an item are kept. A sample is held until the next one
+// tells whether the line from the last kept sample can go on without it:
+//  - swinging door keeps the held sample when no line from the last kept sample
+//    passes within the deviation of all the samples since,
+//  - boxcar backslope keeps it when the new sample is off by more than the deviation
+//    both from the last kept value and from the slope of the last two kept samples.
+// A quality change, a NaN, MAX_HELD_SAMPLES samples or MAX_ARCHIVE_INTERVAL ms since
+// the last kept sample always keep the held sample.
+class Compressor
+{
+public:
+  Compressor(CompressionSettings const & settings);
+
+  // appends the samples to keep, if any...
+  void append(Sample const & sample, vector<Sample> & archived);
+
+  // keeps the held sample...
+  void flush(vector<Sample> & archived);
+
+  // the sample not yet decided on...
+  bool held(Sample & sample) const;
+
+  CompressionSettings const & settings() const;
+  CompressionStats const & stats() const;
+
+private:
+  CompressionSettings config;
+  CompressionStats counters;
+
+  bool has_archived;
+  Sample last;
+  bool has_slope;
+  double slope;
+
+  // the samples since the last kept one, the held one last...
+  vector<Sample> pending;
+  double upper;
+  double lower;
+
+  bool within(Sample const & sample);
+  void start(Sample const & sample);
+  void archive(Sample const & sample, vector<Sample> & archived);
+};
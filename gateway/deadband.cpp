@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "deadband.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEADBAND_SSE2
+#endif
+
+int DeadbandTable::add(double abs, double rel)
+{
+  int id;
+
+  if (free_ids.empty())
+  {
+    id = static_cast<int>(last.size());
+    last.push_back(0);
+    absolute.push_back(0);
+    relative.push_back(0);
+  }
+  else
+  {
+    id = free_ids.back();
+    free_ids.pop_back();
+  }
+
+  last[id] = numeric_limits<double>::quiet_NaN();
+  absolute[id] = abs;
+  relative[id] = rel;
+
+  return id;
+}
+
+
+void DeadbandTable::remove(int id)
+{
+  free_ids.push_back(id);
+}
+
+
+void DeadbandTable::filter(size_t count, int const * ids, double const * values, unsigned char * pass)
+{
+  batch_last.resize(count);
+  batch_absolute.resize(count);
+  batch_relative.resize(count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    batch_last[i] = last[ids[i]];
+    batch_absolute[i] = absolute[ids[i]];
+    batch_relative[i] = relative[ids[i]];
+  }
+
+  compare(count, values, batch_last.data(), batch_absolute.data(), batch_relative.data(), pass);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (pass[i])
+      last[ids[i]] = values[i];
+  }
+}
+
+
+void DeadbandTable::compare(size_t count, double const * value, double const * last, double const * absolute, double const * relative, unsigned char * pass)
+{
+  size_t i = 0;
+
+#ifdef DEADBAND_SSE2
+  __m128d const sign = _mm_set1_pd(-0.0);
+
+  for (; i + 2 <= count; i += 2)
+  {
+    __m128d v = _mm_loadu_pd(value + i);
+    __m128d l = _mm_loadu_pd(last + i);
+
+    __m128d difference = _mm_andnot_pd(sign, _mm_sub_pd(v, l));
+    __m128d limit = _mm_max_pd(_mm_loadu_pd(absolute + i), _mm_mul_pd(_mm_loadu_pd(relative + i), _mm_andnot_pd(sign, l)));
+
+    // a NaN on either side means a non numeric value or no last value...
+    int mask = _mm_movemask_pd(_mm_or_pd(_mm_cmpgt_pd(difference, limit), _mm_cmpunord_pd(v, l)));
+
+    pass[i] = mask & 1;
+    pass[i + 1] = (mask >> 1) & 1;
+  }
+#endif
+
+  compare_scalar(count - i, value + i, last + i, absolute + i, relative + i, pass + i);
+}
+
+
+void DeadbandTable::compare_scalar(size_t count, double const * value, double const * last, double const * absolute, double const * relative, unsigned char * pass)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    double limit = max(absolute[i], relative[i] * fabs(last[i]));
+
+    pass[i] = fabs(value[i] - last[i]) > limit || value[i] != value[i] || last[i] != last[i];
+  }
+}
+
+
+bool DeadbandTable::vectorized()
+{
+#ifdef DEADBAND_SSE2
+  return true;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+// deadbands of the subscriptions kept as contiguous arrays, so the changes of a
+// whole batch can be checked against them with SIMD compares. A change passes
+// when it differs from the last passed value by more than the absolute deadband
+// and by more than the relative deadband times the last passed value. Changes
+// that are not numbers always pass, and so does the first one after subscribing.
+class DeadbandTable
+{
+public:
+  // adds a deadband and returns its id...
+  int add(double absolute, double relative);
+  void remove(int id);
+
+  // checks count values against the deadbands with the given ids. The last value
+  // of the deadbands the values pass is updated...
+  void filter(size_t count, int const * ids, double const * values, unsigned char * pass);
+
+  // sets pass[i] to 1 if value[i] is out of the deadband around last[i]...
+  static void compare(size_t count, double const * value, double const * last, double const * absolute, double const * relative, unsigned char * pass);
+
+  // the same without SIMD, compare ends with it...
+  static void compare_scalar(size_t count, double const * value, double const * last, double const * absolute, double const * relative, unsigned char * pass);
+
+  // whether compare uses SSE2...
+  static bool vectorized();
+
+private:
+  vector<double> last;
+  vector<double> absolute;
+  vector<double> relative;
+  vector<int> free_ids;
+
+  // gathered lanes of the batch being filtered, kept to reuse their memory...
+  vector<double> batch_last;
+  vector<double> batch_absolute;
+  vector<double> batch_relative;
+};
@@ -0,0 +1,425 @@
+#include "expression.h"
+
+Expression::Expression() :
+position(0),
+max_depth(0)
+{
+}
+
+
+bool Expression::compile(string const & text, string & error)
+{
+  code.clear();
+  constants.clear();
+  input_ids.clear();
+  values.clear();
+
+  source = text;
+  position = 0;
+  max_depth = 0;
+
+  bool compiled = expression();
+
+  skip();
+
+  if (compiled && position < source.size())
+    compiled = fail(string("unexpected '") + source[position] + "'");
+
+  if (compiled && max_depth > EXPRESSION_STACK_SIZE)
+    compiled = fail("too deep");
+
+  error = compiled ? string() : failure;
+  source.clear();
+
+  return compiled;
+}
+
+
+double Expression::run(double const * inputs, int const * slots) const
+{
+  double stack[EXPRESSION_STACK_SIZE];
+  size_t top = 0;
+
+  unsigned char const * pc = code.data();
+  unsigned char const * end = pc + code.size();
+
+  while (pc < end)
+  {
+    OpCode op = static_cast<OpCode>(*pc++);
+
+    switch (op)
+    {
+    case OP_CONSTANT:
+      stack[top++] = constants[pc[0] | (pc[1] << 8)];
+      pc += 2;
+      break;
+    case OP_INPUT:
+      stack[top++] = inputs[slots[pc[0] | (pc[1] << 8)]];
+      pc += 2;
+      break;
+    case OP_NEGATE:
+    case OP_ABS:
+    case OP_SQRT:
+    case OP_EXP:
+    case OP_LOG:
+      stack[top - 1] = apply(op, stack + top - 1);
+      break;
+    default:
+      top--;
+      stack[top - 1] = apply(op, stack + top - 1);
+      break;
+    }
+  }
+
+  return stack[0];
+}
+
+
+vector<string> const & Expression::inputs() const
+{
+  return input_ids;
+}
+
+
+size_t Expression::size() const
+{
+  return code.size();
+}
+
+
+bool Expression::expression()
+{
+  if (!term())
+    return false;
+
+  for (;;)
+  {
+    if (accept('+'))
+    {
+      if (!term())
+        return false;
+
+      emit(OP_ADD, 2);
+    }
+    else if (accept('-'))
+    {
+      if (!term())
+        return false;
+
+      emit(OP_SUBTRACT, 2);
+    }
+    else
+      return true;
+  }
+}
+
+
+bool Expression::term()
+{
+  if (!unary())
+    return false;
+
+  for (;;)
+  {
+    if (accept('*'))
+    {
+      if (!unary())
+        return false;
+
+      emit(OP_MULTIPLY, 2);
+    }
+    else if (accept('/'))
+    {
+      if (!unary())
+        return false;
+
+      emit(OP_DIVIDE, 2);
+    }
+    else
+      return true;
+  }
+}
+
+
+bool Expression::unary()
+{
+  if (!accept('-'))
+    return power();
+
+  if (!unary())
+    return false;
+
+  emit(OP_NEGATE, 1);
+  return true;
+}
+
+
+bool Expression::power()
+{
+  if (!primary())
+    return false;
+
+  // 2^-1 is allowed, and 2^3^2 is 2^9...
+  if (!accept('^'))
+    return true;
+
+  if (!unary())
+    return false;
+
+  emit(OP_POWER, 2);
+  return true;
+}
+
+
+bool Expression::primary()
+{
+  skip();
+
+  if (position >= source.size())
+    return fail("unexpected end");
+
+  char c = source[position];
+
+  if (accept('('))
+  {
+    if (!expression())
+      return false;
+
+    return accept(')') || fail("missing ')'");
+  }
+
+  if (c == '[')
+  {
+    size_t close = source.find(']', position);
+
+    if (close == string::npos)
+      return fail("missing ']'");
+
+    string id = source.substr(position + 1, close - position - 1);
+    position = close + 1;
+
+    return input(id);
+  }
+
+  if (isdigit(static_cast<unsigned char>(c)) || c == '.')
+  {
+    char const * start = source.c_str() + position;
+    char * stop = nullptr;
+    double number = strtod(start, &stop);
+
+    if (stop == start)
+      return fail("invalid number");
+
+    position += stop - start;
+
+    return constant(number);
+  }
+
+  if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+  {
+    size_t start = position;
+
+    while (position < source.size() && (isalnum(static_cast<unsigned char>(source[position])) || source[position] == '_' || source[position] == '.' || source[position] == ':'))
+      position++;
+
+    string name = source.substr(start, position - start);
+
+    skip();
+
+    if (position < source.size() && source[position] == '(')
+      return call(name);
+
+    return input(name);
+  }
+
+  return fail(string("unexpected '") + c + "'");
+}
+
+
+bool Expression::call(string const & name)
+{
+  OpCode op;
+  size_t arity = 1;
+
+  if (name == "abs")
+    op = OP_ABS;
+  else if (name == "sqrt")
+    op = OP_SQRT;
+  else if (name == "exp")
+    op = OP_EXP;
+  else if (name == "log")
+    op = OP_LOG;
+  else if (name == "min")
+  {
+    op = OP_MIN;
+    arity = 2;
+  }
+  else if (name == "max")
+  {
+    op = OP_MAX;
+    arity = 2;
+  }
+  else
+    return fail("unknown function " + name);
+
+  accept('(');
+
+  for (size_t a = 0; a < arity; a++)
+  {
+    if (a > 0 && !accept(','))
+      return fail(name + " takes " + to_string(arity) + " arguments");
+
+    if (!expression())
+      return false;
+  }
+
+  if (!accept(')'))
+    return fail("missing ')'");
+
+  emit(op, arity);
+  return true;
+}
+
+
+void Expression::skip()
+{
+  while (position < source.size() && isspace(static_cast<unsigned char>(source[position])))
+    position++;
+}
+
+
+bool Expression::accept(char c)
+{
+  skip();
+
+  if (position >= source.size() || source[position] != c)
+    return false;
+
+  position++;
+  return true;
+}
+
+
+bool Expression::fail(string const & message)
+{
+  failure = message + " at " + to_string(position);
+  return false;
+}
+
+
+bool Expression::constant(double number)
+{
+  if (constants.size() >= EXPRESSION_OPERANDS)
+    return fail("too many constants");
+
+  constants.push_back(number);
+  push(OP_CONSTANT, constants.size() - 1);
+
+  return true;
+}
+
+
+bool Expression::input(string const & id)
+{
+  if (id.empty())
+    return fail("empty tag id");
+
+  size_t n = find(input_ids.begin(), input_ids.end(), id) - input_ids.begin();
+
+  if (n == input_ids.size())
+  {
+    if (n >= EXPRESSION_OPERANDS)
+      return fail("too many inputs");
+
+    input_ids.push_back(id);
+  }
+
+  push(OP_INPUT, n);
+  return true;
+}
+
+
+void Expression::push(OpCode op, size_t operand)
+{
+  values.push_back(make_pair(code.size(), op == OP_CONSTANT));
+  max_depth = max(max_depth, values.size());
+
+  code.push_back(static_cast<unsigned char>(op));
+  code.push_back(static_cast<unsigned char>(operand & 0xFF));
+  code.push_back(static_cast<unsigned char>(operand >> 8));
+}
+
+
+void Expression::emit(OpCode op, size_t operands)
+{
+  if (fold(op, operands))
+    return;
+
+  // the operands make one value, starting where the first one does...
+  size_t start = values[values.size() - operands].first;
+
+  values.resize(values.size() - operands);
+  values.push_back(make_pair(start, false));
+
+  code.push_back(static_cast<unsigned char>(op));
+}
+
+
+bool Expression::fold(OpCode op, size_t operands)
+{
+  size_t first = values.size() - operands;
+  double arguments[2];
+
+  for (size_t i = first; i < values.size(); i++)
+  {
+    if (!values[i].second)
+      return false;
+  }
+
+  // the constants of the last values are the last ones of the table...
+  for (size_t i = 0; i < operands; i++)
+    arguments[i] = constants[constants.size() - operands + i];
+
+  constants.resize(constants.size() - operands);
+  code.resize(values[first].first);
+  values.resize(first);
+
+  constants.push_back(apply(op, arguments));
+  push(OP_CONSTANT, constants.size() - 1);
+
+  return true;
+}
+
+
+double Expression::apply(OpCode op, double const * arguments)
+{
+  switch (op)
+  {
+  case OP_ADD:
+    return arguments[0] + arguments[1];
+  case OP_SUBTRACT:
+    return arguments[0] - arguments[1];
+  case OP_MULTIPLY:
+    return arguments[0] * arguments[1];
+  case OP_DIVIDE:
+    return arguments[0] / arguments[1];
+  case OP_POWER:
+    return pow(arguments[0], arguments[1]);
+  case OP_NEGATE:
+    return -arguments[0];
+  case OP_ABS:
+    return fabs(arguments[0]);
+  case OP_SQRT:
+    return sqrt(arguments[0]);
+  case OP_EXP:
+    return exp(arguments[0]);
+  case OP_LOG:
+    return log(arguments[0]);
+  case OP_MIN:
+    return min(arguments[0], arguments[1]);
+  case OP_MAX:
+    return max(arguments[0], arguments[1]);
+  default:
+    return numeric_limits<double>::quiet_NaN();
+  }
+}
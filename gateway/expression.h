@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// deepest stack an expression may need...
+static size_t const EXPRESSION_STACK_SIZE = 32;
+
+// most constants and inputs of an expression, their operands are 16 bits...
+static size_t const EXPRESSION_OPERANDS = 65536;
+
+// an arithmetic expression over tags compiled to a stack bytecode: one byte per
+// operation, the pushes followed by a 16 bit operand, the index of a constant or of
+// an input. The grammar is the usual one:
+//  - numbers, tag ids made of letters, digits, '_', '.' and ':', or any other id in
+//    brackets, i.e. [Bucket Brewing.Int4],
+//  - + - * / and ^ (power, right associative), unary -, parentheses,
+//  - abs(x), sqrt(x), exp(x), log(x), min(x, y) and max(x, y).
+// The parts made only of constants are computed once when compiling.
+class Expression
+{
+public:
+  Expression();
+
+  // the error tells what is wrong and where...
+  bool compile(string const & text, string & error);
+
+  // runs the code, the value of the input n being values[slots[n]]...
+  double run(double const * values, int const * slots) const;
+
+  // the ids of the inputs, in the order of their operands...
+  vector<string> const & inputs() const;
+
+  // bytes of code...
+  size_t size() const;
+
+private:
+  enum OpCode
+  {
+    OP_CONSTANT,
+    OP_INPUT,
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_POWER,
+    OP_NEGATE,
+    OP_ABS,
+    OP_SQRT,
+    OP_EXP,
+    OP_LOG,
+    OP_MIN,
+    OP_MAX
+  };
+
+  vector<unsigned char> code;
+  vector<double> constants;
+  vector<string> input_ids;
+
+  // the text being compiled, and where the code of each value on the stack starts
+  // and whether it is a constant...
+  string source;
+  size_t position;
+  vector<pair<size_t, bool>> values;
+  size_t max_depth;
+  string failure;
+
+  bool expression();
+  bool term();
+  bool unary();
+  bool power();
+  bool primary();
+  bool call(string const & name);
+
+  void skip();
+  bool accept(char c);
+  bool fail(string const & message);
+
+  bool constant(double number);
+  bool input(string const & id);
+  void push(OpCode op, size_t operand);
+  void emit(OpCode op, size_t operands);
+  bool fold(OpCode op, size_t operands);
+
+  static double apply(OpCode op, double const * arguments);
+};
@@ -0,0 +1,415 @@
+#include "fan-out.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+SubscriberSet::SubscriberSet()
+{
+  words.fill(0);
+}
+
+
+void SubscriberSet::set(int slot)
+{
+  words[slot / 64] |= 1ULL << (slot % 64);
+}
+
+
+void SubscriberSet::reset(int slot)
+{
+  words[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+
+bool SubscriberSet::test(int slot) const
+{
+  return (words[slot / 64] & (1ULL << (slot % 64))) != 0;
+}
+
+
+bool SubscriberSet::any() const
+{
+  for (size_t w = 0; w < words.size(); w++)
+  {
+    if (words[w] != 0)
+      return true;
+  }
+
+  return false;
+}
+
+
+unsigned SubscriberSet::lowest_bit(unsigned long long word)
+{
+#ifdef _MSC_VER
+  unsigned long bit;
+
+  // _BitScanForward64 is only available on x64...
+  if (_BitScanForward(&bit, static_cast<unsigned long>(word)))
+    return bit;
+
+  _BitScanForward(&bit, static_cast<unsigned long>(word >> 32));
+  return bit + 32;
+#else
+  return __builtin_ctzll(word);
+#endif
+}
+
+
+FanOut::FanOut(boost::asio::io_service & service, function<string(string const & itemId)> currentValueFn) :
+currentValue(currentValueFn),
+sessions(MAX_SUBSCRIBERS),
+subscriptions(MAX_SUBSCRIBERS),
+wheel(WHEEL_SLOTS, now() / WHEEL_TICK),
+timer(service),
+timer_armed(false),
+pending(MAX_SUBSCRIBERS)
+{
+}
+
+
+bool FanOut::attach(shared_ptr<Session> const & session)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  for (size_t slot = 0; slot < sessions.size(); slot++)
+  {
+    if (!sessions[slot])
+    {
+      sessions[slot] = session;
+      session->slot = static_cast<int>(slot);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+void FanOut::detach(Session & session)
+{
+  if (session.slot < 0)
+    return;
+
+  unsubscribe_all(session);
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  sessions[session.slot].reset();
+  session.slot = -1;
+}
+
+
+bool FanOut::subscribe(Session & session, int index, string const & itemId, SubscriptionOptions const & options)
+{
+  if (session.slot < 0)
+    return false;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  Subscribers & item = items[index];
+  item.itemId = itemId;
+  item.slots.set(session.slot);
+  item.waiting.set(session.slot);
+
+  if (options.rate > 0)
+    item.limited.set(session.slot);
+  else
+    item.limited.reset(session.slot);
+
+  bool deadband = options.absolute > 0 || options.relative > 0;
+
+  if (deadband)
+    item.banded.set(session.slot);
+  else
+    item.banded.reset(session.slot);
+
+  // subscribing again replaces the options...
+  auto existing = subscriptions[session.slot].find(index);
+
+  if (existing != subscriptions[session.slot].end() && existing->second.deadband >= 0)
+    deadbands.remove(existing->second.deadband);
+
+  Subscription & subscription = subscriptions[session.slot][index];
+  subscription.deadband = deadband ? deadbands.add(options.absolute, options.relative) : -1;
+  subscription.options = options;
+  subscription.last_sent = now();
+  subscription.scheduled = false;
+  subscription.held = false;
+  subscription.newest = Frame();
+
+  // the current value may come from the server, it is read without the lock. A
+  // change sent meanwhile is newer, the value read is then dropped...
+  lock.unlock();
+
+  shared_ptr<string> buffer = make_shared<string>();
+  append_change(*buffer, itemId, currentValue(itemId));
+
+  lock.lock();
+
+  auto subscribed = items.find(index);
+
+  if (sessions[session.slot].get() != &session || subscribed == items.end() || !subscribed->second.waiting.test(session.slot))
+    return true;
+
+  subscribed->second.waiting.reset(session.slot);
+  session.notify(vector<Frame>(1, Frame{ index, buffer, 0, buffer->size() }));
+
+  return true;
+}
+
+
+void FanOut::unsubscribe(Session & session, int index)
+{
+  if (session.slot < 0)
+    return;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  remove_subscription(session.slot, index);
+}
+
+
+void FanOut::unsubscribe_all(Session & session)
+{
+  if (session.slot < 0)
+    return;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  while (!subscriptions[session.slot].empty())
+    remove_subscription(session.slot, subscriptions[session.slot].begin()->first);
+}
+
+
+void FanOut::publish(vector<Change> const & changes)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  shared_ptr<string> buffer;
+
+  for (auto c = changes.begin(); c != changes.end(); ++c)
+  {
+    auto item = items.find(c->index);
+
+    if (item == items.end())
+      continue;
+
+    if (!buffer)
+      buffer = make_shared<string>();
+
+    size_t offset = buffer->size();
+    append_change(*buffer, item->second.itemId, c->value);
+
+    slices.push_back(Slice{ &item->second, c->index, c->number, offset, buffer->size() - offset });
+  }
+
+  if (!buffer)
+    return;
+
+  // from here on the buffer is immutable and shared by all the receivers...
+  shared_ptr<string const> shared = buffer;
+  long long t = now();
+
+  for (size_t i = 0; i < slices.size(); i++)
+  {
+    Slice & s = slices[i];
+    Frame frame{ s.index, shared, s.offset, s.length };
+
+    s.item->slots.for_each([&](int slot) {
+      if (!s.item->banded.test(slot))
+      {
+        dispatch(slot, frame, *s.item, t);
+        return;
+      }
+
+      // the deadbands are checked below, all at once...
+      banded.push_back(make_pair(i, slot));
+      banded_ids.push_back(subscriptions[slot][s.index].deadband);
+      banded_values.push_back(s.number);
+    });
+  }
+
+  if (!banded.empty())
+  {
+    banded_pass.resize(banded.size());
+    deadbands.filter(banded.size(), banded_ids.data(), banded_values.data(), banded_pass.data());
+
+    for (size_t b = 0; b < banded.size(); b++)
+    {
+      if (!banded_pass[b])
+        continue;
+
+      Slice & s = slices[banded[b].first];
+      dispatch(banded[b].second, Frame{ s.index, shared, s.offset, s.length }, *s.item, t);
+    }
+
+    banded.clear();
+    banded_ids.clear();
+    banded_values.clear();
+  }
+
+  slices.clear();
+
+  flush_pending();
+}
+
+
+void FanOut::dispatch(int slot, Frame const & frame, Subscribers & item, long long t)
+{
+  bool sent = true;
+
+  if (item.limited.test(slot))
+    sent = route(slot, frame, t);
+  else
+    queue_frame(slot, frame);
+
+  // the first value of a new subscription would be older than this one...
+  if (sent)
+    item.waiting.reset(slot);
+}
+
+
+void FanOut::remove_subscription(int slot, int index)
+{
+  auto item = items.find(index);
+
+  if (item != items.end())
+  {
+    item->second.slots.reset(slot);
+    item->second.limited.reset(slot);
+    item->second.banded.reset(slot);
+    item->second.waiting.reset(slot);
+
+    if (!item->second.slots.any())
+      items.erase(item);
+  }
+
+  auto subscription = subscriptions[slot].find(index);
+
+  if (subscription == subscriptions[slot].end())
+    return;
+
+  if (subscription->second.deadband >= 0)
+    deadbands.remove(subscription->second.deadband);
+
+  // a timer that is still in the wheel will find no subscription and be ignored...
+  subscriptions[slot].erase(subscription);
+}
+
+
+bool FanOut::route(int slot, Frame const & frame, long long t)
+{
+  Subscription & subscription = subscriptions[slot][frame.index];
+
+  if (!subscription.scheduled && t - subscription.last_sent >= subscription.options.rate)
+  {
+    subscription.last_sent = t;
+    queue_frame(slot, frame);
+    return true;
+  }
+
+  // too early, only the newest change is kept until the interval is over...
+  subscription.newest = frame;
+  subscription.held = true;
+
+  if (subscription.scheduled)
+    return false;
+
+  long long deadline = (subscription.last_sent + subscription.options.rate + WHEEL_TICK - 1) / WHEEL_TICK;
+  wheel.schedule((static_cast<unsigned long long>(slot) << 32) | static_cast<unsigned>(frame.index), deadline);
+  subscription.scheduled = true;
+
+  arm_timer();
+
+  return false;
+}
+
+
+void FanOut::queue_frame(int slot, Frame const & frame)
+{
+  if (pending[slot].empty())
+    touched.push_back(slot);
+
+  pending[slot].push_back(frame);
+}
+
+
+void FanOut::flush_pending()
+{
+  for (auto t = touched.begin(); t != touched.end(); ++t)
+  {
+    sessions[*t]->notify(pending[*t]);
+    pending[*t].clear();
+  }
+
+  touched.clear();
+}
+
+
+void FanOut::arm_timer()
+{
+  if (timer_armed)
+    return;
+
+  timer_armed = true;
+
+  timer.expires_from_now(chrono::milliseconds(WHEEL_TICK));
+  timer.async_wait(boost::bind(&FanOut::on_timer, this, boost::asio::placeholders::error));
+}
+
+
+void FanOut::on_timer(boost::system::error_code const & error)
+{
+  if (error)
+    return;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  timer_armed = false;
+
+  long long t = now();
+  wheel.advance(t / WHEEL_TICK, expired);
+
+  for (auto e = expired.begin(); e != expired.end(); ++e)
+  {
+    int slot = static_cast<int>(*e >> 32);
+    int index = static_cast<int>(*e & 0xffffffff);
+
+    auto subscription = subscriptions[slot].find(index);
+
+    if (subscription == subscriptions[slot].end())
+      continue;
+
+    subscription->second.scheduled = false;
+
+    if (!subscription->second.held)
+      continue;
+
+    subscription->second.held = false;
+    subscription->second.last_sent = t;
+    queue_frame(slot, subscription->second.newest);
+    items[index].waiting.reset(slot);
+    subscription->second.newest = Frame();
+  }
+
+  expired.clear();
+
+  flush_pending();
+
+  if (!wheel.empty())
+    arm_timer();
+}
+
+
+long long FanOut::now()
+{
+  return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void FanOut::append_change(string & buffer, string const & itemId, string const & value)
+{
+  buffer.append("CHANGE|").append(itemId).append("|").append(value).append("\n");
+}
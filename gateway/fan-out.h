@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/thread/mutex.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "deadband.h"
+#include "session.h"
+#include "timing-wheel.h"
+
+using namespace std;
+
+static unsigned const MAX_SUBSCRIBERS = 256;
+static unsigned const WHEEL_SLOTS = 1024;
+static unsigned const WHEEL_TICK = 10;
+
+// a changed item, its formatted value and its value as a number, NaN if it isn't one...
+struct Change
+{
+  int index;
+  string value;
+  double number;
+};
+
+// options given with SUBSCRIBE...
+struct SubscriptionOptions
+{
+  // minimum interval between two notifications of an item, in ms. 0 means no limit...
+  long long rate;
+
+  // change needed for a notification, absolute and relative to the last notified value...
+  double absolute;
+  double relative;
+};
+
+// fixed size bitset of fan-out slots...
+class SubscriberSet
+{
+public:
+  SubscriberSet();
+
+  void set(int slot);
+  void reset(int slot);
+  bool test(int slot) const;
+  bool any() const;
+
+  // calls fn for every slot in the set...
+  template <typename Fn>
+  void for_each(Fn fn) const
+  {
+    for (size_t w = 0; w < words.size(); w++)
+    {
+      unsigned long long word = words[w];
+
+      while (word != 0)
+      {
+        fn(static_cast<int>(w * 64 + lowest_bit(word)));
+        word &= word - 1;
+      }
+    }
+  }
+
+private:
+  array<unsigned long long, MAX_SUBSCRIBERS / 64> words;
+
+  static unsigned lowest_bit(unsigned long long word);
+};
+
+// routes change batches to the subscribed sessions. Each batch is serialized once
+// into an immutable buffer and the sessions interested in a change are found
+// through the per-item subscriber sets, so the cost of a batch does not depend on
+// how many sessions receive it.
+//
+// Rate limited subscriptions hold back the changes that come too early, keeping
+// only the newest one, and a timing wheel releases it when the interval is over.
+// Subscriptions without held back changes don't cost anything.
+//
+// Subscriptions with a deadband go through a filter first. The deadbands of all
+// the changes of a batch are checked at once, see DeadbandTable.
+class FanOut
+{
+public:
+  FanOut(boost::asio::io_service & service, function<string(string const & itemId)> currentValueFn);
+
+  // gives the session a slot. Returns false if all the slots are taken...
+  bool attach(shared_ptr<Session> const & session);
+
+  // removes the session and all its subscriptions...
+  void detach(Session & session);
+
+  // subscribes the session to an item and queues its current value as the first notification...
+  bool subscribe(Session & session, int index, string const & itemId, SubscriptionOptions const & options);
+
+  void unsubscribe(Session & session, int index);
+  void unsubscribe_all(Session & session);
+
+  void publish(vector<Change> const & changes);
+
+private:
+  struct Subscribers
+  {
+    string itemId;
+    SubscriberSet slots;
+    SubscriberSet limited;
+    SubscriberSet banded;
+
+    // the sessions subscribed and not sent any value yet...
+    SubscriberSet waiting;
+  };
+
+  struct Subscription
+  {
+    SubscriptionOptions options;
+    long long last_sent;
+    bool scheduled;
+    bool held;
+    Frame newest;
+    int deadband;
+  };
+
+  struct Slice
+  {
+    Subscribers * item;
+    int index;
+    double number;
+    size_t offset;
+    size_t length;
+  };
+
+  boost::mutex mtx;
+  function<string(string const & itemId)> currentValue;
+  unordered_map<int, Subscribers> items;
+  vector<shared_ptr<Session>> sessions;
+  vector<unordered_map<int, Subscription>> subscriptions;
+
+  DeadbandTable deadbands;
+
+  TimingWheel wheel;
+  boost::asio::steady_timer timer;
+  bool timer_armed;
+
+  // per slot frames being routed and the slices of the batch being published,
+  // kept to reuse their memory...
+  vector<vector<Frame>> pending;
+  vector<int> touched;
+  vector<Slice> slices;
+  vector<unsigned long long> expired;
+
+  // slice and slot of each change that has to go through a deadband...
+  vector<pair<size_t, int>> banded;
+  vector<int> banded_ids;
+  vector<double> banded_values;
+  vector<unsigned char> banded_pass;
+
+  void remove_subscription(int slot, int index);
+  void dispatch(int slot, Frame const & frame, Subscribers & item, long long now);
+
+  // returns false when the frame is held back...
+  bool route(int slot, Frame const & frame, long long now);
+  void queue_frame(int slot, Frame const & frame);
+  void flush_pending();
+  void arm_timer();
+  void on_timer(boost::system::error_code const & error);
+
+  static long long now();
+  static void append_change(string & buffer, string const & itemId, string const & value);
+};
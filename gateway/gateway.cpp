@@ -1,21 +1,107 @@
 #include <boost/thread.hpp>
 #include "proxy-server.h"
+#include <atomic>
+#include <cmath>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#ifdef _WIN32
 #include "targetver.h"
-#include "opc_client.h"
-#include "opc_utils.h"
+#include "opc-source.h"
+#endif
+
+#include "alarm-engine.h"
+#include "calculated-tags.h"
+#include "capture.h"
+#include "change-bus.h"
+#include "change-detector.h"
+#include "history.h"
+#include "opc_types.h"
+#include "recorder.h"
+#include "simulated-source.h"
+#include "stale-watchdog.h"
+#include "value-cache.h"
+#include "write-coalescer.h"
 
 using namespace opc;
 using namespace std;
 
 bool verboseEnable = false;
 
-vector<unique_ptr<ItemValue>> actualValues;
+// maximum age (ms) of a cached value before a READ goes to the device...
+long long maxCacheAge = 5000;
+
+// time (ms) the proxy writes are collected before being sent as a batch...
+long long writeWindow = 5;
+
+// number of proxy reactors, one per core by default, and whether they are pinned to their cores...
+unsigned reactorCount = boost::thread::hardware_concurrency();
+bool pinReactors = false;
+
+// -u runs the proxy sessions on io_uring, on the Linux builds that have it...
+TransportType transportType = ASIO_TRANSPORT;
+
+ValueCache valueCache(CACHE_SIZE);
+ChangeDetector changeDetector;
+
+// -X id=expression defines a calculated tag, see Expression. The calculated tags take
+// the last indexes of the cache...
+CalculatedTags calculatedTags(CACHE_SIZE - 1);
+
+// the changes go from the data change callback to the cache, the history and the
+// subscribers through the bus, each stage at its own pace...
+unique_ptr<ChangeBus> changeBus;
+
+// depth of the history rings (-H depth), per item id prefix with -H prefix=depth...
+size_t historyDepth = HISTORY_DEPTH;
+vector<pair<string, size_t>> historyClasses;
+unique_ptr<HistoryStore> history;
+
+// directory of the recorder segments (-R directory), -R none stops the recording...
+string recorderDirectory = "recorder";
+
+// segments kept by the recorder (-K count), 0 keeps them all...
+size_t recorderRetention = SEGMENT_RETENTION;
+unique_ptr<Recorder> recorder;
+
+// lossy compression of the recorded samples (-C sdt:deviation or -C boxcar:deviation),
+// per item id prefix with -C prefix=sdt:deviation...
+CompressionSettings recorderCompression = { NO_COMPRESSION, 0 };
+vector<pair<string, CompressionSettings>> compressionClasses;
+
+// -W timeout (ms) marks the items whose values stop coming as uncertain, per item id
+// prefix with -W prefix=timeout. 0, the default, never times out...
+long long staleTimeout = 0;
+vector<pair<string, long long>> staleClasses;
+unique_ptr<StaleWatchdog> watchdog;
+
+// -L limits raises and clears alarms as the values change, per item id prefix with
+// -L prefix=limits, see parseLimits. The clients get them with ALARMS...
+AlarmLimits alarmLimits = noLimits();
+vector<pair<string, AlarmLimits>> alarmClasses;
+unique_ptr<AlarmEngine> alarms;
+
+// -c file saves the data change batches, -P file replays them without the server, at
+// the speed given by -s (1 is as captured, 0 as fast as possible)...
+string captureFile;
+unique_ptr<CaptureWriter> capture;
+string replayFile;
+double replaySpeed = 1;
+
+// -t file saves the proxy connections and requests for the load-replay tool...
+string trafficFile;
+
+// where the items come from: -S opc (the default) or -S sim[:settings] for the
+// simulated source, see parseSimulation...
+bool simulatedSource = false;
+SimulationSettings simulation = { SIMULATED_TAGS, vector<ValueType>(), SIMULATED_RATE, SIMULATED_INTERVAL, 0, 0, 0, 0 };
+
+// the running proxy, used to push the changes to the subscribed clients...
+atomic<ProxyServer *> proxyServer(nullptr);
 
 void setupOptions(int argc, char * argv[])
 {
@@ -25,6 +111,92 @@ void setupOptions(int argc, char * argv[])
     {
       if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "-V") == 0)
         verboseEnable = true;
+      else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+        maxCacheAge = atoll(argv[++i]);
+      else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        writeWindow = atoll(argv[++i]);
+      else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        reactorCount = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-p") == 0)
+        pinReactors = true;
+      else if (strcmp(argv[i], "-u") == 0)
+        transportType = URING_TRANSPORT;
+      else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc)
+        recorderDirectory = argv[++i];
+      else if (strcmp(argv[i], "-K") == 0 && i + 1 < argc)
+        recorderRetention = static_cast<size_t>(atoll(argv[++i]));
+      else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        captureFile = argv[++i];
+      else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        trafficFile = argv[++i];
+      else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+        replayFile = argv[++i];
+      else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        replaySpeed = atof(argv[++i]);
+      else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+      {
+        string option(argv[++i]);
+
+        simulatedSource = option.compare(0, 3, "sim") == 0;
+
+        if (option.compare(0, 4, "sim:") == 0 && !parseSimulation(option.substr(4), simulation))
+          cout << "Invalid simulation: " << option << endl;
+      }
+      else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc)
+      {
+        string option(argv[++i]);
+        size_t equals = option.find('=');
+        CompressionSettings settings;
+
+        if (!parseCompression(equals == string::npos ? option : option.substr(equals + 1), settings))
+          cout << "Invalid compression: " << option << endl;
+        else if (equals == string::npos)
+          recorderCompression = settings;
+        else
+          compressionClasses.push_back(make_pair(option.substr(0, equals), settings));
+      }
+      else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc)
+      {
+        string option(argv[++i]);
+        size_t equals = option.find('=');
+
+        if (equals == string::npos)
+          staleTimeout = atoll(option.c_str());
+        else
+          staleClasses.push_back(make_pair(option.substr(0, equals), atoll(option.c_str() + equals + 1)));
+      }
+      else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc)
+      {
+        string option(argv[++i]);
+        size_t equals = option.find('=');
+        AlarmLimits limits;
+
+        if (!parseLimits(equals == string::npos ? option : option.substr(equals + 1), limits))
+          cout << "Invalid limits: " << option << endl;
+        else if (equals == string::npos)
+          alarmLimits = limits;
+        else
+          alarmClasses.push_back(make_pair(option.substr(0, equals), limits));
+      }
+      else if (strcmp(argv[i], "-X") == 0 && i + 1 < argc)
+      {
+        string option(argv[++i]);
+        size_t equals = option.find('=');
+        string error = "missing '='";
+
+        if (equals == string::npos || !calculatedTags.define(option.substr(0, equals), option.substr(equals + 1), error))
+          cout << "Invalid calculated tag: " << option << " - " << error << endl;
+      }
+      else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc)
+      {
+        string option(argv[++i]);
+        size_t equals = option.find('=');
+
+        if (equals == string::npos)
+          historyDepth = atoi(option.c_str());
+        else
+          historyClasses.push_back(make_pair(option.substr(0, equals), static_cast<size_t>(atoi(option.c_str() + equals + 1))));
+      }
     }
   }
 }
@@ -37,18 +209,18 @@ void gatewayLog(const string & msg)
 }
 
 
-void connectCommand(OPCClient & opc)
+void connectCommand(TagSource & source)
 {
   string serverName;
 
   cout << "Enter the OPC Server name: ";
   getline(cin, serverName);
 
-  opc.Connect(serverName);
+  source.connect(serverName);
 }
 
 
-void disconnectCommand(OPCClient & opc)
+void disconnectCommand(TagSource & source)
 {
   string response;
 
@@ -56,11 +228,11 @@ void disconnectCommand(OPCClient & opc)
   getline(cin, response);
 
   if (response == "y")
-    opc.Disconnect();
+    source.disconnect();
 }
 
 
-void addServer211Items(OPCClient & opc)
+void addServer211Items(TagSource & source)
 {
   ItemInfo info;
   string id;
@@ -68,33 +240,24 @@ void addServer211Items(OPCClient & opc)
   for (size_t i = 0; i < 10; i++)
   {
     id = "TAG" + to_string(i);
-    opc.AddItem(id, VARENUM::VT_I4, info);
+    source.add_item(id, TYPE_I4, info);
   }
 }
 
 
-VARIANT readItem(OPCClient & opc, string const & itemId)
+Value readItem(TagSource & source, string const & itemId)
 {
   ItemInfo item;
+  ItemValue value;
 
-  HRESULT hr = opc.GetItemInfo(itemId, item);
-
-  if (hr == S_OK)
-  {
-    ItemValue value;
-    VariantInit(&value.value);
-
-    hr = opc.Read(item, value);
+  if (source.item_info(itemId, item) == STATUS_OK)
+    source.read(item, value);
 
-    if (hr == S_OK)
-    {
-      return value.value;
-    }
-  }
+  return value.value;
 }
 
 
-void readItem(OPCClient & opc, vector<string> const & tokens)
+void readItem(TagSource & source, vector<string> const & tokens)
 {
   if (tokens.size() < 2)
   {
@@ -104,107 +267,483 @@ void readItem(OPCClient & opc, vector<string> const & tokens)
 
   string id = tokens[1];
 
-  VARIANT v = readItem(opc, id);
+  cout << formatValue(readItem(source, id)) << endl;
+}
+
+
+// the item ids are short, so the string usually fits in its small buffer...
+Status getItemInfo(TagSource & source, boost::string_ref itemId, ItemInfo & item)
+{
+  string id(itemId.begin(), itemId.end());
+
+  // a calculated tag hides a source item with the same id...
+  if (calculatedTags.item_info(id, item))
+    return STATUS_OK;
+
+  return source.item_info(id, item);
+}
+
 
-  string result = fromVARIANT(v);
+// the id of a calculated tag or of a source item...
+string itemIdOf(TagSource & source, int index)
+{
+  if (calculatedTags.calculated(index))
+    return calculatedTags.item_id(index);
 
-  cout << result << endl;
+  return source.item_info(index).id;
 }
 
+
+// whether readItemProxyFn answers without the server: the value is cached and fresh,
+// the tag is calculated or there is no such item...
+bool cachedItemProxyFn(TagSource & source, boost::string_ref itemId)
+{
+  ItemInfo item;
+
+  if (getItemInfo(source, itemId, item) != STATUS_OK || calculatedTags.calculated(item.index))
+    return true;
+
+  CachedValue cached;
+
+  return valueCache.get(item.index, cached) && ValueCache::age(cached) <= maxCacheAge;
+}
+
+
 boost::mutex readMtx;
-string readItemProxyFn(OPCClient & opc, string const & itemId)
+void readItemProxyFn(TagSource & source, boost::string_ref itemId, bool fromDevice, string & response)
 {
+  ItemInfo item;
+
+  if (getItemInfo(source, itemId, item) != STATUS_OK)
+  {
+    response.append("READ_FAIL");
+    return;
+  }
+
+  // the cache is the primary source, no lock is taken here...
+  CachedValue cached;
+  bool hasCached = valueCache.get(item.index, cached);
+
+  if (!fromDevice && hasCached && ValueCache::age(cached) <= maxCacheAge)
+  {
+    formatCachedValue(cached, response);
+    return;
+  }
+
+  // a calculated tag has no device, its value is the last one computed...
+  if (calculatedTags.calculated(item.index))
+  {
+    if (hasCached)
+      formatCachedValue(cached, response);
+    else
+      response.append("READ_FAIL");
+
+    return;
+  }
+
   boost::unique_lock<boost::mutex> lock(readMtx);
 
-  VARIANT v = readItem(opc, itemId);
+  ItemValue value;
+
+  if (source.read(item, value) != STATUS_OK)
+  {
+    if (hasCached)
+      formatCachedValue(cached, response);
+    else
+      response.append("READ_FAIL");
+
+    return;
+  }
+
+  valueCache.update(item.index, value.value, value.quality);
+
+  valueCache.get(item.index, cached);
 
-  return fromVARIANT(v);
+  formatCachedValue(cached, response);
 }
 
 
-HRESULT writeItem(OPCClient & opc, string const & itemId, VARIANT & value)
+Status writeItem(TagSource & source, string const & itemId, Value const & value)
 {
   ItemInfo item;
 
-  HRESULT hr = opc.GetItemInfo(itemId, item);
+  Status status = source.item_info(itemId, item);
 
-  if (hr == S_OK)
+  if (status == STATUS_OK)
   {
-    hr = opc.Write(item, value);
+    vector<ItemInfo> items(1, item);
+    vector<Value> values(1, value);
+    vector<Status> results;
+
+    status = source.write(items, values, results);
+
+    if (status != STATUS_OK && !results.empty())
+      status = results[0];
   }
 
-  return hr;
+  return status;
 }
 
 
-HRESULT writeItem(OPCClient & opc, vector<string> const & tokens)
+Status writeItem(TagSource & source, vector<string> const & tokens)
 {
   if (tokens.size() < 3)
   {
     cout << "Invalid write command." << endl;
-    return S_FALSE;
+    return STATUS_FALSE;
   }
 
   string itemId = tokens[1];
   string value = tokens[2];
 
-  VARIANT v;
-  VariantInit(&v);
-  //v.vt = VT_I4;
-  //v.intVal = stoi(value);
-  toVariant(value, v);
+  // the text goes as it is, the source converts it to the item's type...
+  Value v;
+  v.type = TYPE_STRING;
+  v.text = value;
 
-  HRESULT hr = writeItem(opc, itemId, v);
+  Status status = writeItem(source, itemId, v);
 
-  if (hr == S_OK)
+  if (status == STATUS_OK)
     cout << "Success" << endl;
   else
-    cout << "Fail (" << hr << ")" << endl;
+    cout << "Fail (" << status << ")" << endl;
+
+  return status;
 }
 
 
-boost::mutex writeMtx;
-bool writeItemProxyFn(OPCClient & opc, string const & itemId, string value)
+void writeBatch(TagSource & source, vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results)
 {
-  boost::unique_lock<boost::mutex> lock(writeMtx);
+  source.write(items, values, results);
 
-  VARIANT v;
-  VariantInit(&v);
-  toVariant(value, v);
-
-  HRESULT hr = writeItem(opc, itemId, v);
+  // the written values are visible to the readers right away. The detector forgets
+  // the items, so the next value from the device goes through even if it is the one
+  // from before the write...
+  for (size_t i = 0; i < items.size(); i++)
+  {
+    if (results[i] != STATUS_OK)
+      continue;
 
-  return hr == S_OK;
+    changeDetector.forget(items[i].index);
+    valueCache.update(items[i].index, values[i], QUALITY_GOOD);
+  }
 }
 
 
-void openSocket(OPCClient & opc, vector<string> const & tokens)
+bool writeItemProxyFn(TagSource & source, WriteCoalescer & coalescer, boost::string_ref itemId, boost::string_ref value)
 {
-  int maxThreads = 1;
+  ItemInfo item;
 
-  if (tokens.size() == 2)
-    maxThreads = stoi(tokens[1]);
+  if (getItemInfo(source, itemId, item) != STATUS_OK || calculatedTags.calculated(item.index))
+    return false;
+
+  // the value is parsed as the item's canonical type, bad values never reach the server...
+  Value v;
+
+  if (parseValue(value.data(), value.size(), item.dataType, v) != STATUS_OK)
+    return false;
+
+  boost::shared_future<Status> result = coalescer.submit(item, v);
+
+  return result.get() == STATUS_OK;
 }
 
 
-HRESULT groupManager(OPCClient & opc, vector<string> const & tokens)
+// the proxy opens its socket at startup, open_socket is left for the scripts using it...
+void openSocket(TagSource &, vector<string> const &)
+{
+}
+
+
+Status groupManager(TagSource & source, vector<string> const & tokens)
 {
   if (tokens.size() == 2)
   {
     string option = tokens[1];
 
     if (option == "activate")
-      return opc.SetGroupState(true);
+      return source.set_active(true);
 
     if (option == "deactivate")
-      return opc.SetGroupState(false);
+      return source.set_active(false);
+  }
+
+  return STATUS_FALSE;
+}
+
+
+void recorderStats(function<string(int index)> itemIdFn, vector<string> const & tokens)
+{
+  if (!recorder)
+  {
+    cout << "The recorder is off." << endl;
+    return;
+  }
+
+  RecorderStats stats = recorder->stats();
+
+  cout << "samples: " << stats.samples << ", kept: " << stats.archived << ", bytes: " << stats.bytes;
+
+  if (stats.archived > 0)
+    cout << ", bytes/sample: " << static_cast<double>(stats.bytes) / stats.archived;
+
+  cout << ", dropped: " << stats.dropped << ", segments: " << stats.segments << endl;
+
+  if (stats.failed)
+    cout << "The recording stopped on an error, the samples are dropped." << endl;
+
+  // recorder items lists the compression of each item...
+  if (tokens.size() < 2 || tokens[1] != "items")
+    return;
+
+  vector<pair<int, CompressionStats>> items;
+  recorder->compression(items);
+
+  for (auto i = items.begin(); i != items.end(); ++i)
+  {
+    CompressionStats const & c = i->second;
+
+    cout << itemIdFn(i->first) << ": received " << c.received << ", kept " << c.archived;
+
+    if (c.archived > 0)
+      cout << ", ratio " << static_cast<double>(c.received) / c.archived;
+
+    cout << ", max error " << c.max_error;
+
+    if (c.received > 0)
+      cout << ", rms error " << sqrt(c.squared_error / c.received);
+
+    cout << endl;
+  }
+}
+
+
+// the changes of a batch gathered by the alarm stage...
+struct AlarmBatch
+{
+  vector<int> indexes;
+  vector<double> values;
+  vector<long long> times;
+  vector<AlarmTransition> transitions;
+  vector<string> messages;
+
+  void clear()
+  {
+    indexes.clear();
+    values.clear();
+    times.clear();
+    transitions.clear();
+    messages.clear();
+  }
+};
+
+
+// the alarms are only evaluated with some limits...
+void initAlarms(function<string(int index)> itemIdFn)
+{
+  if (!hasLimits(alarmLimits) && alarmClasses.empty())
+    return;
+
+  alarms = make_unique<AlarmEngine>(itemIdFn);
+  alarms->set_limits(alarmLimits);
+
+  for (auto c = alarmClasses.begin(); c != alarmClasses.end(); ++c)
+    alarms->set_limits(c->first, c->second);
+}
+
+
+// starts the stages of the changes. The cache and the history take them as they come,
+// the subscribers get what the cache has formatted, so they wait for the cache...
+void startStages()
+{
+  changeBus = make_unique<ChangeBus>(CHANGE_BUS_SIZE);
+
+  int cacheStage = changeBus->add_consumer("cache", [](ChangeEvent const & event, bool)
+  {
+    // the cache is indexed by the item index, so there is no lookup here...
+    valueCache.update(event.index, event.value, event.quality);
+  });
+
+  shared_ptr<vector<Record>> records = make_shared<vector<Record>>();
+
+  changeBus->add_consumer("history", [records](ChangeEvent const & event, bool last)
+  {
+    double number = numeric_limits<double>::quiet_NaN();
+    toDouble(event.value, number);
+
+    // stamped with the time of the batch, not of this stage, as in the recorder...
+    Sample sample{ event.time, number, event.quality };
+
+    history->record(event.index, sample);
+
+    if (recorder)
+      records->push_back(Record{ event.index, sample });
+
+    if (last && !records->empty())
+    {
+      recorder->record(*records);
+      records->clear();
+    }
+  });
+
+  shared_ptr<vector<Change>> published = make_shared<vector<Change>>();
+
+  changeBus->add_consumer("subscribers", [published](ChangeEvent const & event, bool last)
+  {
+    ProxyServer * proxy = proxyServer.load();
+    CachedValue cached;
+
+    if (proxy != nullptr && valueCache.get(event.index, cached))
+      published->push_back(Change{ event.index, formatCachedValue(cached), cached.number });
+
+    if (last && !published->empty())
+    {
+      if (proxy != nullptr)
+        proxy->publish(*published);
+
+      published->clear();
+    }
+  }, vector<int>(1, cacheStage));
+
+  if (alarms)
+  {
+    shared_ptr<AlarmBatch> gathered = make_shared<AlarmBatch>();
+
+    changeBus->add_consumer("alarms", [gathered](ChangeEvent const & event, bool last)
+    {
+      double number = numeric_limits<double>::quiet_NaN();
+
+      // a bad value leaves the alarms as they are...
+      if ((event.quality & QUALITY_MASK) != QUALITY_BAD)
+        toDouble(event.value, number);
+
+      gathered->indexes.push_back(event.index);
+      gathered->values.push_back(number);
+      gathered->times.push_back(event.time);
+
+      if (!last)
+        return;
+
+      alarms->evaluate(gathered->indexes.size(), gathered->indexes.data(), gathered->values.data(), gathered->times.data(), gathered->transitions);
+
+      ProxyServer * proxy = proxyServer.load();
+
+      if (!gathered->transitions.empty())
+      {
+        alarms->format(gathered->transitions, gathered->messages);
+
+        for (auto m = gathered->messages.begin(); m != gathered->messages.end(); ++m)
+          gatewayLog(*m + "\n");
+
+        if (proxy != nullptr)
+          proxy->publish_alarms(gathered->messages);
+      }
+
+      gathered->clear();
+    });
+  }
+
+  changeBus->start();
+}
+
+
+// the items that went quiet keep their value with an uncertain quality, so the READs
+// and the subscribers see it isn't current. The detector forgets them, so their next
+// value goes through as a change even if it is the same...
+void staleCallback(vector<int> const & indexes)
+{
+  vector<Change> changes;
+  CachedValue cached;
+
+  for (auto i = indexes.begin(); i != indexes.end(); ++i)
+  {
+    changeDetector.forget(*i);
+
+    // a value may have reached the cache since the watchdog looked...
+    if (!valueCache.expire(*i, WATCHDOG_TICK, QUALITY_UNCERTAIN) || !valueCache.get(*i, cached))
+      continue;
+
+    // no number, so the deadbands let it through...
+    changes.push_back(Change{ *i, formatCachedValue(cached), numeric_limits<double>::quiet_NaN() });
+  }
+
+  ProxyServer * proxy = proxyServer.load();
+
+  if (proxy != nullptr && !changes.empty())
+    proxy->publish(changes);
+}
+
+
+void startWatchdog(function<string(int index)> itemIdFn)
+{
+  if (staleTimeout <= 0 && staleClasses.empty())
+    return;
+
+  watchdog = make_unique<StaleWatchdog>(CACHE_SIZE, itemIdFn, staleCallback);
+  watchdog->set_timeout(staleTimeout);
+
+  for (auto c = staleClasses.begin(); c != staleClasses.end(); ++c)
+    watchdog->set_timeout(c->first, c->second);
+
+  watchdog->start();
+}
+
+
+void busStats()
+{
+  vector<ChangeBusStats> stats = changeBus->stats();
+
+  for (auto s = stats.begin(); s != stats.end(); ++s)
+    cout << s->name << ": handled " << s->sequence + 1 << ", lag " << s->lag << ", batches " << s->batches << endl;
+
+  cout << "full ring waits: " << changeBus->stalls() << endl;
+
+  if (watchdog)
+    cout << "stale items: " << watchdog->stale() << endl;
+}
+
+
+void alarmStats()
+{
+  if (!alarms)
+  {
+    cout << "no limits, see -L" << endl;
+    return;
   }
 
-  return S_FALSE;
+  vector<AlarmTransition> active;
+  vector<string> messages;
+
+  alarms->active(active);
+  alarms->format(active, messages);
+
+  for (auto m = messages.begin(); m != messages.end(); ++m)
+    cout << *m << endl;
+
+  cout << "active alarms: " << alarms->active_count() << ", evaluated values: " << alarms->evaluated() << endl;
 }
 
 
-void commandLoop(OPCClient & opc)
+void calculatedStats()
+{
+  vector<CalculatedTag> tags = calculatedTags.list();
+  CachedValue cached;
+
+  for (auto t = tags.begin(); t != tags.end(); ++t)
+  {
+    cout << t->id << " = " << t->text << " (" << t->size << " bytes): ";
+
+    if (valueCache.get(t->index, cached))
+      cout << formatCachedValue(cached) << endl;
+    else
+      cout << "no value" << endl;
+  }
+
+  cout << "calculated tags: " << tags.size() << ", evaluations: " << calculatedTags.evaluations() << ", inputs not found: " << calculatedTags.unresolved() << endl;
+}
+
+
+void commandLoop(TagSource & source)
 {
   string cmd;
   vector<string> tokens;
@@ -217,19 +756,27 @@ void commandLoop(OPCClient & opc)
     copy(istream_iterator<string>(iss), istream_iterator<string>(), back_inserter(tokens));
 
     if (tokens[0] == "connect")
-      connectCommand(opc);
+      connectCommand(source);
     else if (tokens[0] == "disconnect")
-      disconnectCommand(opc);
+      disconnectCommand(source);
     else if (tokens[0] == "add_211")
-      addServer211Items(opc);
+      addServer211Items(source);
     else if (tokens[0] == "read")
-      readItem(opc, tokens);
+      readItem(source, tokens);
     else if (tokens[0] == "write")
-      writeItem(opc, tokens);
+      writeItem(source, tokens);
     else if (tokens[0] == "group")
-      groupManager(opc, tokens);
+      groupManager(source, tokens);
     else if (tokens[0] == "open_socket")
-      openSocket(opc, tokens);
+      openSocket(source, tokens);
+    else if (tokens[0] == "recorder")
+      recorderStats([&](int index) -> string { return itemIdOf(source, index); }, tokens);
+    else if (tokens[0] == "bus")
+      busStats();
+    else if (tokens[0] == "alarms")
+      alarmStats();
+    else if (tokens[0] == "calc")
+      calculatedStats();
 
 
     tokens.clear();
@@ -239,77 +786,399 @@ void commandLoop(OPCClient & opc)
 
 void dataChangeCallback(vector<unique_ptr<ItemValue>> const & data)
 {
-  vector<unique_ptr<ItemValue>> changed;
+  ChangeSet changes;
+
+  if (capture)
+    capture->write(data);
 
-  for (auto d = data.begin(); d != data.end(); ++d)
+  // a repeated value tells the item is still there as much as a new one...
+  if (watchdog)
   {
-    //auto a = find(actualValues.begin(), actualValues.end(), *d);
-    auto a = find_if(actualValues.begin(), actualValues.end(), [&](unique_ptr<ItemValue> const & obj) {
-      return  obj->handle == (*d)->handle;
-    });
+    for (auto d = data.begin(); d != data.end(); ++d)
+      watchdog->seen((*d)->index);
+  }
 
+  // the repeated values only keep the cached ones fresh, the changes go on to the stages
+  // with the calculated tags they change...
+  changeDetector.detect(data, changes);
+  calculatedTags.update(changes);
 
-    // if found in the actual values
-    if (a != actualValues.end())
-    {
-      ULONG res = VarCmp(&(*a)->value, &(*d)->value, 0);
+  for (auto r = changes.repeated.begin(); r != changes.repeated.end(); ++r)
+    valueCache.touch(*r);
 
-      if (res == VARCMP_GT || res == VARCMP_LT)
-      {
-        (*a)->value = (*d)->value;
-      }
-    }
-    else
-    {
-      // its a new item
-      changed.push_back(make_unique<ItemValue>(ItemValue{ (*d)->handle, (*d)->value, (*d)->quality }));
-      actualValues.push_back(make_unique<ItemValue>(ItemValue{ (*d)->handle, (*d)->value, (*d)->quality }));
-    }
+  if (!changes.changed.empty())
+    changeBus->publish(changes.changed, HistoryStore::now());
+}
+
+
+bool writeAsyncItemProxyFn(TagSource & source, boost::string_ref itemId, boost::string_ref value, unsigned long transactionId)
+{
+  ItemInfo item;
+
+  if (getItemInfo(source, itemId, item) != STATUS_OK || calculatedTags.calculated(item.index))
+    return false;
+
+  Value v;
+
+  if (parseValue(value.data(), value.size(), item.dataType, v) != STATUS_OK)
+    return false;
+
+  Status status = source.write_async(item, v, transactionId);
+
+  return status == STATUS_OK;
+}
+
+
+void writeCompleteCallback(unsigned long transactionId, Status result)
+{
+  ProxyServer * proxy = proxyServer.load();
+
+  if (proxy != nullptr)
+    proxy->write_completed(transactionId, result == STATUS_OK);
+}
+
+
+// the samples of an item in a range, from the rings and then the recorder...
+void historyResponse(int index, long long from, long long to, string & response)
+{
+  long long now = HistoryStore::now();
+
+  if (from <= 0)
+    from += now;
+
+  if (to <= 0)
+    to += now;
+
+  vector<Sample> samples;
+  history->query(index, from, to, samples);
+
+  // what is older than the ring comes from the recorder...
+  if (recorder && (samples.empty() || samples.front().timestamp > from))
+  {
+    vector<Sample> recorded;
+    recorder->query(index, from, samples.empty() ? to : samples.front().timestamp - 1, recorded);
+
+    samples.insert(samples.begin(), recorded.begin(), recorded.end());
+  }
+
+  // count|timestamp,value,quality|...
+  appendInteger(response, samples.size());
+
+  for (auto s = samples.begin(); s != samples.end(); ++s)
+  {
+    response.push_back('|');
+    appendInteger(response, s->timestamp);
+    response.push_back(',');
+    appendNumber(response, s->number);
+    response.push_back(',');
+    appendInteger(response, s->quality);
+  }
+}
+
+
+void historyItemProxyFn(TagSource & source, boost::string_ref itemId, long long from, long long to, string & response)
+{
+  ItemInfo item;
+
+  if (getItemInfo(source, itemId, item) != STATUS_OK)
+  {
+    response.append("HIST_FAIL");
+    return;
   }
+
+  historyResponse(item.index, from, to, response);
+}
+
+
+int resolveItemProxyFn(TagSource & source, boost::string_ref itemId)
+{
+  ItemInfo item;
+
+  if (getItemInfo(source, itemId, item) != STATUS_OK)
+    return -1;
+
+  return item.index;
 }
 
 
-void initProxyAsync(function<string(string const & itemId)> readFn, function<bool(string const & itemId, string value)> writeFn)
+void initProxyAsync(ReadHandler readFn, WriteHandler writeFn, ResolveHandler resolveFn, AsyncWriteHandler asyncWriteFn, HistoryHandler historyFn, CachedHandler cachedFn)
 {
-  ProxyServer proxy(9002, readFn, writeFn);
+  ProxyServer proxy(9002, transportType, reactorCount, pinReactors, readFn, writeFn, resolveFn, asyncWriteFn, historyFn);
+
+  proxy.cached_reads(cachedFn);
+
+  if (!trafficFile.empty())
+    proxy.capture(trafficFile);
+
+  if (alarms)
+  {
+    proxy.alarm_list([](vector<string> & messages)
+    {
+      vector<AlarmTransition> active;
+      alarms->active(active);
+      alarms->format(active, messages);
+    });
+  }
+
+  proxyServer = &proxy;
   proxy.start();
 }
 
 
-//function<string(string const & itemId)> readFnHandler;
+// stops the proxy and waits for its thread, so no request is served once the stores
+// are gone. The proxy may still be starting...
+void stopProxy(boost::thread & proxyThread)
+{
+  while (!proxyThread.try_join_for(boost::chrono::milliseconds(10)))
+  {
+    ProxyServer * proxy = proxyServer.exchange(nullptr);
+
+    if (proxy != nullptr)
+      proxy->stop();
+  }
+}
+
+
+// makes the history rings and the recorder, the item ids give their classes...
+void initStores(function<string(int index)> itemIdFn)
+{
+  history = make_unique<HistoryStore>(CACHE_SIZE, itemIdFn);
+  history->set_depth(historyDepth);
+
+  for (auto c = historyClasses.begin(); c != historyClasses.end(); ++c)
+    history->set_depth(c->first, c->second);
+
+  if (recorderDirectory != "none")
+  {
+    recorder = make_unique<Recorder>(recorderDirectory, recorderRetention, itemIdFn);
+    recorder->set_compression(recorderCompression);
+
+    for (auto c = compressionClasses.begin(); c != compressionClasses.end(); ++c)
+      recorder->set_compression(c->first, c->second);
+  }
+}
+
+
+void printReplayStats(ReplayStats const & stats)
+{
+  cout << "batches: " << stats.batches << ", values: " << stats.values << ", seconds: " << stats.elapsed / 1e6;
+
+  if (stats.elapsed > 0)
+    cout << ", values/s: " << static_cast<double>(stats.values) * 1e6 / stats.elapsed;
+
+  cout << ", max lag (ms): " << stats.max_lag / 1e3 << endl;
+}
+
+
+// replays a capture through the cache, the history, the recorder and the proxy, with
+// no OPC server nor COM. The proxy knows the captured items, it reads them from the
+// cache and fails the writes...
+int replayMain()
+{
+  CaptureReader reader(replayFile);
+
+  if (!reader.good())
+  {
+    cout << "Invalid capture file: " << replayFile << endl;
+    return 1;
+  }
+
+  vector<ItemInfo> const & items = reader.items();
+  unordered_map<string, int> indexes;
+
+  for (auto i = items.begin(); i != items.end(); ++i)
+  {
+    if (!i->id.empty())
+      indexes[i->id] = i->index;
+  }
+
+  function<string(int index)> itemIdFn = [&](int index) -> string
+  {
+    if (calculatedTags.calculated(index))
+      return calculatedTags.item_id(index);
+
+    return static_cast<size_t>(index) < items.size() ? items[index].id : string();
+  };
+
+  calculatedTags.set_resolver([&](string const & itemId) -> int
+  {
+    auto i = indexes.find(itemId);
+    return i == indexes.end() ? -1 : i->second;
+  });
+
+  initStores(itemIdFn);
+  initAlarms(itemIdFn);
+  startStages();
+  startWatchdog(itemIdFn);
+
+  ResolveHandler resolveFnHandler = [&](boost::string_ref itemId) -> int
+  {
+    string id(itemId.begin(), itemId.end());
+    ItemInfo item;
+
+    if (calculatedTags.item_info(id, item))
+      return item.index;
+
+    auto i = indexes.find(id);
+    return i == indexes.end() ? -1 : i->second;
+  };
+
+  ReadHandler readFnHandler = [&](boost::string_ref itemId, bool, string & response)
+  {
+    int index = resolveFnHandler(itemId);
+    CachedValue cached;
+
+    if (index < 0 || !valueCache.get(index, cached))
+      response.append("READ_FAIL");
+    else
+      formatCachedValue(cached, response);
+  };
+
+  WriteHandler writeFnHandler = [](boost::string_ref, boost::string_ref) -> bool { return false; };
+
+  AsyncWriteHandler asyncWriteFnHandler = [](boost::string_ref, boost::string_ref, unsigned long) -> bool { return false; };
+
+  HistoryHandler historyFnHandler = [&](boost::string_ref itemId, long long from, long long to, string & response)
+  {
+    int index = resolveFnHandler(itemId);
+
+    if (index < 0)
+      response.append("HIST_FAIL");
+    else
+      historyResponse(index, from, to, response);
+  };
+
+  // the replayed values are all there is, a READ never goes further than the cache...
+  CachedHandler cachedFnHandler = [](boost::string_ref) -> bool { return true; };
+
+  boost::thread proxyThread(&initProxyAsync, readFnHandler, writeFnHandler, resolveFnHandler, asyncWriteFnHandler, historyFnHandler, cachedFnHandler);
+
+  printReplayStats(replay(reader, replaySpeed, dataChangeCallback));
+
+  // replay [speed] feeds the capture again...
+  string cmd;
+  vector<string> tokens;
+
+  do
+  {
+    cout << "Enter a command: " << endl;
+    getline(cin, cmd);
+
+    istringstream iss(cmd);
+    copy(istream_iterator<string>(iss), istream_iterator<string>(), back_inserter(tokens));
+
+    if (tokens.empty())
+      continue;
+
+    if (tokens[0] == "replay")
+    {
+      reader.rewind();
+      printReplayStats(replay(reader, tokens.size() > 1 ? atof(tokens[1].c_str()) : replaySpeed, dataChangeCallback));
+    }
+    else if (tokens[0] == "recorder")
+    {
+      recorderStats(itemIdFn, tokens);
+    }
+    else if (tokens[0] == "bus")
+    {
+      busStats();
+    }
+    else if (tokens[0] == "alarms")
+    {
+      alarmStats();
+    }
+    else if (tokens[0] == "calc")
+    {
+      calculatedStats();
+    }
+
+    tokens.clear();
+  } while (cmd != "quit" && cin.good());
+
+  watchdog.reset();
+  changeBus->stop();
+  stopProxy(proxyThread);
+  recorder.reset();
+
+  return 0;
+}
+
+
+//ReadHandler readFnHandler;
 
 int main(int argc, char * argv[])
 {
   setupOptions(argc, argv);
 
-  gatewayLog("Initializing COM.\r\n");
-  OPCClient::Initialize();
+  if (!replayFile.empty())
+    return replayMain();
 
   try
   {
+    unique_ptr<TagSource> source;
+
+    if (simulatedSource)
+      source = make_unique<SimulatedSource>(simulation, gatewayLog, dataChangeCallback, writeCompleteCallback);
+#ifdef _WIN32
+    else
+      source = make_unique<OpcSource>(gatewayLog, dataChangeCallback, writeCompleteCallback);
+#else
+    else
+    {
+      cout << "The OPC source needs COM, only the simulated source (-S sim) runs here." << endl;
+      return 1;
+    }
+#endif
+
+    calculatedTags.set_resolver([&](string const & itemId) -> int
     {
-      unique_ptr<OPCClient> opc = make_unique<OPCClient>(gatewayLog, dataChangeCallback);
+      ItemInfo item;
+      return source->item_info(itemId, item) == STATUS_OK ? item.index : -1;
+    });
 
-      function<string(string const & itemId)> readFnHandler = [&](string const & itemId) -> string { return readItemProxyFn(*opc, itemId); };
+    initStores([&](int index) -> string { return itemIdOf(*source, index); });
+    initAlarms([&](int index) -> string { return itemIdOf(*source, index); });
+    startStages();
+    startWatchdog([&](int index) -> string { return itemIdOf(*source, index); });
 
-      function<bool(string const & itemId, string value)> writeFnHandler = [&](string const & itemId, string value) -> bool { return writeItemProxyFn(*opc, itemId, value); };
+    if (!captureFile.empty())
+      capture = make_unique<CaptureWriter>(captureFile, [&](size_t index) -> ItemInfo { return source->item_info(index); });
 
-      boost::thread proxyThread(&initProxyAsync, readFnHandler, writeFnHandler);
+    // the simulated items are there from the start, the server ones come with connect...
+    if (simulatedSource)
+      source->connect(string());
 
-      commandLoop(*opc);
+    ReadHandler readFnHandler = [&](boost::string_ref itemId, bool fromDevice, string & response) { readItemProxyFn(*source, itemId, fromDevice, response); };
 
-      proxyThread.interrupt();
-    }
+    unique_ptr<WriteCoalescer> coalescer = make_unique<WriteCoalescer>([&](vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results) { writeBatch(*source, items, values, results); }, writeWindow);
+
+    WriteHandler writeFnHandler = [&](boost::string_ref itemId, boost::string_ref value) -> bool { return writeItemProxyFn(*source, *coalescer, itemId, value); };
+
+    ResolveHandler resolveFnHandler = [&](boost::string_ref itemId) -> int { return resolveItemProxyFn(*source, itemId); };
 
-    gatewayLog("Uninitializing COM.\r\n");
-    OPCClient::Uninitialize();
+    AsyncWriteHandler asyncWriteFnHandler = [&](boost::string_ref itemId, boost::string_ref value, unsigned long transactionId) -> bool { return writeAsyncItemProxyFn(*source, itemId, value, transactionId); };
+
+    HistoryHandler historyFnHandler = [&](boost::string_ref itemId, long long from, long long to, string & response) { historyItemProxyFn(*source, itemId, from, to, response); };
+
+    CachedHandler cachedFnHandler = [&](boost::string_ref itemId) -> bool { return cachedItemProxyFn(*source, itemId); };
+
+    boost::thread proxyThread(&initProxyAsync, readFnHandler, writeFnHandler, resolveFnHandler, asyncWriteFnHandler, historyFnHandler, cachedFnHandler);
+
+    commandLoop(*source);
+
+    // the source stops sending changes and the stages finish theirs before the proxy and
+    // the stores go, then the blocks being filled are written...
+    source->disconnect();
+    watchdog.reset();
+    changeBus->stop();
+    stopProxy(proxyThread);
+    coalescer.reset();
+    recorder.reset();
+    capture.reset();
   }
   catch (exception & e)
   {
     gatewayLog("An exception occurred: " + string(e.what()));
-
-    gatewayLog("Uninitializing COM.\r\n");
-    OPCClient::Uninitialize();
   }
 
   return 0;
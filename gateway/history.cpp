@@ -0,0 +1,170 @@
+#include "history.h"
+
+HistoryRing::HistoryRing(size_t depth) :
+samples(depth),
+head(0),
+count(0)
+{
+}
+
+
+void HistoryRing::record(Sample const & sample)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  Sample & next = samples[head];
+  next = sample;
+
+  // a clock step back would break the order the search relies on...
+  if (count > 0)
+    next.timestamp = max(next.timestamp, at(count - 1).timestamp);
+
+  head = (head + 1) % samples.size();
+  count = min(count + 1, samples.size());
+}
+
+
+void HistoryRing::query(long long from, long long to, size_t limit, vector<Sample> & result)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  size_t low = 0;
+  size_t high = count;
+
+  // first sample not older than from...
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+
+    if (at(middle).timestamp < from)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  for (size_t i = low; i < count && at(i).timestamp <= to && limit > 0; i++, limit--)
+    result.push_back(at(i));
+}
+
+
+size_t HistoryRing::depth() const
+{
+  return samples.size();
+}
+
+
+Sample const & HistoryRing::at(size_t position) const
+{
+  // position 0 is the oldest sample...
+  return samples[(head + samples.size() - count + position) % samples.size()];
+}
+
+
+HistoryStore::HistoryStore(size_t capacity, function<string(int index)> itemIdFn) :
+default_depth(HISTORY_DEPTH),
+itemId(itemIdFn),
+rings(new atomic<HistoryRing *>[capacity]),
+disabled(capacity, false),
+capacity(capacity)
+{
+  for (size_t i = 0; i < capacity; i++)
+    rings[i] = nullptr;
+}
+
+
+void HistoryStore::set_depth(size_t depth)
+{
+  default_depth = depth;
+}
+
+
+void HistoryStore::set_depth(string const & prefix, size_t depth)
+{
+  classes.push_back(make_pair(prefix, depth));
+
+  // the longest prefixes are tried first...
+  stable_sort(classes.begin(), classes.end(), [](pair<string, size_t> const & a, pair<string, size_t> const & b) { return a.first.size() > b.first.size(); });
+}
+
+
+void HistoryStore::record(int index, Sample const & sample)
+{
+  HistoryRing * r = ring(index);
+
+  if (r != nullptr)
+    r->record(sample);
+}
+
+
+bool HistoryStore::query(int index, long long from, long long to, vector<Sample> & samples)
+{
+  if (index < 0 || static_cast<size_t>(index) >= capacity)
+    return false;
+
+  HistoryRing * r = rings[index].load();
+
+  if (r != nullptr)
+    r->query(from, to, MAX_HISTORY_SAMPLES, samples);
+
+  return true;
+}
+
+
+size_t HistoryStore::memory()
+{
+  boost::unique_lock<boost::mutex> lock(rings_mtx);
+
+  size_t total = 0;
+
+  for (auto r = owned.begin(); r != owned.end(); ++r)
+    total += (*r)->depth() * sizeof(Sample);
+
+  return total;
+}
+
+
+long long HistoryStore::now()
+{
+  return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+HistoryRing * HistoryStore::ring(int index)
+{
+  if (index < 0 || static_cast<size_t>(index) >= capacity || disabled[index])
+    return nullptr;
+
+  HistoryRing * r = rings[index].load(memory_order_acquire);
+
+  if (r != nullptr)
+    return r;
+
+  size_t itemDepth = depth(itemId(index));
+
+  if (itemDepth == 0)
+  {
+    disabled[index] = true;
+    return nullptr;
+  }
+
+  boost::unique_lock<boost::mutex> lock(rings_mtx);
+
+  owned.push_back(unique_ptr<HistoryRing>(new HistoryRing(itemDepth)));
+  r = owned.back().get();
+
+  rings[index].store(r, memory_order_release);
+
+  return r;
+}
+
+
+size_t HistoryStore::depth(string const & id)
+{
+  for (auto c = classes.begin(); c != classes.end(); ++c)
+  {
+    if (id.compare(0, c->first.size(), c->first) == 0)
+      return c->second;
+  }
+
+  return default_depth;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+static size_t const HISTORY_DEPTH = 600;
+static size_t const MAX_HISTORY_SAMPLES = 10000;
+
+// a recorded value. Only the numeric value is kept, text values are recorded as NaN...
+struct Sample
+{
+  long long timestamp;
+  double number;
+  Quality quality;
+};
+
+// the last samples of one item, oldest overwritten first. The timestamps never go
+// back, so the samples are always sorted and a range is found by binary search...
+class HistoryRing
+{
+public:
+  HistoryRing(size_t depth);
+
+  void record(Sample const & sample);
+
+  // appends the samples with from <= timestamp <= to, oldest first...
+  void query(long long from, long long to, size_t limit, vector<Sample> & samples);
+
+  size_t depth() const;
+
+private:
+  boost::mutex mtx;
+  vector<Sample> samples;
+  size_t head;
+  size_t count;
+
+  Sample const & at(size_t position) const;
+};
+
+
+// the history rings of all the items, indexed by the item index. A ring is made on
+// the first sample of its item, its depth coming from the item's class. A class is
+// an item id prefix, the longest matching one wins, so the memory taken is bounded
+// by the depth of each class times the number of its items.
+class HistoryStore
+{
+public:
+  HistoryStore(size_t capacity, function<string(int index)> itemIdFn);
+
+  // sets the depth of the items without a class, 0 disables their history...
+  void set_depth(size_t depth);
+  void set_depth(string const & prefix, size_t depth);
+
+  // records the sample of an item. The recorder gets the same sample, so the two
+  // stores agree on its time...
+  void record(int index, Sample const & sample);
+
+  // gets the samples of an item in a range of epoch milliseconds...
+  bool query(int index, long long from, long long to, vector<Sample> & samples);
+
+  // memory taken by the samples of all the rings...
+  size_t memory();
+
+  static long long now();
+
+private:
+  size_t default_depth;
+  vector<pair<string, size_t>> classes;
+  function<string(int index)> itemId;
+
+  // the rings are only made by the recording thread, the readers just load the pointers...
+  boost::mutex rings_mtx;
+  vector<unique_ptr<HistoryRing>> owned;
+  unique_ptr<atomic<HistoryRing *>[]> rings;
+  vector<bool> disabled;
+  size_t capacity;
+
+  HistoryRing * ring(int index);
+  size_t depth(string const & itemId);
+};
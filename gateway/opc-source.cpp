@@ -0,0 +1,94 @@
+#include "opc-source.h"
+
+OpcSource::OpcSource(LogHandler logFunc, DataChangeHandler dataChangeFunc, WriteCompleteHandler writeCompleteFunc) :
+logger(logFunc)
+{
+  logger("Initializing COM.\r\n");
+  OPCClient::Initialize();
+
+  client = make_unique<OPCClient>(logFunc, dataChangeFunc, writeCompleteFunc);
+}
+
+
+OpcSource::~OpcSource()
+{
+  // the client releases its COM objects before COM goes...
+  client.reset();
+
+  logger("Uninitializing COM.\r\n");
+  OPCClient::Uninitialize();
+}
+
+
+void OpcSource::connect(string const & server)
+{
+  client->Connect(server);
+}
+
+
+void OpcSource::disconnect()
+{
+  client->Disconnect();
+}
+
+
+Status OpcSource::add_item(string const & itemId, ValueType type, ItemInfo & item)
+{
+  return client->AddItem(itemId, static_cast<VARENUM>(type), item);
+}
+
+
+Status OpcSource::item_info(string const & itemId, ItemInfo & item)
+{
+  return client->GetItemInfo(itemId, item);
+}
+
+
+ItemInfo OpcSource::item_info(size_t index)
+{
+  return client->GetItemInfoByIndex(index);
+}
+
+
+Status OpcSource::read(ItemInfo const & item, ItemValue & value)
+{
+  return client->Read(item, value);
+}
+
+
+Status OpcSource::write(vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results)
+{
+  vector<VARIANT> variants(values.size());
+  vector<HRESULT> errors;
+
+  for (size_t i = 0; i < values.size(); i++)
+    toVariant(values[i], variants[i]);
+
+  HRESULT hr = client->Write(items, variants, errors);
+
+  results.assign(errors.begin(), errors.end());
+
+  for (auto v = variants.begin(); v != variants.end(); ++v)
+    VariantClear(&*v);
+
+  return hr;
+}
+
+
+Status OpcSource::write_async(ItemInfo const & item, Value const & value, unsigned long transactionId)
+{
+  VARIANT variant;
+  toVariant(value, variant);
+
+  HRESULT hr = client->WriteAsync(item, variant, transactionId);
+
+  VariantClear(&variant);
+
+  return hr;
+}
+
+
+Status OpcSource::set_active(bool active)
+{
+  return client->SetGroupState(active);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opc_client.h"
+#include "tag-source.h"
+
+using namespace opc;
+using namespace std;
+
+// the items of an OPC-DA server, through OPCClient. COM is initialized for as long as
+// the source lives, the values written are converted to VARIANTs here and the
+// HRESULTs are given back as they are. Only builds on Windows...
+class OpcSource : public TagSource
+{
+public:
+  OpcSource(LogHandler logFunc, DataChangeHandler dataChangeFunc, WriteCompleteHandler writeCompleteFunc);
+  ~OpcSource();
+
+  void connect(string const & server);
+  void disconnect();
+
+  Status add_item(string const & itemId, ValueType type, ItemInfo & item);
+  Status item_info(string const & itemId, ItemInfo & item);
+  ItemInfo item_info(size_t index);
+
+  Status read(ItemInfo const & item, ItemValue & value);
+  Status write(vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results);
+  Status write_async(ItemInfo const & item, Value const & value, unsigned long transactionId);
+
+  Status set_active(bool active);
+
+private:
+  LogHandler logger;
+  unique_ptr<OPCClient> client;
+};
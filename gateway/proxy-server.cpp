@@ -1,18 +1,82 @@
 #include "proxy-server.h"
 
-ProxyServer::ProxyServer(int const & port, function<string(string const & itemId)>readFnHandler, function<bool(string const & itemId, string value)> writeFnHandler) :
-tcp_service(),
+// parses a number out of a token, which isn't null terminated...
+static double to_number(boost::string_ref text)
+{
+  char buffer[64];
+  size_t length = min(text.size(), sizeof(buffer) - 1);
+
+  memcpy(buffer, text.data(), length);
+  buffer[length] = '\0';
+
+  return atof(buffer);
+}
+
+
+static boost::string_ref trim(boost::string_ref text)
+{
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+    text.remove_prefix(1);
+
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+    text.remove_suffix(1);
+
+  return text;
+}
+
+
+ProxyServer::ProxyServer(int const & port, TransportType transport, unsigned reactorCount, bool pinned, ReadHandler readFnHandler, WriteHandler writeFnHandler, ResolveHandler resolveFnHandler, AsyncWriteHandler asyncWriteFnHandler, HistoryHandler historyFnHandler) :
+next_reactor(0),
+connections(0),
 worker_service(),
-tcp_acceptor(tcp_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)),
 worker(worker_service),
 readFunc(readFnHandler),
-writeFunc(writeFnHandler)
+writeFunc(writeFnHandler),
+resolveFunc(resolveFnHandler),
+asyncWriteFunc(asyncWriteFnHandler),
+historyFunc(historyFnHandler),
+fan_out(worker_service, [readFnHandler](string const & itemId) -> string { string value; readFnHandler(itemId, false, value); return value; }),
+next_transaction(1),
+next_session(1)
 {
-  available_connections = POOL_SIZE;
+  boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+  unsigned count = max(reactorCount, 1u);
+
+  if (transport == URING_TRANSPORT)
+  {
+#ifdef GATEWAY_IO_URING
+    // every ring accepts on its own socket, io_uring is only on Linux where SO_REUSEPORT is...
+    for (unsigned i = 0; i < count; i++)
+    {
+      UringReactor * ring = new UringReactor(i, pinned ? static_cast<int>(i) : -1, boost::bind(&ProxyServer::admit, this, _1, _2));
+      loops.push_back(unique_ptr<EventLoop>(ring));
+      ring->listen(endpoint);
+    }
+#else
+    std::cout << "Proxy Server - io_uring is not available in this build, using Asio" << std::endl;
+#endif
+  }
+
+  if (loops.empty())
+  {
+    for (unsigned i = 0; i < count; i++)
+    {
+      Reactor * reactor = new Reactor(i, pinned ? static_cast<int>(i) : -1);
+      loops.push_back(unique_ptr<EventLoop>(reactor));
+      reactors.push_back(reactor);
+    }
+
+#ifdef REUSE_PORT_SUPPORTED
+    for (auto r = reactors.begin(); r != reactors.end(); ++r)
+      (*r)->listen(endpoint, true);
+#else
+    reactors.front()->listen(endpoint, false);
+#endif
+  }
 
   start_threadpool();
 
-  std::cout << "Proxy Server - Listening on " << tcp_acceptor.local_endpoint() << std::endl;
+  std::cout << "Proxy Server - Listening on " << endpoint << " - " << (reactors.empty() ? "io_uring" : "Asio") << " loops: " << loops.size() << std::endl;
 }
 
 
@@ -21,10 +85,14 @@ ProxyServer::~ProxyServer()
   // para o loop servio para que nenhuma tarefa aps esse ponto seja executada.
   worker_service.stop();
 
-  tcp_service.stop();
+  for (auto l = loops.begin(); l != loops.end(); ++l)
+    (*l)->stop();
 
   // aguarda o fim das tarefas em execuo
   threadpool.join_all();
+
+  for (auto l = loops.begin(); l != loops.end(); ++l)
+    (*l)->join();
 }
 
 
@@ -37,129 +105,489 @@ void ProxyServer::start_threadpool()
 }
 
 
+void ProxyServer::capture(string const & path)
+{
+  traffic.reset(new TrafficCapture(path));
+
+  if (!traffic->good())
+  {
+    std::cout << "Proxy Server - Cannot capture the traffic to " << path << std::endl;
+    traffic.reset();
+  }
+}
+
+
+void ProxyServer::alarm_list(AlarmListHandler handler)
+{
+  alarmListFunc = handler;
+}
+
+
+void ProxyServer::cached_reads(CachedHandler handler)
+{
+  cachedFunc = handler;
+}
+
+
+void ProxyServer::publish_alarms(vector<string> const & alarms)
+{
+  boost::unique_lock<boost::mutex> lock(alarms_mtx);
+
+  for (auto w = alarm_sessions.begin(); w != alarm_sessions.end(); ++w)
+  {
+    shared_ptr<Session> s = w->lock();
+
+    if (!s)
+      continue;
+
+    for (auto a = alarms.begin(); a != alarms.end(); ++a)
+      s->respond(*a);
+  }
+}
+
+
 void ProxyServer::start()
 {
-  while (true)
+  for (auto r = reactors.begin(); r != reactors.end(); ++r)
+  {
+    if ((*r)->acceptor() != nullptr)
+      accept(**r);
+  }
+
+  for (auto l = loops.begin(); l != loops.end(); ++l)
+    (*l)->start();
+
+  for (auto l = loops.begin(); l != loops.end(); ++l)
+    (*l)->join();
+}
+
+
+void ProxyServer::stop()
+{
+  for (auto l = loops.begin(); l != loops.end(); ++l)
+    (*l)->stop();
+}
+
+
+void ProxyServer::publish(std::vector<Change> const & changes)
+{
+  fan_out.publish(changes);
+}
+
+
+void ProxyServer::write_completed(unsigned long transactionId, bool success)
+{
+  shared_ptr<Session> s;
+
   {
-    check_connections_pool();
+    boost::unique_lock<boost::mutex> lock(writes_mtx);
+
+    auto found = outstanding_writes.find(transactionId);
+
+    if (found == outstanding_writes.end())
+      return;
+
+    s = found->second.lock();
+    outstanding_writes.erase(found);
+  }
+
+  // the session may have ended while the write was running...
+  if (!s)
+    return;
+
+  shared_ptr<string> response = s->acquire();
+  response->append("WRITE_DONE|");
+  opc::appendInteger(*response, transactionId);
+  response->append(success ? "|OK" : "|FAIL");
+
+  s->respond(response);
+}
+
+
+void ProxyServer::accept(Reactor & listener)
+{
+  // each reactor accepts its own connections, without SO_REUSEPORT the first one
+  // hands them to the reactors in turn...
+#ifdef REUSE_PORT_SUPPORTED
+  Reactor & target = listener;
+#else
+  Reactor & target = *reactors[next_reactor++ % reactors.size()];
+#endif
+
+  boost::asio::ip::tcp::socket * socket = new boost::asio::ip::tcp::socket(target.service());
+
+  listener.acceptor()->async_accept(*socket, boost::bind(&ProxyServer::on_accept, this, boost::ref(listener), boost::ref(target), socket, boost::asio::placeholders::error));
+}
+
 
-    boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(tcp_service);
-    tcp_acceptor.accept(*socket);
+void ProxyServer::on_accept(Reactor & listener, Reactor & target, boost::asio::ip::tcp::socket * socket, boost::system::error_code const & error)
+{
+  if (error)
+  {
+    delete socket;
 
-    std::cout << "Application Server - New conection from " << socket->remote_endpoint() << std::endl;
+    // the pending accept is cancelled when the reactor stops...
+    if (error != boost::asio::error::operation_aborted)
+      accept(listener);
 
-    worker_service.post(boost::bind(&ProxyServer::session, this, socket));
+    return;
   }
+
+  // from now on the session only runs on the thread of its reactor...
+  shared_ptr<Session> s = make_shared<Session>(unique_ptr<Transport>(new SocketTransport(target.service(), socket)));
+  target.service().post(boost::bind(&ProxyServer::admit, this, boost::ref<EventLoop>(target), s));
+
+  accept(listener);
 }
 
 
-void ProxyServer::check_connections_pool()
+void ProxyServer::admit(EventLoop & loop, shared_ptr<Session> const & s)
 {
-  boost::unique_lock<boost::mutex> lock(m);
-  while (available_connections <= 0)
+  if (++connections > MAX_CONNECTIONS)
   {
+    --connections;
+
     std::cout << "Application Server - Maximun number of connections reach" << std::endl;
-    cv.wait(lock);
+
+    s->close();
+    return;
   }
 
-  --available_connections;
+  s->id = next_session++;
+
+  std::cout << "Application Server - New conection from " << s->transport().peer() << " - Loop " << loop.id << std::endl;
+
+  if (traffic)
+    traffic->connected(s->id);
+
+  loop.add(s);
+
+  if (!fan_out.attach(s))
+    std::cout << "Application Server - Maximun number of subscribers reach" << std::endl;
+
+  read_request(loop, s);
 }
 
 
-void ProxyServer::session(boost::asio::ip::tcp::socket* socket)
+void ProxyServer::end_session(EventLoop & loop, shared_ptr<Session> const & s)
 {
-  try
+  fan_out.detach(*s);
+
   {
-    while (true)
-    {
-      std::string message = read_request(socket);
-      boost::algorithm::trim(message);
+    boost::unique_lock<boost::mutex> lock(alarms_mtx);
 
-      if (message == "DISCONNECTED")
+    for (auto w = alarm_sessions.begin(); w != alarm_sessions.end(); ++w)
+    {
+      if (w->lock() == s)
       {
-        std::cerr << "Application Server - Client has disconnected." << socket->remote_endpoint() << std::endl;
+        alarm_sessions.erase(w);
         break;
       }
-
-      process_request(socket, message);
     }
   }
-  catch (std::exception &e)
-  {
-    std::cerr << "Application Server - Session error - " << e.what() << std::endl;
-  }
 
-  if (socket->is_open())
-    socket->close();
+  if (traffic)
+    traffic->disconnected(s->id);
+
+  // the transport is closed by the loop once the pending writes are cancelled...
+  s->close();
+
+  loop.remove(s);
 
   // libera uma conexo para o pool...
-  boost::unique_lock<boost::mutex> lock(m);
-  ++available_connections;
-  cv.notify_one();
+  --connections;
 }
 
 
-std::string ProxyServer::read_request(boost::asio::ip::tcp::socket * socket)
+void ProxyServer::read_request(EventLoop & loop, shared_ptr<Session> const & s)
 {
-  boost::system::error_code error;
-  char data[MAX_LENGTH];
+  // reads into the session's buffer, the message and its tokens point into it...
+  s->transport().read(s->request, MAX_LENGTH, boost::bind(&ProxyServer::on_read, this, boost::ref(loop), s, _1, _2));
+}
 
-  size_t length = socket->read_some(boost::asio::buffer(data, MAX_LENGTH), error);
 
+void ProxyServer::on_read(EventLoop & loop, shared_ptr<Session> const & s, boost::system::error_code const & error, size_t length)
+{
   if (error == boost::asio::error::eof) // Client has disconnected
-    return "DISCONNECTED";
-  else if (error)
-    throw boost::system::system_error(error); // Some other error.
+  {
+    std::cerr << "Application Server - Client has disconnected." << std::endl;
+    end_session(loop, s);
+    return;
+  }
+  else if (error) // Some other error.
+  {
+    std::cerr << "Application Server - Session error - " << error.message() << std::endl;
+    end_session(loop, s);
+    return;
+  }
+
+  boost::string_ref message = trim(boost::string_ref(s->request, length));
+
+  if (traffic)
+    traffic->request(s->id, message);
+
+  tokenizer(message, s->tokens);
+
+  // the reactor goes on with its other sessions while a pool thread runs the request...
+  if (blocking(s->tokens))
+    worker_service.post(boost::bind(&ProxyServer::serve, this, boost::ref(loop), s, message));
+  else
+    serve(loop, s, message);
+}
+
+
+void ProxyServer::serve(EventLoop & loop, shared_ptr<Session> const & s, boost::string_ref message)
+{
+  bool failed = false;
+
+  try
+  {
+    process_request(*s, message);
+  }
+  catch (std::exception &e)
+  {
+    std::cerr << "Application Server - Session error - " << e.what() << std::endl;
+    failed = true;
+  }
 
-  return std::string(data, length);
+  // a session is only read on its loop, a pool thread hands it back...
+  if (failed)
+    s->transport().dispatch(boost::bind(&ProxyServer::end_session, this, boost::ref(loop), s));
+  else
+    s->transport().dispatch(boost::bind(&ProxyServer::read_request, this, boost::ref(loop), s));
 }
 
 
-void ProxyServer::process_request(boost::asio::ip::tcp::socket * socket, std::string const & message)
+bool ProxyServer::blocking(std::vector<boost::string_ref> const & tokens)
 {
-  vector<string>tokens;
+  // a WRITE waits for its batch and READ|DEVICE for the server. A plain READ is
+  // answered from the cache and only goes to the server when the value is missing or
+  // too old...
+  if (tokens.empty())
+    return false;
+
+  if (tokens[0] == "WRITE")
+    return true;
+
+  // a SUBSCRIBE reads the current values of its tags the same way...
+  if (tokens[0] == "SUBSCRIBE")
+  {
+    for (size_t i = 1; i < tokens.size(); i++)
+    {
+      if (tokens[i].starts_with("RATE=") || tokens[i].starts_with("DEADBAND="))
+        continue;
+
+      if (!cachedFunc || !cachedFunc(tokens[i]))
+        return true;
+    }
 
-  tokenizer(const_cast<string &>(message), tokens);
+    return false;
+  }
+
+  if (tokens[0] != "READ" || tokens.size() < 2)
+    return false;
+
+  return (tokens.size() > 2 && tokens[2] == "DEVICE") || !cachedFunc || !cachedFunc(tokens[1]);
+}
+
+
+void ProxyServer::process_request(Session & s, boost::string_ref message)
+{
+  string const & peer = s.transport().peer();
+  vector<boost::string_ref> const & tokens = s.tokens;
 
   if (tokens.size() > 0)
   {
     if (tokens[0] == "READ" && tokens.size() > 1)
     {
-      std::cout << "Application Server - Message received from " << socket->remote_endpoint() << " - Message: " << message << std::endl;
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
 
-      string res = readFunc(tokens[1]);
-      socket->write_some(boost::asio::buffer(res));
+      // READ|tag is answered from the cache, READ|tag|DEVICE forces a device read...
+      shared_ptr<string> response = s.acquire();
+      readFunc(tokens[1], tokens.size() > 2 && tokens[2] == "DEVICE", *response);
+      s.respond(response);
     }
     else if (tokens[0] == "WRITE" && tokens.size() > 2)
     {
-      std::cout << "Application Server - Message received from " << socket->remote_endpoint() << " - Message: " << message << std::endl;
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
 
       bool res = writeFunc(tokens[1], tokens[2]);
-      socket->write_some(boost::asio::buffer(res ? string("WRITE_OK") : string("WRITE_FAIL")));
+      s.respond(res ? "WRITE_OK" : "WRITE_FAIL");
+    }
+    else if (tokens[0] == "WRITE_ASYNC" && tokens.size() > 2)
+    {
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
+
+      write_async(s, tokens);
+    }
+    else if (tokens[0] == "HIST" && tokens.size() > 2)
+    {
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
+
+      // HIST|tag|from[|to] in epoch milliseconds. Times up to 0 are relative to now,
+      // HIST|tag|-60000 is the last minute...
+      long long from = static_cast<long long>(to_number(tokens[2]));
+      long long to = tokens.size() > 3 ? static_cast<long long>(to_number(tokens[3])) : 0;
+
+      shared_ptr<string> response = s.acquire();
+      historyFunc(tokens[1], from, to, *response);
+      s.respond(response);
+    }
+    else if (tokens[0] == "SUBSCRIBE" && tokens.size() > 1)
+    {
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
+
+      subscribe(s, tokens);
+    }
+    else if (tokens[0] == "UNSUBSCRIBE")
+    {
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
+
+      unsubscribe(s, tokens);
+    }
+    else if (tokens[0] == "ALARMS" && alarmListFunc)
+    {
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
+
+      subscribe_alarms(s);
     }
     else
     {
-      std::cout << "Application Server - Message received from " << socket->remote_endpoint() << " - Message: " << message << std::endl;
+      std::cout << "Application Server - Message received from " << peer << " - Message: " << message << std::endl;
+
+      s.respond("INVALID");
+    }
+  }
+}
+
+
+void ProxyServer::subscribe(Session & s, std::vector<boost::string_ref> const & tokens)
+{
+  SubscriptionOptions options{ 0, 0, 0 };
+
+  // from now on every message is framed so notifications and responses can be told apart...
+  s.set_framed();
+
+  for (size_t i = 1; i < tokens.size(); i++)
+  {
+    // an option applies to the tags that follow it, i.e. SUBSCRIBE|RATE=500|tag...
+    if (tokens[i].starts_with("RATE="))
+    {
+      options.rate = static_cast<long long>(to_number(tokens[i].substr(5)));
+      continue;
+    }
+
+    // DEADBAND=0.5 is absolute, DEADBAND=2% is relative to the last notified value...
+    if (tokens[i].starts_with("DEADBAND="))
+    {
+      double deadband = to_number(tokens[i].substr(9));
+
+      if (tokens[i].ends_with("%"))
+      {
+        options.absolute = 0;
+        options.relative = deadband / 100;
+      }
+      else
+      {
+        options.absolute = deadband;
+        options.relative = 0;
+      }
 
-      socket->write_some(boost::asio::buffer(string("INVALID")));
+      continue;
     }
+
+    int index = resolveFunc(tokens[i]);
+
+    if (index >= 0 && fan_out.subscribe(s, index, string(tokens[i]), options))
+      continue;
+
+    shared_ptr<string> response = s.acquire();
+    response->append("SUBSCRIBE_FAIL|").append(tokens[i].data(), tokens[i].size());
+    s.respond(response);
+  }
+}
+
+
+void ProxyServer::unsubscribe(Session & s, std::vector<boost::string_ref> const & tokens)
+{
+  // UNSUBSCRIBE alone cancels all the subscriptions of the session...
+  if (tokens.size() == 1)
+    fan_out.unsubscribe_all(s);
+
+  for (size_t i = 1; i < tokens.size(); i++)
+  {
+    int index = resolveFunc(tokens[i]);
+
+    if (index >= 0)
+      fan_out.unsubscribe(s, index);
   }
+
+  s.respond("UNSUBSCRIBE_OK");
 }
 
-void ProxyServer::tokenizer(std::string & message, std::vector<std::string> & tokens)
+
+void ProxyServer::write_async(Session & s, std::vector<boost::string_ref> const & tokens)
+{
+  unsigned long transactionId = next_transaction++;
+
+  // WRITE_DONE is pushed later, so the messages must be framed. The id goes out
+  // first, the completion may come as soon as the write starts...
+  s.set_framed();
+
+  shared_ptr<string> response = s.acquire();
+  response->append("WRITE_PENDING|");
+  opc::appendInteger(*response, transactionId);
+  s.respond(response);
+
+  {
+    boost::unique_lock<boost::mutex> lock(writes_mtx);
+    outstanding_writes[transactionId] = s.shared_from_this();
+  }
+
+  if (!asyncWriteFunc(tokens[1], tokens[2], transactionId))
+    write_completed(transactionId, false);
+}
+
+
+void ProxyServer::subscribe_alarms(Session & s)
 {
-  std::string delimiter = "|";
+  // the transitions are pushed, so the messages are framed as with SUBSCRIBE...
+  s.set_framed();
 
-  size_t pos = 0;
-  std::string tok;
+  s.respond("ALARMS_OK");
 
+  {
+    boost::unique_lock<boost::mutex> lock(alarms_mtx);
+
+    for (auto w = alarm_sessions.begin(); w != alarm_sessions.end(); ++w)
+    {
+      if (w->lock().get() == &s)
+        return;
+    }
+
+    alarm_sessions.push_back(s.shared_from_this());
+  }
+
+  // the alarms active now follow, a transition may come before them...
+  vector<string> alarms;
+  alarmListFunc(alarms);
+
+  for (auto a = alarms.begin(); a != alarms.end(); ++a)
+    s.respond(*a);
+}
+
+
+void ProxyServer::tokenizer(boost::string_ref message, std::vector<boost::string_ref> & tokens)
+{
+  // the tokens point into the message, nothing is copied...
   tokens.clear();
 
-  while ((pos = message.find(delimiter)) != std::string::npos)
+  size_t pos;
+
+  while ((pos = message.find('|')) != boost::string_ref::npos)
   {
-    tok = message.substr(0, pos);
-    tokens.push_back(tok);
-    message.erase(0, pos + delimiter.length());
+    tokens.push_back(message.substr(0, pos));
+    message.remove_prefix(pos + 1);
   }
 
   if (message.length() > 0)
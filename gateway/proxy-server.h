@@ -1,45 +1,134 @@
 #pragma once
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <atomic>
 #include <iostream>
 #include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
-#include "opc_utils.h"
+#include "fan-out.h"
+#include "opc_types.h"
+#include "reactor.h"
+#include "session.h"
+#include "traffic-capture.h"
+#include "uring-transport.h"
 
-static unsigned const MAX_LENGTH = 100;
+// threads running the requests that may block, like writes and device reads...
 static unsigned const POOL_SIZE = 30;
+static unsigned const MAX_CONNECTIONS = MAX_SUBSCRIBERS;
 
+// the handlers get tokens pointing into the request buffer and write the READ
+// response into a pooled buffer, so a request is served without allocations...
+typedef function<void(boost::string_ref itemId, bool fromDevice, string & response)> ReadHandler;
+typedef function<bool(boost::string_ref itemId, boost::string_ref value)> WriteHandler;
+typedef function<int(boost::string_ref itemId)> ResolveHandler;
+typedef function<bool(boost::string_ref itemId, boost::string_ref value, unsigned long transactionId)> AsyncWriteHandler;
+typedef function<void(boost::string_ref itemId, long long from, long long to, string & response)> HistoryHandler;
+
+// gets the ALARM messages of the alarms active now...
+typedef function<void(vector<string> & alarms)> AlarmListHandler;
+
+// whether the READ of an item is answered without the server, from a fresh cached value...
+typedef function<bool(boost::string_ref itemId)> CachedHandler;
+
+// the sessions run on Asio sockets or, on Linux builds with GATEWAY_IO_URING, on io_uring...
+enum TransportType
+{
+  ASIO_TRANSPORT,
+  URING_TRANSPORT
+};
+
+// the connections are spread among the event loops, see Reactor and UringReactor. A
+// loop reads the requests of its sessions and answers the ones that don't block, the
+// others go to the thread pool and the session's reads resume on its loop when they
+// are done. The requests only see the session's Transport, whichever the loop is.
 class ProxyServer
 {
 public:
-  ProxyServer(int const &, function<string(string const & itemId)>, function<bool(string const & itemId, string value)>);
+  // with pinning the loop n runs on the core n...
+  ProxyServer(int const &, TransportType, unsigned reactorCount, bool pinned, ReadHandler, WriteHandler, ResolveHandler, AsyncWriteHandler, HistoryHandler);
   ~ProxyServer();
+
+  // runs the reactors until the server is stopped...
   void start();
 
+  // stops the reactors from any thread, start returns once they have finished...
+  void stop();
+
+  // pushes the changed items to the sessions subscribed to them...
+  void publish(std::vector<Change> const & changes);
+
+  // pushes the result of a WRITE_ASYNC to the session that started it...
+  void write_completed(unsigned long transactionId, bool success);
+
+  // saves the connections and the requests to a file, to be set before start...
+  void capture(string const & path);
+
+  // lets the clients subscribe to the alarms with ALARMS, to be set before start...
+  void alarm_list(AlarmListHandler handler);
+
+  // lets the loops answer the READs of fresh cached values, to be set before start.
+  // The others may read the server, they go to the pool with the SUBSCRIBEs of such
+  // items, and so do all of them without it...
+  void cached_reads(CachedHandler handler);
+
+  // pushes ALARM messages to the sessions subscribed to the alarms...
+  void publish_alarms(vector<string> const & alarms);
+
+  // splits a request at the pipes, the tokens point into the message...
+  static void tokenizer(boost::string_ref message, std::vector<boost::string_ref> & tokens);
+
 private:
-  unsigned available_connections;
-  boost::asio::io_service tcp_service;
+  // the loops of the chosen transport. The Asio reactors are also listed apart, they
+  // are the ones the server accepts for...
+  vector<unique_ptr<EventLoop>> loops;
+  vector<Reactor *> reactors;
+  atomic<unsigned> next_reactor;
+  atomic<unsigned> connections;
   boost::asio::io_service worker_service;
-  boost::asio::ip::tcp::acceptor tcp_acceptor;
   boost::asio::io_service::work worker;
-  boost::condition_variable cv;
-  boost::mutex m;
   boost::thread_group threadpool;
 
-  function<string(string const & itemId)> readFunc;
-  function<bool(string const & itemId, string value)> writeFunc;
+  ReadHandler readFunc;
+  WriteHandler writeFunc;
+  ResolveHandler resolveFunc;
+  AsyncWriteHandler asyncWriteFunc;
+  HistoryHandler historyFunc;
+  AlarmListHandler alarmListFunc;
+  CachedHandler cachedFunc;
 
-  void session(boost::asio::ip::tcp::socket *);
-  std::string read_request(boost::asio::ip::tcp::socket *);
-  void process_request(boost::asio::ip::tcp::socket *, std::string const &);
-  void start_threadpool();
-  void check_connections_pool();
+  FanOut fan_out;
+
+  // sessions getting the alarm transitions...
+  boost::mutex alarms_mtx;
+  vector<weak_ptr<Session>> alarm_sessions;
+
+  // sessions waiting for the completion of their asynchronous writes...
+  boost::mutex writes_mtx;
+  unordered_map<unsigned long, weak_ptr<Session>> outstanding_writes;
+  atomic<unsigned long> next_transaction;
 
-  void tokenizer(std::string & message, std::vector<std::string> & tokens);
+  atomic<unsigned long> next_session;
+  unique_ptr<TrafficCapture> traffic;
+
+  void accept(Reactor & listener);
+  void on_accept(Reactor & listener, Reactor & target, boost::asio::ip::tcp::socket * socket, boost::system::error_code const & error);
+  void admit(EventLoop & loop, shared_ptr<Session> const & s);
+  void end_session(EventLoop & loop, shared_ptr<Session> const & s);
+  void read_request(EventLoop & loop, shared_ptr<Session> const & s);
+  void on_read(EventLoop & loop, shared_ptr<Session> const & s, boost::system::error_code const & error, size_t length);
+  void serve(EventLoop & loop, shared_ptr<Session> const & s, boost::string_ref message);
+  bool blocking(std::vector<boost::string_ref> const & tokens);
+  void process_request(Session &, boost::string_ref);
+  void subscribe(Session &, std::vector<boost::string_ref> const &);
+  void unsubscribe(Session &, std::vector<boost::string_ref> const &);
+  void write_async(Session &, std::vector<boost::string_ref> const &);
+  void subscribe_alarms(Session &);
+  void start_threadpool();
 };
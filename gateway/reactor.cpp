@@ -0,0 +1,120 @@
+#include "reactor.h"
+
+EventLoop::EventLoop(unsigned id, int core) :
+id(id),
+core(core)
+{
+}
+
+
+void EventLoop::add(shared_ptr<Session> const & session)
+{
+  sessions.insert(session);
+}
+
+
+void EventLoop::remove(shared_ptr<Session> const & session)
+{
+  sessions.erase(session);
+}
+
+
+void EventLoop::clear()
+{
+  sessions.clear();
+}
+
+
+size_t EventLoop::connections() const
+{
+  return sessions.size();
+}
+
+
+void EventLoop::pin()
+{
+  if (core < 0)
+    return;
+
+#ifdef _WIN32
+  SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << core);
+#else
+  cpu_set_t cores;
+  CPU_ZERO(&cores);
+  CPU_SET(core, &cores);
+
+  pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+#endif
+}
+
+
+Reactor::Reactor(unsigned id, int core) :
+EventLoop(id, core),
+svc(1),
+work(svc)
+{
+}
+
+
+Reactor::~Reactor()
+{
+  stop();
+  join();
+  clear();
+}
+
+
+boost::asio::io_service & Reactor::service()
+{
+  return svc;
+}
+
+
+boost::asio::ip::tcp::acceptor * Reactor::acceptor()
+{
+  return tcp_acceptor.get();
+}
+
+
+void Reactor::listen(boost::asio::ip::tcp::endpoint const & endpoint, bool reusePort)
+{
+  tcp_acceptor.reset(new boost::asio::ip::tcp::acceptor(svc));
+
+  tcp_acceptor->open(endpoint.protocol());
+  tcp_acceptor->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+
+#ifdef REUSE_PORT_SUPPORTED
+  if (reusePort)
+    tcp_acceptor->set_option(reuse_port(true));
+#endif
+
+  tcp_acceptor->bind(endpoint);
+  tcp_acceptor->listen();
+}
+
+
+void Reactor::start()
+{
+  thread = boost::thread(boost::bind(&Reactor::run, this));
+}
+
+
+void Reactor::stop()
+{
+  svc.stop();
+}
+
+
+void Reactor::join()
+{
+  if (thread.joinable())
+    thread.join();
+}
+
+
+void Reactor::run()
+{
+  pin();
+
+  svc.run();
+}
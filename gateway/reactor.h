@@ -0,0 +1,93 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <functional>
+#include <memory>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "session.h"
+#include "socket-transport.h"
+
+using namespace std;
+
+// several sockets can listen on the same port and the kernel spreads the incoming
+// connections among them. Where it isn't available the first reactor accepts for
+// all the others...
+#if defined(SO_REUSEPORT)
+#define REUSE_PORT_SUPPORTED
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+class EventLoop;
+
+typedef function<void(EventLoop & loop, shared_ptr<Session> const & session)> AcceptHandler;
+
+// a thread running the I/O of a set of sessions, optionally pinned to a core. The
+// loops never share their sessions, so they never contend on a shared queue...
+class EventLoop
+{
+public:
+  virtual ~EventLoop() {}
+
+  virtual void start() = 0;
+  virtual void stop() = 0;
+  virtual void join() = 0;
+
+  // the connection set is only touched on the loop's thread...
+  void add(shared_ptr<Session> const & session);
+  void remove(shared_ptr<Session> const & session);
+  size_t connections() const;
+
+  unsigned const id;
+
+protected:
+  // the core is -1 when the thread can run anywhere...
+  EventLoop(unsigned id, int core);
+
+  // binds the calling thread to the loop's core, if it has one...
+  void pin();
+
+  // drops the sessions left once the loop has stopped. A loop does it before its own
+  // members go, the sockets of the sessions may need them...
+  void clear();
+
+private:
+  int core;
+  unordered_set<shared_ptr<Session>> sessions;
+};
+
+
+// an event loop on an Asio io_service. Each reactor owns its io_service, listening
+// socket and sessions. Everything of a session runs on the thread of its reactor.
+class Reactor : public EventLoop
+{
+public:
+  Reactor(unsigned id, int core);
+  ~Reactor();
+
+  boost::asio::io_service & service();
+
+  // the listening socket of the reactor, null if it accepts through another one...
+  boost::asio::ip::tcp::acceptor * acceptor();
+
+  void listen(boost::asio::ip::tcp::endpoint const & endpoint, bool reusePort);
+
+  void start();
+  void stop();
+  void join();
+
+private:
+  boost::asio::io_service svc;
+  boost::asio::io_service::work work;
+  unique_ptr<boost::asio::ip::tcp::acceptor> tcp_acceptor;
+  boost::thread thread;
+
+  void run();
+};
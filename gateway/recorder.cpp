@@ -0,0 +1,559 @@
+#include "recorder.h"
+
+static bool by_item_and_time(BlockIndexEntry const & a, BlockIndexEntry const & b)
+{
+  return a.index != b.index ? a.index < b.index : a.first < b.first;
+}
+
+
+Segment::Segment(string const & path, size_t size, bool create) :
+file(path),
+mapping(prepare(path, size, create), boost::interprocess::read_write),
+region(mapping, boost::interprocess::read_write)
+{
+  data = static_cast<uint8_t *>(region.get_address());
+  header = reinterpret_cast<SegmentHeader *>(data);
+  this->size = region.get_size();
+
+  if (this->size < sizeof(SegmentHeader))
+    throw runtime_error("too small for a segment");
+
+  if (create)
+  {
+    memset(header, 0, sizeof(SegmentHeader));
+    header->magic = SEGMENT_MAGIC;
+    header->used = sizeof(SegmentHeader);
+    return;
+  }
+
+  // a file that isn't a segment is left as it is...
+  if (header->magic != SEGMENT_MAGIC)
+    throw runtime_error("not a segment");
+
+  if (header->used < sizeof(SegmentHeader) || header->used > this->size)
+    throw runtime_error("damaged segment");
+
+  if (header->index_offset != 0)
+  {
+    if (header->index_offset < header->used || header->index_count > (this->size - header->index_offset) / sizeof(BlockIndexEntry))
+      throw runtime_error("damaged segment index");
+
+    BlockIndexEntry const * index = reinterpret_cast<BlockIndexEntry const *>(data + header->index_offset);
+    entries.assign(index, index + header->index_count);
+    return;
+  }
+
+  // the gateway stopped before the segment was closed, the blocks are still there...
+  for (uint64_t offset = sizeof(SegmentHeader); offset + sizeof(BlockHeader) <= header->used; )
+  {
+    BlockHeader const * block = reinterpret_cast<BlockHeader const *>(data + offset);
+
+    if (block->length > header->used - offset - sizeof(BlockHeader))
+      break;
+
+    entries.push_back(BlockIndexEntry{ block->index, 0, offset, block->first, block->last });
+
+    offset += (sizeof(BlockHeader) + block->length + 7) & ~static_cast<uint64_t>(7);
+  }
+
+  close();
+}
+
+
+bool Segment::append(int index, BlockEncoder const & block)
+{
+  vector<uint8_t> const & bytes = block.bytes();
+  size_t length = (sizeof(BlockHeader) + bytes.size() + 7) & ~static_cast<size_t>(7);
+
+  // room is kept for the index, written when the segment closes...
+  if (header->used + length + (entries.size() + 1) * sizeof(BlockIndexEntry) > size)
+    return false;
+
+  uint64_t offset = header->used;
+
+  BlockHeader * blockHeader = reinterpret_cast<BlockHeader *>(data + offset);
+  blockHeader->index = static_cast<uint32_t>(index);
+  blockHeader->count = static_cast<uint32_t>(block.count());
+  blockHeader->length = static_cast<uint32_t>(bytes.size());
+  blockHeader->reserved = 0;
+  blockHeader->first = block.first();
+  blockHeader->last = block.last();
+
+  memcpy(data + offset + sizeof(BlockHeader), bytes.data(), bytes.size());
+
+  entries.push_back(BlockIndexEntry{ static_cast<uint32_t>(index), 0, offset, block.first(), block.last() });
+
+  if (header->samples == 0 || block.first() < header->first)
+    header->first = block.first();
+
+  header->last = max(static_cast<long long>(header->last), block.last());
+  header->samples += block.count();
+
+  // the block only counts once it is all there...
+  header->used = offset + length;
+
+  return true;
+}
+
+
+void Segment::close()
+{
+  if (header->index_offset != 0)
+    return;
+
+  sort(entries.begin(), entries.end(), by_item_and_time);
+
+  memcpy(data + header->used, entries.data(), entries.size() * sizeof(BlockIndexEntry));
+
+  header->index_count = entries.size();
+  header->index_offset = header->used;
+
+  region.flush();
+}
+
+
+void Segment::query(int index, long long from, long long to, vector<Sample> & samples)
+{
+  if (header->samples == 0 || from > header->last || to < header->first)
+    return;
+
+  auto begin = entries.begin();
+  auto end = entries.end();
+
+  // a closed segment has its index sorted, the blocks of the item are found at once...
+  if (closed())
+  {
+    BlockIndexEntry key = { static_cast<uint32_t>(index), 0, 0, 0, 0 };
+
+    begin = lower_bound(entries.begin(), entries.end(), key, [](BlockIndexEntry const & a, BlockIndexEntry const & b) { return a.index < b.index; });
+    end = upper_bound(begin, entries.end(), key, [](BlockIndexEntry const & a, BlockIndexEntry const & b) { return a.index < b.index; });
+  }
+
+  for (auto e = begin; e != end; ++e)
+  {
+    if (e->index != static_cast<uint32_t>(index) || e->last < from || e->first > to)
+      continue;
+
+    BlockHeader const * block = reinterpret_cast<BlockHeader const *>(data + e->offset);
+    BlockEncoder::decode(data + e->offset + sizeof(BlockHeader), block->length, block->count, from, to, samples);
+  }
+}
+
+
+long long Segment::first() const
+{
+  return header->first;
+}
+
+
+long long Segment::last() const
+{
+  return header->last;
+}
+
+
+bool Segment::closed() const
+{
+  return header->index_offset != 0;
+}
+
+
+string const & Segment::path() const
+{
+  return file;
+}
+
+
+char const * Segment::prepare(string const & path, size_t size, bool create)
+{
+  // the file gets its full size up front, so it is mapped once...
+  if (create)
+  {
+    ofstream file(path.c_str(), ios::binary | ios::trunc);
+    file.seekp(size - 1);
+    file.put(0);
+    file.close();
+
+    if (!file)
+      throw runtime_error("cannot be made");
+  }
+
+  return path.c_str();
+}
+
+
+Recorder::Recorder(string const & directory, size_t retention, function<string(int index)> itemIdFn) :
+directory(directory),
+itemId(itemIdFn),
+retention(retention),
+next_segment(1),
+stopped(false),
+failed(false),
+samples(0),
+kept(0),
+bytes(0),
+dropped(0)
+{
+#ifdef _WIN32
+  _mkdir(directory.c_str());
+#else
+  mkdir(directory.c_str(), 0755);
+#endif
+
+  // the segments of the previous runs can still be queried, the new ones are numbered
+  // after the last file, so none is ever overwritten...
+  vector<unsigned> numbers = segment_numbers();
+
+  for (auto n = numbers.begin(); n != numbers.end(); ++n)
+  {
+    unique_ptr<Segment> segment = open(segment_path(*n), 0, false);
+
+    if (segment)
+      segments.push_back(move(segment));
+  }
+
+  if (!numbers.empty())
+    next_segment = numbers.back() + 1;
+
+  retire();
+
+  default_compression.type = NO_COMPRESSION;
+  default_compression.deviation = 0;
+
+  thread = boost::thread(boost::bind(&Recorder::run, this));
+}
+
+
+Recorder::~Recorder()
+{
+  stopped = true;
+
+  thread.join();
+}
+
+
+void Recorder::set_compression(CompressionSettings const & settings)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  default_compression = settings;
+}
+
+
+void Recorder::set_compression(string const & prefix, CompressionSettings const & settings)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  classes.push_back(make_pair(prefix, settings));
+
+  // the longest prefixes are tried first...
+  stable_sort(classes.begin(), classes.end(), [](pair<string, CompressionSettings> const & a, pair<string, CompressionSettings> const & b) { return a.first.size() > b.first.size(); });
+}
+
+
+void Recorder::record(vector<Record> const & records)
+{
+  if (failed)
+  {
+    dropped += records.size();
+    return;
+  }
+
+  boost::unique_lock<boost::mutex> lock(queue_mtx);
+
+  size_t room = RECORD_QUEUE_SIZE - min(queue.size(), static_cast<size_t>(RECORD_QUEUE_SIZE));
+  size_t taken = min(room, records.size());
+
+  queue.insert(queue.end(), records.begin(), records.begin() + taken);
+  dropped += records.size() - taken;
+}
+
+
+void Recorder::query(int index, long long from, long long to, vector<Sample> & output)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  for (auto s = segments.begin(); s != segments.end(); ++s)
+    (*s)->query(index, from, to, output);
+
+  auto i = items.find(index);
+
+  if (i == items.end())
+    return;
+
+  BlockEncoder const & block = i->second.block;
+
+  if (block.count() > 0)
+    BlockEncoder::decode(block.bytes().data(), block.bytes().size(), block.count(), from, to, output);
+
+  // the held sample is still the last value of the item...
+  Sample held;
+
+  if (i->second.compressor.held(held) && held.timestamp >= from && held.timestamp <= to)
+    output.push_back(held);
+}
+
+
+RecorderStats Recorder::stats()
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  return RecorderStats{ samples, kept, bytes, dropped, segments.size(), failed };
+}
+
+
+void Recorder::compression(vector<pair<int, CompressionStats>> & result)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  for (auto i = items.begin(); i != items.end(); ++i)
+    result.push_back(make_pair(i->first, i->second.compressor.stats()));
+
+  sort(result.begin(), result.end(), [](pair<int, CompressionStats> const & a, pair<int, CompressionStats> const & b) { return a.first < b.first; });
+}
+
+
+void Recorder::run()
+{
+  bool stopping = false;
+
+  while (!stopping)
+  {
+    stopping = stopped;
+
+    if (!stopping)
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(RECORD_INTERVAL));
+
+    {
+      boost::unique_lock<boost::mutex> lock(queue_mtx);
+      draining.swap(queue);
+    }
+
+    boost::unique_lock<boost::mutex> lock(mtx);
+
+    for (auto r = draining.begin(); r != draining.end(); ++r)
+    {
+      RecordedItem & recorded = item(r->index);
+
+      recorded.compressor.append(r->sample, archived);
+      keep(r->index, recorded.block);
+    }
+
+    samples += draining.size();
+    draining.clear();
+
+    if (stopping)
+    {
+      for (auto i = items.begin(); i != items.end(); ++i)
+      {
+        i->second.compressor.flush(archived);
+        keep(i->first, i->second.block);
+      }
+    }
+
+    flush(stopping);
+  }
+
+  if (!segments.empty())
+    segments.back()->close();
+}
+
+
+void Recorder::flush(bool all)
+{
+  long long now = HistoryStore::now();
+
+  for (auto i = items.begin(); i != items.end(); ++i)
+  {
+    BlockEncoder & block = i->second.block;
+
+    if (block.count() > 0 && (all || now - block.first() >= BLOCK_AGE))
+      write(i->first, block);
+  }
+}
+
+
+void Recorder::write(int index, BlockEncoder & block)
+{
+  Segment * segment = current();
+
+  if (segment != nullptr && !segment->append(index, block))
+  {
+    segment->close();
+    segment = current();
+
+    if (segment != nullptr)
+      segment->append(index, block);
+  }
+
+  if (segment == nullptr)
+    dropped += block.count();
+  else
+    bytes += sizeof(BlockHeader) + block.bytes().size();
+
+  block.clear();
+}
+
+
+void Recorder::keep(int index, BlockEncoder & block)
+{
+  for (auto a = archived.begin(); a != archived.end(); ++a)
+  {
+    block.append(*a);
+
+    if (block.count() >= BLOCK_SAMPLES)
+      write(index, block);
+  }
+
+  kept += archived.size();
+  archived.clear();
+}
+
+
+Recorder::RecordedItem & Recorder::item(int index)
+{
+  auto i = items.find(index);
+
+  if (i != items.end())
+    return i->second;
+
+  CompressionSettings settings = default_compression;
+
+  if (!classes.empty())
+  {
+    string id = itemId(index);
+
+    for (auto c = classes.begin(); c != classes.end(); ++c)
+    {
+      if (id.compare(0, c->first.size(), c->first) == 0)
+      {
+        settings = c->second;
+        break;
+      }
+    }
+  }
+
+  return items.insert(make_pair(index, RecordedItem{ Compressor(settings), BlockEncoder() })).first->second;
+}
+
+
+Segment * Recorder::current()
+{
+  if (failed)
+    return nullptr;
+
+  if (!segments.empty() && !segments.back()->closed())
+    return segments.back().get();
+
+  unique_ptr<Segment> segment = open(segment_path(next_segment++), SEGMENT_SIZE, true);
+
+  if (!segment)
+  {
+    fail("Cannot make a new segment");
+    return nullptr;
+  }
+
+  segments.push_back(move(segment));
+  retire();
+
+  return segments.back().get();
+}
+
+
+unique_ptr<Segment> Recorder::open(string const & path, size_t size, bool create)
+{
+  try
+  {
+    return unique_ptr<Segment>(new Segment(path, size, create));
+  }
+  catch (exception & e)
+  {
+    cout << "Recorder - " << path << " - " << e.what() << endl;
+  }
+
+  return unique_ptr<Segment>();
+}
+
+
+void Recorder::retire()
+{
+  if (retention == 0 || segments.size() <= retention)
+    return;
+
+  size_t count = segments.size() - retention;
+
+  // the mapping goes before the file...
+  for (size_t s = 0; s < count; s++)
+  {
+    string path = segments[s]->path();
+
+    segments[s].reset();
+    remove(path.c_str());
+  }
+
+  segments.erase(segments.begin(), segments.begin() + count);
+}
+
+
+void Recorder::fail(string const & reason)
+{
+  cout << "Recorder - " << reason << ", the recording is off." << endl;
+
+  failed = true;
+}
+
+
+string Recorder::segment_path(unsigned number) const
+{
+  string name = to_string(number);
+
+  return directory + "/segment-" + string(name.size() < 6 ? 6 - name.size() : 0, '0') + name + ".rec";
+}
+
+
+vector<unsigned> Recorder::segment_numbers() const
+{
+  vector<string> names;
+
+#ifdef _WIN32
+  _finddata_t found;
+  intptr_t search = _findfirst((directory + "/segment-*.rec").c_str(), &found);
+
+  if (search != -1)
+  {
+    do
+      names.push_back(found.name);
+    while (_findnext(search, &found) == 0);
+
+    _findclose(search);
+  }
+#else
+  DIR * listing = opendir(directory.c_str());
+
+  if (listing != nullptr)
+  {
+    while (dirent * entry = readdir(listing))
+      names.push_back(entry->d_name);
+
+    closedir(listing);
+  }
+#endif
+
+  vector<unsigned> numbers;
+
+  // segment-NNNNNN.rec, the number may be longer than 6 digits...
+  for (auto n = names.begin(); n != names.end(); ++n)
+  {
+    if (n->size() <= 12 || n->compare(0, 8, "segment-") != 0 || n->compare(n->size() - 4, 4, ".rec") != 0)
+      continue;
+
+    string digits = n->substr(8, n->size() - 12);
+
+    if (digits.find_first_not_of("0123456789") == string::npos)
+      numbers.push_back(static_cast<unsigned>(strtoul(digits.c_str(), nullptr, 10)));
+  }
+
+  sort(numbers.begin(), numbers.end());
+
+  return numbers;
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "block-encoder.h"
+#include "compressor.h"
+#include "history.h"
+
+using namespace std;
+
+static size_t const SEGMENT_SIZE = 64 * 1024 * 1024;
+static size_t const BLOCK_SAMPLES = 1024;
+static long long const BLOCK_AGE = 60000;
+static size_t const RECORD_QUEUE_SIZE = 65536;
+static long long const RECORD_INTERVAL = 100;
+static uint64_t const SEGMENT_MAGIC = 0x31304345524350ULL;
+
+// segments kept on disk, the oldest ones go when there are more...
+static size_t const SEGMENT_RETENTION = 64;
+
+// a sample of an item waiting to be recorded...
+struct Record
+{
+  int index;
+  Sample sample;
+};
+
+struct RecorderStats
+{
+  unsigned long long samples;
+  unsigned long long archived;
+  unsigned long long bytes;
+  unsigned long long dropped;
+  size_t segments;
+
+  // whether the recording stopped on an error...
+  bool failed;
+};
+
+// the start of a segment file. A segment is only appended to, used tells how much
+// of it holds blocks. The block index is written after the last block when the
+// segment is closed, a segment without one has its blocks scanned instead...
+struct SegmentHeader
+{
+  uint64_t magic;
+  uint64_t used;
+  uint64_t index_offset;
+  uint64_t index_count;
+  int64_t first;
+  int64_t last;
+  uint64_t samples;
+  uint64_t reserved;
+};
+
+struct BlockHeader
+{
+  uint32_t index;
+  uint32_t count;
+  uint32_t length;
+  uint32_t reserved;
+  int64_t first;
+  int64_t last;
+};
+
+// where the blocks of an item are, sorted by item and time...
+struct BlockIndexEntry
+{
+  uint32_t index;
+  uint32_t reserved;
+  uint64_t offset;
+  int64_t first;
+  int64_t last;
+};
+
+// a segment file, mapped in memory...
+class Segment
+{
+public:
+  // opens an existing segment, or makes a new one of the given size. Throws when the
+  // file can't be made or mapped, or isn't a segment...
+  Segment(string const & path, size_t size, bool create);
+
+  // false if the block doesn't fit along with the index...
+  bool append(int index, BlockEncoder const & block);
+
+  // writes the block index after the last block...
+  void close();
+
+  void query(int index, long long from, long long to, vector<Sample> & samples);
+
+  long long first() const;
+  long long last() const;
+  bool closed() const;
+  string const & path() const;
+
+private:
+  string file;
+  boost::interprocess::file_mapping mapping;
+  boost::interprocess::mapped_region region;
+  SegmentHeader * header;
+  uint8_t * data;
+  size_t size;
+
+  // the index of an open segment is kept here and sorted when it is written...
+  vector<BlockIndexEntry> entries;
+
+  static char const * prepare(string const & path, size_t size, bool create);
+};
+
+
+// records every sample to disk. The data-change path only appends the samples to a
+// bounded queue, a thread compresses them into a block per item and appends the full
+// blocks to the current segment. A block is also written once its first sample is
+// BLOCK_AGE old, bounding what is lost when the gateway stops. When the queue is
+// full the samples are dropped and counted, so recording never slows the callback.
+// The samples can go through a lossy compression first, set per item id prefix like
+// the history depth, only the samples it keeps are written.
+// At most retention segments are kept, 0 keeps them all, the oldest are deleted as
+// new ones are made. A segment that can't be made stops the recording, the samples
+// are then dropped.
+class Recorder
+{
+public:
+  Recorder(string const & directory, size_t retention, function<string(int index)> itemIdFn);
+  ~Recorder();
+
+  // sets the compression of the items without a class, lossless by default...
+  void set_compression(CompressionSettings const & settings);
+  void set_compression(string const & prefix, CompressionSettings const & settings);
+
+  void record(vector<Record> const & records);
+
+  // gets the samples of an item, from the segments and the blocks being filled...
+  void query(int index, long long from, long long to, vector<Sample> & samples);
+
+  RecorderStats stats();
+
+  // the compression of each item recorded so far...
+  void compression(vector<pair<int, CompressionStats>> & items);
+
+private:
+  // an item being recorded, its kept samples are appended to its block...
+  struct RecordedItem
+  {
+    Compressor compressor;
+    BlockEncoder block;
+  };
+
+  string directory;
+  function<string(int index)> itemId;
+  CompressionSettings default_compression;
+  vector<pair<string, CompressionSettings>> classes;
+
+  size_t retention;
+  unsigned next_segment;
+  vector<unique_ptr<Segment>> segments;
+  unordered_map<int, RecordedItem> items;
+  vector<Sample> archived;
+
+  boost::mutex queue_mtx;
+  vector<Record> queue;
+  vector<Record> draining;
+
+  // guards the segments and the blocks, queries read them from other threads...
+  boost::mutex mtx;
+  boost::thread thread;
+  atomic<bool> stopped;
+  atomic<bool> failed;
+
+  atomic<unsigned long long> samples;
+  atomic<unsigned long long> kept;
+  atomic<unsigned long long> bytes;
+  atomic<unsigned long long> dropped;
+
+  void run();
+  void flush(bool all);
+  void write(int index, BlockEncoder & block);
+  void keep(int index, BlockEncoder & block);
+  RecordedItem & item(int index);
+
+  // the segment being filled, null once the recording failed...
+  Segment * current();
+  unique_ptr<Segment> open(string const & path, size_t size, bool create);
+  void retire();
+  void fail(string const & reason);
+
+  string segment_path(unsigned number) const;
+
+  // the numbers of the segment files in the directory, in order...
+  vector<unsigned> segment_numbers() const;
+};
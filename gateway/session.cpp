@@ -0,0 +1,192 @@
+#include "session.h"
+
+Session::Session(unique_ptr<Transport> transport) :
+slot(-1),
+id(0),
+io(move(transport)),
+writing(false),
+framed(false),
+conflated_frames(0)
+{
+}
+
+
+Session::~Session()
+{
+}
+
+
+Transport & Session::transport()
+{
+  return *io;
+}
+
+
+shared_ptr<string> Session::acquire()
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  // a buffer only referenced by the pool has been written and can be reused,
+  // keeping its capacity...
+  for (auto b = pool.begin(); b != pool.end(); ++b)
+  {
+    if (b->use_count() == 1)
+    {
+      (*b)->clear();
+      return *b;
+    }
+  }
+
+  shared_ptr<string> buffer = make_shared<string>();
+  buffer->reserve(128);
+
+  if (pool.size() < RESPONSE_POOL_SIZE)
+    pool.push_back(buffer);
+
+  return buffer;
+}
+
+
+void Session::respond(shared_ptr<string> const & response)
+{
+  if (framed)
+    response->push_back('\n');
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  queue.push_back(Frame{ -1, response, 0, response->size() });
+
+  schedule_write();
+}
+
+
+void Session::respond(boost::string_ref message)
+{
+  shared_ptr<string> response = acquire();
+  response->assign(message.data(), message.size());
+
+  respond(response);
+}
+
+
+void Session::notify(vector<Frame> const & frames)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  for (auto f = frames.begin(); f != frames.end(); ++f)
+  {
+    // once conflating, everything goes to the pending map until it is flushed,
+    // otherwise a newer value could be sent before an older one...
+    if (pending.empty() && queue.size() < CONFLATE_THRESHOLD)
+    {
+      queue.push_back(*f);
+      continue;
+    }
+
+    auto p = pending.find(f->index);
+
+    if (p == pending.end())
+    {
+      pending.emplace(f->index, *f);
+    }
+    else
+    {
+      p->second = *f;
+      ++conflated_frames;
+    }
+  }
+
+  schedule_write();
+}
+
+
+void Session::set_framed()
+{
+  framed = true;
+}
+
+
+void Session::close()
+{
+  shared_ptr<Session> self = shared_from_this();
+
+  io->post([self]() {
+    self->io->close();
+  });
+}
+
+
+size_t Session::conflated()
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  return conflated_frames;
+}
+
+
+void Session::schedule_write()
+{
+  // must be called with the lock held. Writes are only started on the transport's
+  // thread, so the transport is never used by two writers...
+  if (writing || queue.empty())
+    return;
+
+  writing = true;
+
+  io->post(boost::bind(&Session::start_write, shared_from_this()));
+}
+
+
+void Session::start_write()
+{
+  vector<boost::asio::const_buffer> buffers;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mtx);
+
+    while (!queue.empty() && in_flight.size() < MAX_GATHER)
+    {
+      in_flight.push_back(queue.front());
+      queue.pop_front();
+    }
+
+    for (auto f = in_flight.begin(); f != in_flight.end(); ++f)
+      buffers.push_back(boost::asio::buffer(f->buffer->data() + f->offset, f->length));
+  }
+
+  io->write(buffers, boost::bind(&Session::on_write, shared_from_this(), _1));
+}
+
+
+void Session::on_write(boost::system::error_code const & error)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  in_flight.clear();
+
+  if (error)
+  {
+    // the reactor will notice the broken connection on its next read...
+    queue.clear();
+    pending.clear();
+    writing = false;
+    return;
+  }
+
+  // the queue has drained, the newest value of each conflated item goes next...
+  if (queue.empty())
+  {
+    for (auto p = pending.begin(); p != pending.end(); ++p)
+      queue.push_back(p->second);
+
+    pending.clear();
+  }
+
+  if (queue.empty())
+  {
+    writing = false;
+    return;
+  }
+
+  io->post(boost::bind(&Session::start_write, shared_from_this()));
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "transport.h"
+
+using namespace std;
+
+static unsigned const CONFLATE_THRESHOLD = 1024;
+static unsigned const MAX_LENGTH = 1024;
+static unsigned const RESPONSE_POOL_SIZE = 16;
+static unsigned const MAX_GATHER = 64;
+
+// slice of an immutable buffer. A notification batch is serialized once and each
+// session receiving it only holds references to its slices. The index is the item
+// a notification is about, -1 for responses...
+struct Frame
+{
+  int index;
+  shared_ptr<string const> buffer;
+  size_t offset;
+  size_t length;
+};
+
+// a client connection. Everything sent to the client goes through a send queue
+// drained by gathered writes on the transport's thread, so responses and change
+// notifications never interleave and a slow client never blocks the publisher.
+class Session : public enable_shared_from_this<Session>
+{
+public:
+  Session(unique_ptr<Transport> transport);
+  ~Session();
+
+  Transport & transport();
+
+  // gets an empty buffer from the session's pool to build a response in...
+  shared_ptr<string> acquire();
+
+  // queues a response. Responses are never dropped...
+  void respond(shared_ptr<string> const & response);
+  void respond(boost::string_ref message);
+
+  // queues change notifications. Once the queue backs up the notifications are
+  // conflated per item, keeping only the newest one until the queue drains...
+  void notify(vector<Frame> const & frames);
+
+  // from now on responses are terminated by a newline like the notifications...
+  void set_framed();
+
+  // closes the transport once the pending writes are cancelled...
+  void close();
+
+  size_t conflated();
+
+  // slot of the session in the fan-out subscriber sets, -1 if it has none...
+  int slot;
+
+  // number given to the session when it is admitted...
+  unsigned long id;
+
+  // the request being processed and its tokens, they point into the request buffer...
+  char request[MAX_LENGTH];
+  vector<boost::string_ref> tokens;
+
+private:
+  unique_ptr<Transport> io;
+  boost::mutex mtx;
+  deque<Frame> queue;
+  unordered_map<int, Frame> pending;
+  vector<shared_ptr<string>> pool;
+  vector<Frame> in_flight;
+  bool writing;
+
+  // set by a pool thread running a request, read by the ones responding...
+  atomic<bool> framed;
+  size_t conflated_frames;
+
+  void schedule_write();
+  void start_write();
+  void on_write(boost::system::error_code const & error);
+};
@@ -0,0 +1,385 @@
+#include "simulated-source.h"
+
+static bool parseType(string const & name, ValueType & type)
+{
+  if (name == "r8")
+    type = TYPE_R8;
+  else if (name == "r4")
+    type = TYPE_R4;
+  else if (name == "i4")
+    type = TYPE_I4;
+  else if (name == "i2")
+    type = TYPE_I2;
+  else if (name == "bool")
+    type = TYPE_BOOL;
+  else if (name == "str")
+    type = TYPE_STRING;
+  else
+    return false;
+
+  return true;
+}
+
+
+bool parseSimulation(string const & text, SimulationSettings & settings)
+{
+  size_t start = 0;
+
+  while (start < text.size())
+  {
+    size_t end = text.find(',', start);
+
+    if (end == string::npos)
+      end = text.size();
+
+    string option = text.substr(start, end - start);
+    size_t equals = option.find('=');
+
+    start = end + 1;
+
+    if (equals == string::npos)
+      return false;
+
+    string name = option.substr(0, equals);
+    string value = option.substr(equals + 1);
+
+    if (name == "tags")
+      settings.tags = static_cast<size_t>(atoll(value.c_str()));
+    else if (name == "rate")
+      settings.rate = atof(value.c_str());
+    else if (name == "interval")
+      settings.interval = max(atoll(value.c_str()), 1LL);
+    else if (name == "latency")
+      settings.latency = atoll(value.c_str());
+    else if (name == "jitter")
+      settings.jitter = atoll(value.c_str());
+    else if (name == "fail")
+      settings.failures = atof(value.c_str());
+    else if (name == "bad")
+      settings.bad = atof(value.c_str());
+    else if (name == "types")
+    {
+      settings.types.clear();
+
+      // types=r8+i4...
+      for (size_t t = 0; t <= value.size(); )
+      {
+        size_t plus = min(value.find('+', t), value.size());
+        ValueType type;
+
+        if (!parseType(value.substr(t, plus - t), type))
+          return false;
+
+        settings.types.push_back(type);
+        t = plus + 1;
+      }
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+SimulatedSource::SimulatedSource(SimulationSettings const & settings, LogHandler logFunc, DataChangeHandler dataChangeFunc, WriteCompleteHandler writeCompleteFunc) :
+settings(settings),
+logger(logFunc),
+dataChangeFunc(dataChangeFunc),
+writeCompleteFunc(writeCompleteFunc),
+running(false),
+active(true)
+{
+  if (this->settings.types.empty())
+    this->settings.types.push_back(TYPE_R8);
+}
+
+
+SimulatedSource::~SimulatedSource()
+{
+  disconnect();
+}
+
+
+void SimulatedSource::connect(string const &)
+{
+  if (running)
+    return;
+
+  ItemInfo item;
+
+  for (size_t i = 0; i < settings.tags; i++)
+    store("SIM.TAG" + to_string(i), settings.types[i % settings.types.size()], item);
+
+  logger(">> Simulated source with " + to_string(items.size()) + " items.\r\n");
+
+  running = true;
+  thread = boost::thread(boost::bind(&SimulatedSource::run, this));
+}
+
+
+void SimulatedSource::disconnect()
+{
+  running = false;
+
+  if (thread.joinable())
+    thread.join();
+}
+
+
+Status SimulatedSource::add_item(string const & itemId, ValueType type, ItemInfo & item)
+{
+  return store(itemId, type, item) ? STATUS_OK : STATUS_FALSE;
+}
+
+
+Status SimulatedSource::item_info(string const & itemId, ItemInfo & item)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  auto i = indexes.find(itemId);
+
+  if (i == indexes.end())
+    return STATUS_FALSE;
+
+  item = items[i->second].info;
+  return STATUS_OK;
+}
+
+
+ItemInfo SimulatedSource::item_info(size_t index)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  return items.at(index).info;
+}
+
+
+Status SimulatedSource::read(ItemInfo const & item, ItemValue & value)
+{
+  wait();
+
+  if (fails())
+    return STATUS_FAIL;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  if (item.index < 0 || static_cast<size_t>(item.index) >= items.size())
+    return STATUS_FALSE;
+
+  value.handle = item.handle;
+  value.quality = QUALITY_GOOD;
+  value.index = item.index;
+  value.timestamp = now();
+  toValue(items[item.index], value.value);
+
+  return STATUS_OK;
+}
+
+
+Status SimulatedSource::write(vector<ItemInfo> const & written, vector<Value> const & values, vector<Status> & results)
+{
+  wait();
+
+  results.assign(written.size(), STATUS_OK);
+
+  Status status = STATUS_OK;
+
+  for (size_t i = 0; i < written.size(); i++)
+  {
+    double number = 0;
+
+    if (fails() || (!toDouble(values[i], number) && values[i].type != TYPE_STRING))
+    {
+      results[i] = STATUS_FAIL;
+      status = STATUS_FALSE;
+      continue;
+    }
+
+    if (values[i].type == TYPE_STRING)
+      number = atof(values[i].text.c_str());
+
+    boost::unique_lock<boost::mutex> lock(mtx);
+
+    if (written[i].index >= 0 && static_cast<size_t>(written[i].index) < items.size())
+      items[written[i].index].number = number;
+  }
+
+  return status;
+}
+
+
+Status SimulatedSource::write_async(ItemInfo const & item, Value const & value, unsigned long transactionId)
+{
+  vector<ItemInfo> written(1, item);
+  vector<Value> values(1, value);
+  vector<Status> results;
+
+  // the latency is taken here, the completion comes with the next batch...
+  write(written, values, results);
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+  pending.push_back(PendingWrite{ transactionId, results[0] });
+
+  return STATUS_OK;
+}
+
+
+Status SimulatedSource::set_active(bool active)
+{
+  this->active = active;
+
+  return STATUS_OK;
+}
+
+
+void SimulatedSource::run()
+{
+  vector<unique_ptr<ItemValue>> batch;
+  vector<PendingWrite> completed;
+  double due = 0;
+
+  boost::chrono::steady_clock::time_point next = boost::chrono::steady_clock::now();
+
+  while (running)
+  {
+    next += boost::chrono::milliseconds(settings.interval);
+    boost::this_thread::sleep_until(next);
+
+    {
+      boost::unique_lock<boost::mutex> lock(mtx);
+
+      completed.swap(pending);
+
+      // the fraction of a change left over goes with the next batch...
+      due += settings.rate * settings.interval / 1000;
+
+      size_t count = min(static_cast<size_t>(due), items.size());
+      due -= static_cast<size_t>(due);
+
+      if (active && count > 0)
+      {
+        size_t first = uniform_int_distribution<size_t>(0, items.size() - 1)(generator);
+        normal_distribution<double> step(0, 1);
+        uniform_real_distribution<double> chance(0, 1);
+        unsigned long long timestamp = now();
+
+        for (size_t i = 0; i < count; i++)
+        {
+          SimulatedItem & item = items[(first + i) % items.size()];
+
+          switch (item.info.dataType)
+          {
+          case TYPE_R8:
+          case TYPE_R4:
+            item.number += step(generator);
+            break;
+          case TYPE_BOOL:
+            item.number = item.number == 0 ? 1 : 0;
+            break;
+          default:
+            item.number += 1;
+            break;
+          }
+
+          unique_ptr<ItemValue> value(new ItemValue);
+          value->handle = item.info.handle;
+          value->quality = chance(generator) < settings.bad ? QUALITY_BAD : QUALITY_GOOD;
+          value->index = item.info.index;
+          value->timestamp = timestamp;
+          toValue(item, value->value);
+
+          batch.push_back(move(value));
+        }
+      }
+    }
+
+    for (auto c = completed.begin(); c != completed.end(); ++c)
+    {
+      if (writeCompleteFunc)
+        writeCompleteFunc(c->transactionId, c->result);
+    }
+
+    completed.clear();
+
+    if (batch.empty())
+      continue;
+
+    dataChangeFunc(batch);
+    batch.clear();
+  }
+}
+
+
+void SimulatedSource::wait()
+{
+  long long delay = settings.latency;
+
+  if (settings.jitter > 0)
+  {
+    boost::unique_lock<boost::mutex> lock(mtx);
+    delay += uniform_int_distribution<long long>(0, settings.jitter)(generator);
+  }
+
+  if (delay > 0)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(delay));
+}
+
+
+bool SimulatedSource::fails()
+{
+  if (settings.failures <= 0)
+    return false;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  return uniform_real_distribution<double>(0, 1)(generator) < settings.failures;
+}
+
+
+bool SimulatedSource::store(string const & itemId, ValueType type, ItemInfo & item)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  auto i = indexes.find(itemId);
+
+  if (i != indexes.end())
+  {
+    item = items[i->second].info;
+    return false;
+  }
+
+  item.id = itemId;
+  item.handle = static_cast<ItemHandle>(items.size());
+  item.dataType = type;
+  item.index = static_cast<int>(items.size());
+
+  indexes[itemId] = items.size();
+  items.push_back(SimulatedItem{ item, 0 });
+
+  return true;
+}
+
+
+void SimulatedSource::toValue(SimulatedItem const & item, Value & value)
+{
+  value.type = item.info.dataType;
+
+  switch (item.info.dataType)
+  {
+  case TYPE_R8: value.real = item.number; break;
+  case TYPE_R4: value.real = static_cast<float>(item.number); break;
+  case TYPE_BOOL: value.integer = item.number != 0 ? 1 : 0; break;
+  case TYPE_STRING: value.text = to_string(static_cast<long long>(item.number)); break;
+  default: value.integer = static_cast<long long>(item.number); break;
+  }
+}
+
+
+unsigned long long SimulatedSource::now()
+{
+  // 100 ns ticks since 1601...
+  return boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::system_clock::now().time_since_epoch()).count() * 10 + 116444736000000000ULL;
+}
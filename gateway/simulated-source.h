@@ -0,0 +1,103 @@
+#pragma once
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tag-source.h"
+
+using namespace opc;
+using namespace std;
+
+static size_t const SIMULATED_TAGS = 1000;
+static double const SIMULATED_RATE = 10000;
+static long long const SIMULATED_INTERVAL = 100;
+
+struct SimulationSettings
+{
+  // the items made on connect, named SIM.TAG<n>, and their types taken in turn...
+  size_t tags;
+  vector<ValueType> types;
+
+  // changes per second, sent in a batch every interval ms...
+  double rate;
+  long long interval;
+
+  // ms every read and write takes, plus up to jitter ms at random...
+  long long latency;
+  long long jitter;
+
+  // share of the reads and writes that fail, and of the changes with a bad quality...
+  double failures;
+  double bad;
+};
+
+// parses a list like tags=50000,rate=500000,interval=100,types=r8+i4+bool+str,
+// latency=2,jitter=3,fail=0.01,bad=0.001. The values not given keep their defaults...
+bool parseSimulation(string const & text, SimulationSettings & settings);
+
+// a source made up in the process, for running and measuring the gateway without a
+// server. Every interval a window of items, starting at random, changes: the reals
+// walk at random, the integers and strings count and the booleans toggle. Each item
+// changes at most once per batch, like the groups of a real server.
+class SimulatedSource : public TagSource
+{
+public:
+  SimulatedSource(SimulationSettings const & settings, LogHandler logFunc, DataChangeHandler dataChangeFunc, WriteCompleteHandler writeCompleteFunc);
+  ~SimulatedSource();
+
+  void connect(string const & server);
+  void disconnect();
+
+  Status add_item(string const & itemId, ValueType type, ItemInfo & item);
+  Status item_info(string const & itemId, ItemInfo & item);
+  ItemInfo item_info(size_t index);
+
+  Status read(ItemInfo const & item, ItemValue & value);
+  Status write(vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results);
+  Status write_async(ItemInfo const & item, Value const & value, unsigned long transactionId);
+
+  Status set_active(bool active);
+
+private:
+  struct SimulatedItem
+  {
+    ItemInfo info;
+    double number;
+  };
+
+  struct PendingWrite
+  {
+    unsigned long transactionId;
+    Status result;
+  };
+
+  SimulationSettings settings;
+  LogHandler logger;
+  DataChangeHandler dataChangeFunc;
+  WriteCompleteHandler writeCompleteFunc;
+
+  // guards the items, the pending writes and the generator...
+  boost::mutex mtx;
+  vector<SimulatedItem> items;
+  unordered_map<string, size_t> indexes;
+  vector<PendingWrite> pending;
+  mt19937 generator;
+
+  boost::thread thread;
+  atomic<bool> running;
+  atomic<bool> active;
+
+  void run();
+  void wait();
+  bool fails();
+  bool store(string const & itemId, ValueType type, ItemInfo & item);
+
+  static void toValue(SimulatedItem const & item, Value & value);
+  static unsigned long long now();
+};
@@ -0,0 +1,49 @@
+#include "socket-transport.h"
+
+SocketTransport::SocketTransport(boost::asio::io_service & service, boost::asio::ip::tcp::socket * socket) :
+service(service),
+sock(socket)
+{
+  boost::system::error_code error;
+  ostringstream remote;
+
+  remote << sock->remote_endpoint(error);
+  endpoint = remote.str();
+}
+
+
+void SocketTransport::read(char * buffer, size_t size, IoHandler handler)
+{
+  sock->async_read_some(boost::asio::buffer(buffer, size), handler);
+}
+
+
+void SocketTransport::write(vector<boost::asio::const_buffer> const & buffers, IoHandler handler)
+{
+  boost::asio::async_write(*sock, buffers, handler);
+}
+
+
+void SocketTransport::dispatch(function<void()> fn)
+{
+  service.dispatch(fn);
+}
+
+
+void SocketTransport::post(function<void()> fn)
+{
+  service.post(fn);
+}
+
+
+void SocketTransport::close()
+{
+  boost::system::error_code error;
+  sock->close(error);
+}
+
+
+string const & SocketTransport::peer()
+{
+  return endpoint;
+}
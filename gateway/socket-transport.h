@@ -0,0 +1,28 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <sstream>
+
+#include "transport.h"
+
+using namespace std;
+
+// a session on an Asio socket, run by the io_service of its reactor...
+class SocketTransport : public Transport
+{
+public:
+  SocketTransport(boost::asio::io_service & service, boost::asio::ip::tcp::socket * socket);
+
+  void read(char * buffer, size_t size, IoHandler handler);
+  void write(vector<boost::asio::const_buffer> const & buffers, IoHandler handler);
+  void dispatch(function<void()> fn);
+  void post(function<void()> fn);
+  void close();
+  string const & peer();
+
+private:
+  boost::asio::io_service & service;
+  unique_ptr<boost::asio::ip::tcp::socket> sock;
+  string endpoint;
+};
@@ -0,0 +1,185 @@
+#include "stale-watchdog.h"
+
+StaleWatchdog::StaleWatchdog(size_t capacity, function<string(int index)> itemIdFn, StaleHandler staleFn) :
+default_timeout(0),
+itemId(itemIdFn),
+staleFunc(staleFn),
+capacity(capacity),
+last(new atomic<long long>[capacity]),
+states(new atomic<unsigned char>[capacity]),
+stale_items(0),
+timeouts(capacity, -1),
+wheel(now() / WATCHDOG_TICK),
+running(false)
+{
+  for (size_t i = 0; i < capacity; i++)
+  {
+    last[i] = 0;
+    states[i] = ITEM_IDLE;
+  }
+}
+
+
+StaleWatchdog::~StaleWatchdog()
+{
+  stop();
+}
+
+
+void StaleWatchdog::set_timeout(long long timeout)
+{
+  default_timeout = timeout;
+}
+
+
+void StaleWatchdog::set_timeout(string const & prefix, long long timeout)
+{
+  classes.push_back(make_pair(prefix, timeout));
+
+  // the longest prefixes are tried first...
+  stable_sort(classes.begin(), classes.end(), [](pair<string, long long> const & a, pair<string, long long> const & b) { return a.first.size() > b.first.size(); });
+}
+
+
+void StaleWatchdog::start()
+{
+  running = true;
+  thread = boost::thread(boost::bind(&StaleWatchdog::run, this));
+}
+
+
+void StaleWatchdog::stop()
+{
+  if (!running.exchange(false))
+    return;
+
+  thread.join();
+}
+
+
+void StaleWatchdog::seen(int index)
+{
+  if (index < 0 || static_cast<size_t>(index) >= capacity)
+    return;
+
+  last[index].store(now(), memory_order_relaxed);
+
+  unsigned char state = states[index].load(memory_order_acquire);
+
+  // the usual case, the timer is there and will read the new stamp...
+  if (state != ITEM_IDLE && state != ITEM_STALE)
+    return;
+
+  if (!states[index].compare_exchange_strong(state, ITEM_PENDING))
+    return;
+
+  if (state == ITEM_STALE)
+    stale_items--;
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+  pending.push_back(index);
+}
+
+
+size_t StaleWatchdog::stale() const
+{
+  return stale_items.load();
+}
+
+
+long long StaleWatchdog::now()
+{
+  return boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void StaleWatchdog::run()
+{
+  vector<int> armed;
+  vector<unsigned long long> expired;
+  vector<int> stale;
+
+  while (running)
+  {
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(WATCHDOG_TICK));
+
+    {
+      boost::unique_lock<boost::mutex> lock(mtx);
+      armed.swap(pending);
+    }
+
+    arm(armed);
+    armed.clear();
+
+    long long t = now();
+    wheel.advance(t / WATCHDOG_TICK, expired);
+
+    for (auto e = expired.begin(); e != expired.end(); ++e)
+    {
+      int index = static_cast<int>(*e);
+      long long deadline = last[index].load(memory_order_relaxed) + timeouts[index];
+
+      // a value came since the timer was set, it waits for the new deadline...
+      if (deadline > t)
+      {
+        wheel.schedule(*e, deadline / WATCHDOG_TICK + 1);
+        continue;
+      }
+
+      unsigned char state = ITEM_ARMED;
+
+      if (states[index].compare_exchange_strong(state, ITEM_STALE))
+        stale.push_back(index);
+    }
+
+    expired.clear();
+
+    if (stale.empty())
+      continue;
+
+    stale_items += stale.size();
+    staleFunc(stale);
+    stale.clear();
+  }
+}
+
+
+void StaleWatchdog::arm(vector<int> const & indexes)
+{
+  for (auto i = indexes.begin(); i != indexes.end(); ++i)
+  {
+    // the class of an item is looked up once...
+    if (timeouts[*i] < 0)
+    {
+      try
+      {
+        timeouts[*i] = timeout(itemId(*i));
+      }
+      catch (exception &)
+      {
+        timeouts[*i] = default_timeout;
+      }
+    }
+
+    if (timeouts[*i] <= 0)
+    {
+      states[*i] = ITEM_UNWATCHED;
+      continue;
+    }
+
+    states[*i] = ITEM_ARMED;
+    wheel.schedule(static_cast<unsigned long long>(*i), (last[*i].load(memory_order_relaxed) + timeouts[*i]) / WATCHDOG_TICK + 1);
+  }
+}
+
+
+long long StaleWatchdog::timeout(string const & id)
+{
+  for (auto c = classes.begin(); c != classes.end(); ++c)
+  {
+    if (id.compare(0, c->first.size(), c->first) == 0)
+      return c->second;
+  }
+
+  return default_timeout;
+}
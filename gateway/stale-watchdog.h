@@ -0,0 +1,83 @@
+#pragma once
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "timing-wheel.h"
+
+using namespace std;
+
+// ms between two checks of the timers, a stale item is found up to a tick late...
+static long long const WATCHDOG_TICK = 100;
+
+// gets the items that just went stale...
+typedef function<void(vector<int> const & indexes)> StaleHandler;
+
+// finds the items whose values stopped coming. Every item with a timeout has one
+// timer in a hierarchical timing wheel, a value only stamps the time it came, so an
+// update is O(1) and never touches the wheel. When a timer expires the stamp tells
+// whether the item went quiet or when to look again. The timeout of an item comes
+// from its class, an item id prefix, the longest matching one wins; 0 never times out.
+// A stale item is armed again by its next value.
+class StaleWatchdog
+{
+public:
+  StaleWatchdog(size_t capacity, function<string(int index)> itemIdFn, StaleHandler staleFn);
+  ~StaleWatchdog();
+
+  // sets the timeout (ms) of the items without a class...
+  void set_timeout(long long timeout);
+  void set_timeout(string const & prefix, long long timeout);
+
+  void start();
+  void stop();
+
+  // an item got a value, changed or not...
+  void seen(int index);
+
+  // items stale right now...
+  size_t stale() const;
+
+  static long long now();
+
+private:
+  enum ItemState
+  {
+    ITEM_IDLE,
+    ITEM_PENDING,
+    ITEM_ARMED,
+    ITEM_STALE,
+    ITEM_UNWATCHED
+  };
+
+  long long default_timeout;
+  vector<pair<string, long long>> classes;
+  function<string(int index)> itemId;
+  StaleHandler staleFunc;
+  size_t capacity;
+
+  // written by the data change thread, the rest is the watchdog thread's...
+  unique_ptr<atomic<long long>[]> last;
+  unique_ptr<atomic<unsigned char>[]> states;
+  atomic<size_t> stale_items;
+
+  // the items seen for the first time or since they went stale...
+  boost::mutex mtx;
+  vector<int> pending;
+
+  vector<long long> timeouts;
+  HierarchicalTimingWheel wheel;
+
+  boost::thread thread;
+  atomic<bool> running;
+
+  void run();
+  void arm(vector<int> const & indexes);
+  long long timeout(string const & itemId);
+};
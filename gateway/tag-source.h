@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+// where the items and their values come from. The gateway only sees its source
+// through here, with the portable values: a source that talks COM converts its
+// VARIANTs and HRESULTs itself. The data changes and the asynchronous write
+// completions go to the handlers given when the source is made, on the source's
+// own threads.
+class TagSource
+{
+public:
+  virtual ~TagSource() {}
+
+  // connects to the server, with the server name meaning whatever the source makes of it...
+  virtual void connect(string const & server) = 0;
+  virtual void disconnect() = 0;
+
+  virtual Status add_item(string const & itemId, ValueType type, ItemInfo & item) = 0;
+
+  // gets an added item by id, or by index. The index throws out_of_range when there is
+  // no such item...
+  virtual Status item_info(string const & itemId, ItemInfo & item) = 0;
+  virtual ItemInfo item_info(size_t index) = 0;
+
+  // reads the value from the device...
+  virtual Status read(ItemInfo const & item, ItemValue & value) = 0;
+
+  // writes the values of several items at once, results gets the result of each item...
+  virtual Status write(vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results) = 0;
+
+  // starts a write whose result goes to the write complete handler...
+  virtual Status write_async(ItemInfo const & item, Value const & value, unsigned long transactionId) = 0;
+
+  // starts or stops the data changes...
+  virtual Status set_active(bool active) = 0;
+};
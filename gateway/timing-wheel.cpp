@@ -0,0 +1,138 @@
+#include "timing-wheel.h"
+
+TimingWheel::TimingWheel(size_t slots, long long start) : wheel(slots), current(start), count(0)
+{
+}
+
+
+void TimingWheel::schedule(unsigned long long key, long long deadline)
+{
+  // a deadline in the past expires on the next advance...
+  if (deadline <= current)
+    deadline = current + 1;
+
+  wheel[deadline % wheel.size()].push_back(Timer{ key, deadline });
+  ++count;
+}
+
+
+void TimingWheel::advance(long long now, vector<unsigned long long> & expired)
+{
+  // a full turn visits every slot, there's no need to go around again...
+  long long last = now - current > static_cast<long long>(wheel.size()) ? current + wheel.size() : now;
+
+  for (long long tick = current + 1; tick <= last; tick++)
+  {
+    vector<Timer> & slot = wheel[tick % wheel.size()];
+
+    for (size_t i = 0; i < slot.size();)
+    {
+      if (slot[i].deadline > now)
+      {
+        // still has turns to go...
+        ++i;
+        continue;
+      }
+
+      expired.push_back(slot[i].key);
+      slot[i] = slot.back();
+      slot.pop_back();
+      --count;
+    }
+  }
+
+  current = now;
+}
+
+
+bool TimingWheel::empty() const
+{
+  return count == 0;
+}
+
+
+HierarchicalTimingWheel::HierarchicalTimingWheel(long long start) : slots(HIERARCHY_LEVELS << HIERARCHY_BITS), current(start), count(0)
+{
+}
+
+
+void HierarchicalTimingWheel::schedule(unsigned long long key, long long deadline)
+{
+  place(Timer{ key, deadline });
+  ++count;
+}
+
+
+void HierarchicalTimingWheel::advance(long long now, vector<unsigned long long> & expired)
+{
+  long long const mask = (1 << HIERARCHY_BITS) - 1;
+
+  // with no timer there is no slot to visit on the way...
+  if (count == 0)
+    current = max(current, now);
+
+  while (current < now)
+  {
+    current++;
+
+    // the levels whose hand has moved to a new slot, the highest first, so its
+    // timers may land in a slot of the level below that is moved next...
+    unsigned top = 0;
+
+    while (top + 1 < HIERARCHY_LEVELS && (current & ((1LL << (HIERARCHY_BITS * (top + 1))) - 1)) == 0)
+      top++;
+
+    for (unsigned level = top; level > 0; level--)
+    {
+      vector<Timer> & slot = slots[(level << HIERARCHY_BITS) + ((current >> (HIERARCHY_BITS * level)) & mask)];
+
+      moving.swap(slot);
+
+      for (auto t = moving.begin(); t != moving.end(); ++t)
+      {
+        // due on this very tick, its slot is visited below...
+        if (t->deadline <= current)
+          slots[current & mask].push_back(*t);
+        else
+          place(*t);
+      }
+
+      moving.clear();
+    }
+
+    vector<Timer> & slot = slots[current & mask];
+
+    for (auto t = slot.begin(); t != slot.end(); ++t)
+      expired.push_back(t->key);
+
+    count -= slot.size();
+    slot.clear();
+  }
+}
+
+
+bool HierarchicalTimingWheel::empty() const
+{
+  return count == 0;
+}
+
+
+void HierarchicalTimingWheel::place(Timer const & timer)
+{
+  long long const mask = (1 << HIERARCHY_BITS) - 1;
+  long long const range = 1LL << (HIERARCHY_BITS * HIERARCHY_LEVELS);
+
+  // a deadline in the past expires on the next tick, one beyond the top level waits
+  // in the slot its hand reaches last...
+  long long deadline = min(max(timer.deadline, current + 1), current + range - 1);
+  long long delta = deadline - current;
+
+  // the level whose turn, counted from now, holds the deadline. The slot is reached
+  // when the deadline's span of that level starts...
+  unsigned level = 0;
+
+  while (delta >= (1LL << (HIERARCHY_BITS * (level + 1))))
+    level++;
+
+  slots[(level << HIERARCHY_BITS) + ((deadline >> (HIERARCHY_BITS * level)) & mask)].push_back(timer);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+// hashed timing wheel. Timers are keys placed in the slot of their deadline tick,
+// so scheduling is O(1) and advancing only visits the slots of the elapsed ticks.
+// Timers can't be cancelled: the owner checks if a key is still wanted when it expires.
+class TimingWheel
+{
+public:
+  TimingWheel(size_t slots, long long start);
+
+  // schedules the key to expire at the given tick...
+  void schedule(unsigned long long key, long long deadline);
+
+  // moves the wheel to the given tick and appends the expired keys...
+  void advance(long long now, vector<unsigned long long> & expired);
+
+  bool empty() const;
+
+private:
+  struct Timer
+  {
+    unsigned long long key;
+    long long deadline;
+  };
+
+  vector<vector<Timer>> wheel;
+  long long current;
+  size_t count;
+};
+
+
+static unsigned const HIERARCHY_BITS = 6;
+static unsigned const HIERARCHY_LEVELS = 4;
+
+// timing wheel of several levels of 2^HIERARCHY_BITS slots turning like the hands of
+// a clock: a slot of a level spans a whole turn of the level below. A timer goes in
+// the lowest level whose turn holds its deadline and moves down a level when the
+// level above reaches its slot, so it is touched once per level however far away it
+// is, and the wheel stays small for long timeouts. A timer beyond the top level waits
+// in its last slot and is placed again from there. As with the TimingWheel, timers
+// can't be cancelled.
+class HierarchicalTimingWheel
+{
+public:
+  HierarchicalTimingWheel(long long start);
+
+  // schedules the key to expire at the given tick...
+  void schedule(unsigned long long key, long long deadline);
+
+  // moves the wheel to the given tick and appends the expired keys...
+  void advance(long long now, vector<unsigned long long> & expired);
+
+  bool empty() const;
+
+private:
+  struct Timer
+  {
+    unsigned long long key;
+    long long deadline;
+  };
+
+  // the slots of level l are at l << HIERARCHY_BITS...
+  vector<vector<Timer>> slots;
+  vector<Timer> moving;
+  long long current;
+  size_t count;
+
+  void place(Timer const & timer);
+};
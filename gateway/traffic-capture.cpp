@@ -0,0 +1,59 @@
+#include "traffic-capture.h"
+
+TrafficCapture::TrafficCapture(string const & path) :
+file(path.c_str(), ios::binary | ios::trunc),
+start(boost::chrono::steady_clock::now())
+{
+}
+
+
+void TrafficCapture::connected(unsigned long session)
+{
+  write(session, TRAFFIC_CONNECT, boost::string_ref());
+}
+
+
+void TrafficCapture::request(unsigned long session, boost::string_ref message)
+{
+  write(session, TRAFFIC_REQUEST, message);
+}
+
+
+void TrafficCapture::disconnected(unsigned long session)
+{
+  write(session, TRAFFIC_DISCONNECT, boost::string_ref());
+}
+
+
+bool TrafficCapture::good() const
+{
+  return file.good();
+}
+
+
+void TrafficCapture::write(unsigned long session, char event, boost::string_ref message)
+{
+  // the line is made before the lock, the sessions of all the loops write here...
+  string line;
+  line.reserve(32 + message.size());
+
+  opc::appendInteger(line, boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start).count());
+  line.push_back('\t');
+  opc::appendInteger(line, session);
+  line.push_back('\t');
+  line.push_back(event);
+
+  if (!message.empty())
+  {
+    line.push_back('\t');
+
+    // a line break would end the request early...
+    for (auto c = message.begin(); c != message.end(); ++c)
+      line.push_back(*c == '\n' || *c == '\r' ? ' ' : *c);
+  }
+
+  line.push_back('\n');
+
+  boost::unique_lock<boost::mutex> lock(mtx);
+  file.write(line.data(), line.size());
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <fstream>
+#include <string>
+
+#include "opc_types.h"
+
+using namespace std;
+
+// the events of a traffic capture...
+static char const TRAFFIC_CONNECT = 'C';
+static char const TRAFFIC_REQUEST = 'R';
+static char const TRAFFIC_DISCONNECT = 'D';
+
+// saves the proxy traffic, one line per event: the microseconds since the capture
+// started, the session, the event and, for a request, the message as received:
+//   1520	3	C
+//   1733	3	R	READ|Random.Int4
+//   9012	3	D
+// The load-replay tool plays the lines back against a gateway.
+class TrafficCapture
+{
+public:
+  TrafficCapture(string const & path);
+
+  void connected(unsigned long session);
+  void request(unsigned long session, boost::string_ref message);
+  void disconnected(unsigned long session);
+
+  bool good() const;
+
+private:
+  boost::mutex mtx;
+  ofstream file;
+  boost::chrono::steady_clock::time_point start;
+
+  void write(unsigned long session, char event, boost::string_ref message);
+};
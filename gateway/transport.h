@@ -0,0 +1,35 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef function<void(boost::system::error_code const & error, size_t length)> IoHandler;
+
+// the I/O of a session. The proxy only talks to the client through it, so the same
+// sessions and requests run on the Asio sockets or on io_uring. The handlers run on
+// the transport's thread, and so must read and write be called...
+class Transport
+{
+public:
+  virtual ~Transport() {}
+
+  // reads what is available, up to size bytes...
+  virtual void read(char * buffer, size_t size, IoHandler handler) = 0;
+
+  // writes all the buffers. The buffers must stay valid until the handler runs...
+  virtual void write(vector<boost::asio::const_buffer> const & buffers, IoHandler handler) = 0;
+
+  // runs the function on the transport's thread, dispatch right away if it is already on it...
+  virtual void dispatch(function<void()> fn) = 0;
+  virtual void post(function<void()> fn) = 0;
+
+  // the pending reads and writes complete with an error...
+  virtual void close() = 0;
+
+  // the address of the client, taken when the connection is made...
+  virtual string const & peer() = 0;
+};
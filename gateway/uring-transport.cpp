@@ -0,0 +1,595 @@
+#include "uring-transport.h"
+
+#ifdef GATEWAY_IO_URING
+
+UringTransport::UringTransport(UringReactor & reactor, unsigned id, int fd) :
+reactor(reactor),
+id(id),
+fd(fd),
+outstanding(0),
+closing(false),
+read_buffer(nullptr),
+read_size(0),
+written(0)
+{
+  memset(&message, 0, sizeof(message));
+
+  sockaddr_storage address;
+  socklen_t length = sizeof(address);
+
+  if (getpeername(fd, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    return;
+
+  char host[INET6_ADDRSTRLEN] = { 0 };
+  unsigned short port;
+
+  if (address.ss_family == AF_INET6)
+  {
+    sockaddr_in6 * in6 = reinterpret_cast<sockaddr_in6 *>(&address);
+    inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+    port = ntohs(in6->sin6_port);
+  }
+  else
+  {
+    sockaddr_in * in = reinterpret_cast<sockaddr_in *>(&address);
+    inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+    port = ntohs(in->sin_port);
+  }
+
+  endpoint = string(host) + ":" + to_string(port);
+}
+
+
+void UringTransport::read(char * buffer, size_t size, IoHandler handler)
+{
+  read_buffer = buffer;
+  read_size = size;
+  read_handler = handler;
+
+  if (inbox.empty() && !read_error)
+    return;
+
+  // what is already here is delivered on the next round, not from inside the caller...
+  ++outstanding;
+  reactor.post([this]() {
+    --outstanding;
+    complete_read();
+    reactor.settle(*this);
+  });
+}
+
+
+void UringTransport::write(vector<boost::asio::const_buffer> const & buffers, IoHandler handler)
+{
+  if (closing)
+  {
+    reactor.post([handler]() { handler(boost::asio::error::operation_aborted, 0); });
+    return;
+  }
+
+  iovecs.clear();
+
+  for (auto b = buffers.begin(); b != buffers.end(); ++b)
+  {
+    iovec v;
+    v.iov_base = const_cast<void *>(boost::asio::buffer_cast<void const *>(*b));
+    v.iov_len = boost::asio::buffer_size(*b);
+    iovecs.push_back(v);
+  }
+
+  written = 0;
+  write_handler = handler;
+
+  reactor.send(*this);
+}
+
+
+void UringTransport::dispatch(function<void()> fn)
+{
+  if (reactor.in_loop())
+    fn();
+  else
+    reactor.post(fn);
+}
+
+
+void UringTransport::post(function<void()> fn)
+{
+  reactor.post(fn);
+}
+
+
+void UringTransport::close()
+{
+  if (closing)
+    return;
+
+  closing = true;
+
+  reactor.shutdown(*this);
+}
+
+
+string const & UringTransport::peer()
+{
+  return endpoint;
+}
+
+
+void UringTransport::received(char const * data, size_t length)
+{
+  if (!read_handler || !inbox.empty())
+  {
+    inbox.append(data, length);
+    return;
+  }
+
+  // a read is waiting, the data goes straight to its buffer...
+  size_t copied = min(length, read_size);
+  memcpy(read_buffer, data, copied);
+  inbox.append(data + copied, length - copied);
+
+  IoHandler handler;
+  handler.swap(read_handler);
+  handler(boost::system::error_code(), copied);
+}
+
+
+void UringTransport::failed(boost::system::error_code const & error)
+{
+  if (!read_error)
+    read_error = error;
+
+  if (inbox.empty())
+    complete_read();
+}
+
+
+void UringTransport::complete_read()
+{
+  if (!read_handler)
+    return;
+
+  IoHandler handler;
+  handler.swap(read_handler);
+
+  if (inbox.empty())
+  {
+    handler(read_error, 0);
+    return;
+  }
+
+  size_t copied = min(inbox.size(), read_size);
+  memcpy(read_buffer, inbox.data(), copied);
+  inbox.erase(0, copied);
+
+  handler(boost::system::error_code(), copied);
+}
+
+
+void UringTransport::sent(int result)
+{
+  if (result < 0)
+  {
+    IoHandler handler;
+    handler.swap(write_handler);
+    handler(boost::system::error_code(-result, boost::system::system_category()), written);
+    return;
+  }
+
+  written += result;
+
+  // the socket may take less than asked, the rest goes in another send...
+  size_t remaining = result;
+  auto v = iovecs.begin();
+
+  while (v != iovecs.end() && remaining >= v->iov_len)
+  {
+    remaining -= v->iov_len;
+    ++v;
+  }
+
+  iovecs.erase(iovecs.begin(), v);
+
+  if (!iovecs.empty())
+  {
+    iovecs.front().iov_base = static_cast<char *>(iovecs.front().iov_base) + remaining;
+    iovecs.front().iov_len -= remaining;
+
+    if (!closing)
+    {
+      reactor.send(*this);
+      return;
+    }
+  }
+
+  IoHandler handler;
+  handler.swap(write_handler);
+  handler(iovecs.empty() ? boost::system::error_code() : boost::asio::error::operation_aborted, written);
+}
+
+
+UringReactor::UringReactor(unsigned id, int core, AcceptHandler acceptFn) :
+EventLoop(id, core),
+buffers(nullptr),
+recycled(0),
+listener(-1),
+wake_fd(-1),
+wake_value(0),
+accepted(acceptFn),
+next_id(0),
+stopped(false)
+{
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int result = io_uring_queue_init_params(RING_ENTRIES, &ring, &params);
+
+  if (result < 0)
+    throw boost::system::system_error(boost::system::error_code(-result, boost::system::system_category()), "io_uring_queue_init_params");
+
+  buffers = io_uring_setup_buf_ring(&ring, RECV_BUFFERS, RECV_BUFFER_GROUP, 0, &result);
+
+  if (buffers == nullptr)
+  {
+    io_uring_queue_exit(&ring);
+    throw boost::system::system_error(boost::system::error_code(-result, boost::system::system_category()), "io_uring_setup_buf_ring");
+  }
+
+  storage.resize(RECV_BUFFERS * RECV_BUFFER_SIZE);
+
+  for (unsigned i = 0; i < RECV_BUFFERS; i++)
+    io_uring_buf_ring_add(buffers, &storage[i * RECV_BUFFER_SIZE], RECV_BUFFER_SIZE, i, io_uring_buf_ring_mask(RECV_BUFFERS), i);
+
+  io_uring_buf_ring_advance(buffers, RECV_BUFFERS);
+
+  wake_fd = eventfd(0, EFD_CLOEXEC);
+}
+
+
+UringReactor::~UringReactor()
+{
+  stop();
+  join();
+
+  for (auto c = connections.begin(); c != connections.end(); ++c)
+    ::close(c->second.transport->fd);
+
+  connections.clear();
+  clear();
+
+  if (listener >= 0)
+    ::close(listener);
+
+  io_uring_free_buf_ring(&ring, buffers, RECV_BUFFERS, RECV_BUFFER_GROUP);
+  io_uring_queue_exit(&ring);
+
+  ::close(wake_fd);
+}
+
+
+void UringReactor::listen(boost::asio::ip::tcp::endpoint const & endpoint)
+{
+  listener = socket(endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  int on = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+  if (bind(listener, endpoint.data(), static_cast<socklen_t>(endpoint.size())) != 0 || ::listen(listener, SOMAXCONN) != 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "listen");
+}
+
+
+void UringReactor::start()
+{
+  thread = boost::thread(boost::bind(&UringReactor::run, this));
+}
+
+
+void UringReactor::stop()
+{
+  stopped = true;
+
+  unsigned long long one = 1;
+  ::write(wake_fd, &one, sizeof(one));
+}
+
+
+void UringReactor::join()
+{
+  if (thread.joinable())
+    thread.join();
+}
+
+
+void UringReactor::post(function<void()> fn)
+{
+  bool first;
+
+  {
+    boost::unique_lock<boost::mutex> lock(posted_mtx);
+
+    first = posted.empty();
+    posted.push_back(fn);
+  }
+
+  // the loop checks the queue before waiting, only a sleeping loop must be woken...
+  if (first && !in_loop())
+  {
+    unsigned long long one = 1;
+    ::write(wake_fd, &one, sizeof(one));
+  }
+}
+
+
+bool UringReactor::in_loop() const
+{
+  return boost::this_thread::get_id() == loop_thread;
+}
+
+
+unsigned long long UringReactor::user_data(Operation op, unsigned id)
+{
+  return (static_cast<unsigned long long>(op) << 32) | id;
+}
+
+
+io_uring_sqe * UringReactor::next_sqe()
+{
+  io_uring_sqe * sqe = io_uring_get_sqe(&ring);
+
+  // the submission queue is full, what is in it goes now...
+  while (sqe == nullptr)
+  {
+    io_uring_submit(&ring);
+    sqe = io_uring_get_sqe(&ring);
+  }
+
+  return sqe;
+}
+
+
+void UringReactor::arm_accept()
+{
+  io_uring_sqe * sqe = next_sqe();
+
+  io_uring_prep_multishot_accept(sqe, listener, nullptr, nullptr, SOCK_CLOEXEC);
+  io_uring_sqe_set_data64(sqe, user_data(OP_ACCEPT, 0));
+}
+
+
+void UringReactor::arm_recv(UringTransport & transport)
+{
+  io_uring_sqe * sqe = next_sqe();
+
+  io_uring_prep_recv_multishot(sqe, transport.fd, nullptr, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = RECV_BUFFER_GROUP;
+  io_uring_sqe_set_data64(sqe, user_data(OP_RECV, transport.id));
+
+  ++transport.outstanding;
+}
+
+
+void UringReactor::arm_wake()
+{
+  io_uring_sqe * sqe = next_sqe();
+
+  io_uring_prep_read(sqe, wake_fd, &wake_value, sizeof(wake_value), 0);
+  io_uring_sqe_set_data64(sqe, user_data(OP_WAKE, 0));
+}
+
+
+void UringReactor::send(UringTransport & transport)
+{
+  memset(&transport.message, 0, sizeof(transport.message));
+  transport.message.msg_iov = transport.iovecs.data();
+  transport.message.msg_iovlen = transport.iovecs.size();
+
+  io_uring_sqe * sqe = next_sqe();
+
+  io_uring_prep_sendmsg(sqe, transport.fd, &transport.message, MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, user_data(OP_SEND, transport.id));
+
+  ++transport.outstanding;
+}
+
+
+void UringReactor::shutdown(UringTransport & transport)
+{
+  // the pending operations of the socket fail, the connection is released once they are all back...
+  ::shutdown(transport.fd, SHUT_RDWR);
+
+  io_uring_sqe * sqe = next_sqe();
+
+  io_uring_prep_cancel64(sqe, user_data(OP_RECV, transport.id), 0);
+  io_uring_sqe_set_data64(sqe, user_data(OP_CANCEL, transport.id));
+
+  settle(transport);
+}
+
+
+void UringReactor::settle(UringTransport & transport)
+{
+  if (transport.closing && transport.outstanding == 0)
+    released.push_back(transport.id);
+}
+
+
+void UringReactor::release(UringTransport & transport)
+{
+  unsigned id = transport.id;
+
+  ::close(transport.fd);
+
+  // the session is gone once nobody else holds it...
+  connections.erase(id);
+}
+
+
+void UringReactor::run()
+{
+  pin();
+
+  loop_thread = boost::this_thread::get_id();
+
+  arm_wake();
+
+  if (listener >= 0)
+    arm_accept();
+
+  io_uring_cqe * cqes[RING_BATCH];
+
+  while (!stopped)
+  {
+    bool idle;
+
+    {
+      boost::unique_lock<boost::mutex> lock(posted_mtx);
+      idle = posted.empty();
+    }
+
+    // one call submits everything queued on the last round and waits for the next completions...
+    io_uring_submit_and_wait(&ring, idle ? 1 : 0);
+
+    unsigned count = io_uring_peek_batch_cqe(&ring, cqes, RING_BATCH);
+
+    for (unsigned i = 0; i < count; i++)
+      complete(cqes[i]);
+
+    io_uring_cq_advance(&ring, count);
+
+    // the receive buffers used in this round go back to the kernel at once...
+    if (recycled > 0)
+    {
+      io_uring_buf_ring_advance(buffers, recycled);
+      recycled = 0;
+    }
+
+    run_posted();
+
+    for (auto r = released.begin(); r != released.end(); ++r)
+    {
+      auto c = connections.find(*r);
+
+      if (c != connections.end() && c->second.transport->closing && c->second.transport->outstanding == 0)
+        release(*c->second.transport);
+    }
+
+    released.clear();
+  }
+}
+
+
+void UringReactor::complete(io_uring_cqe * cqe)
+{
+  unsigned long long data = io_uring_cqe_get_data64(cqe);
+  Operation op = static_cast<Operation>(data >> 32);
+  unsigned id = static_cast<unsigned>(data & 0xffffffff);
+
+  if (op == OP_ACCEPT)
+  {
+    on_accept(cqe->res, cqe->flags);
+    return;
+  }
+
+  if (op == OP_WAKE)
+  {
+    if (!stopped)
+      arm_wake();
+
+    return;
+  }
+
+  if (op == OP_CANCEL)
+    return;
+
+  auto c = connections.find(id);
+
+  if (c == connections.end())
+    return;
+
+  UringTransport & transport = *c->second.transport;
+
+  if (op == OP_RECV)
+  {
+    on_recv(transport, cqe->res, cqe->flags);
+  }
+  else if (op == OP_SEND)
+  {
+    --transport.outstanding;
+    transport.sent(cqe->res);
+  }
+
+  settle(transport);
+}
+
+
+void UringReactor::on_accept(int result, unsigned flags)
+{
+  // the multishot accept ends on errors, it is armed again...
+  if (!(flags & IORING_CQE_F_MORE) && !stopped)
+    arm_accept();
+
+  if (result < 0)
+    return;
+
+  unsigned id = next_id++;
+
+  UringTransport * transport = new UringTransport(*this, id, result);
+  shared_ptr<Session> session = make_shared<Session>(unique_ptr<Transport>(transport));
+
+  connections[id] = Connection{ session, transport };
+
+  arm_recv(*transport);
+
+  accepted(*this, session);
+}
+
+
+void UringReactor::on_recv(UringTransport & transport, int result, unsigned flags)
+{
+  if (flags & IORING_CQE_F_BUFFER)
+  {
+    unsigned short buffer = static_cast<unsigned short>(flags >> IORING_CQE_BUFFER_SHIFT);
+    char * data = &storage[buffer * RECV_BUFFER_SIZE];
+
+    if (result > 0)
+      transport.received(data, result);
+
+    io_uring_buf_ring_add(buffers, data, RECV_BUFFER_SIZE, buffer, io_uring_buf_ring_mask(RECV_BUFFERS), recycled++);
+  }
+
+  if (flags & IORING_CQE_F_MORE)
+    return;
+
+  // the multishot receive has ended. It is armed again unless the connection is over,
+  // running out of buffers only means the kernel had nowhere to put the data...
+  --transport.outstanding;
+
+  if (result == 0)
+    transport.failed(boost::asio::error::eof);
+  else if (result == -ENOBUFS && !transport.closing)
+    arm_recv(transport);
+  else if (result < 0)
+    transport.failed(boost::system::error_code(-result, boost::system::system_category()));
+  else if (!transport.closing)
+    arm_recv(transport);
+}
+
+
+void UringReactor::run_posted()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(posted_mtx);
+    running.swap(posted);
+  }
+
+  for (auto fn = running.begin(); fn != running.end(); ++fn)
+    (*fn)();
+
+  running.clear();
+}
+
+#endif
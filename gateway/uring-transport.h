@@ -0,0 +1,158 @@
+#pragma once
+
+// the io_uring transport is only built on Linux with liburing, define GATEWAY_IO_URING to enable it...
+#ifdef GATEWAY_IO_URING
+
+#include <boost/asio.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <liburing.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "transport.h"
+
+using namespace std;
+
+static unsigned const RING_ENTRIES = 4096;
+static unsigned const RING_BATCH = 256;
+
+// the receive buffers are handed to the kernel through a provided buffer ring, a
+// connection only takes one while data is arriving. Must be a power of 2...
+static unsigned const RECV_BUFFERS = 1024;
+static unsigned const RECV_BUFFER_SIZE = 2048;
+static unsigned const RECV_BUFFER_GROUP = 0;
+
+class UringReactor;
+
+// a session on a socket driven by the ring of its reactor. The data of the multishot
+// receive goes straight to the pending read, what arrives while no read is waiting
+// is kept until the session reads again. Everything runs on the reactor's thread.
+class UringTransport : public Transport
+{
+public:
+  UringTransport(UringReactor & reactor, unsigned id, int fd);
+
+  void read(char * buffer, size_t size, IoHandler handler);
+  void write(vector<boost::asio::const_buffer> const & buffers, IoHandler handler);
+  void dispatch(function<void()> fn);
+  void post(function<void()> fn);
+  void close();
+  string const & peer();
+
+private:
+  friend class UringReactor;
+
+  UringReactor & reactor;
+  unsigned const id;
+  int const fd;
+  string endpoint;
+
+  // the operations of the connection in the ring, it is released when none is left...
+  unsigned outstanding;
+  bool closing;
+
+  string inbox;
+  boost::system::error_code read_error;
+  char * read_buffer;
+  size_t read_size;
+  IoHandler read_handler;
+
+  vector<iovec> iovecs;
+  msghdr message;
+  size_t written;
+  IoHandler write_handler;
+
+  void received(char const * data, size_t length);
+  void failed(boost::system::error_code const & error);
+  void complete_read();
+  void sent(int result);
+};
+
+
+// an event loop on an io_uring instance. Connections come from a multishot accept
+// on the reactor's own SO_REUSEPORT socket and are read by a multishot receive into
+// the provided buffers. The operations queued while handling a batch of completions
+// go to the kernel in a single submit, which also waits for the next batch.
+class UringReactor : public EventLoop
+{
+public:
+  UringReactor(unsigned id, int core, AcceptHandler acceptFn);
+  ~UringReactor();
+
+  void listen(boost::asio::ip::tcp::endpoint const & endpoint);
+
+  void start();
+  void stop();
+  void join();
+
+  // queues a function to run on the reactor's thread...
+  void post(function<void()> fn);
+  bool in_loop() const;
+
+private:
+  friend class UringTransport;
+
+  enum Operation { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_WAKE, OP_CANCEL };
+
+  struct Connection
+  {
+    shared_ptr<Session> session;
+    UringTransport * transport;
+  };
+
+  io_uring ring;
+  io_uring_buf_ring * buffers;
+  vector<char> storage;
+  int recycled;
+
+  int listener;
+  int wake_fd;
+  unsigned long long wake_value;
+
+  AcceptHandler accepted;
+  unordered_map<unsigned, Connection> connections;
+  unsigned next_id;
+  vector<unsigned> released;
+
+  boost::mutex posted_mtx;
+  vector<function<void()>> posted;
+  vector<function<void()>> running;
+
+  boost::thread thread;
+  boost::thread::id loop_thread;
+  atomic<bool> stopped;
+
+  static unsigned long long user_data(Operation op, unsigned id);
+
+  io_uring_sqe * next_sqe();
+  void arm_accept();
+  void arm_recv(UringTransport & transport);
+  void arm_wake();
+  void send(UringTransport & transport);
+  void shutdown(UringTransport & transport);
+  void settle(UringTransport & transport);
+  void release(UringTransport & transport);
+
+  void run();
+  void complete(io_uring_cqe * cqe);
+  void on_accept(int result, unsigned flags);
+  void on_recv(UringTransport & transport, int result, unsigned flags);
+  void run_posted();
+};
+
+#endif
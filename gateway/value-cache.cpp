@@ -0,0 +1,193 @@
+#include "value-cache.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CACHE_PAUSE
+#endif
+
+// lets the writer's core go on while a reader or another writer waits for the cell...
+static inline void relax()
+{
+#ifdef CACHE_PAUSE
+  _mm_pause();
+#endif
+}
+
+ValueCache::ValueCache(size_t capacity) : size(capacity)
+{
+  size_t shardSize = size_t(1) << CACHE_SHARD_BITS;
+
+  shards.reserve((capacity + shardSize - 1) / shardSize);
+
+  for (size_t allocated = 0; allocated < capacity; allocated += shardSize)
+    shards.emplace_back(shardSize);
+}
+
+
+bool ValueCache::update(int index, Value const & value, Quality quality)
+{
+  CacheCell * c = cell(index);
+
+  if (c == nullptr)
+    return false;
+
+  CachedValue cached;
+  cached.quality = quality;
+  cached.timestamp = chrono::steady_clock::now().time_since_epoch().count();
+
+  if (!toDouble(value, cached.number))
+    cached.number = numeric_limits<double>::quiet_NaN();
+
+  // numbers are formatted straight into the cell text...
+  formatValue(value, cached.text, VALUE_TEXT_SIZE);
+
+  CachedValue previous;
+  bool changed = !get(index, previous) || previous.quality != quality || strcmp(previous.text, cached.text) != 0;
+
+  store(*c, cached);
+
+  return changed;
+}
+
+
+void ValueCache::touch(int index)
+{
+  CacheCell * c = cell(index);
+
+  if (c == nullptr || c->sequence.load(memory_order_acquire) == 0)
+    return;
+
+  // only the timestamp is written, in place, so a racing update isn't undone...
+  unsigned long long sequence = take(*c);
+
+  c->value.timestamp = chrono::steady_clock::now().time_since_epoch().count();
+
+  c->sequence.store(sequence + 2, memory_order_release);
+}
+
+
+bool ValueCache::expire(int index, long long age, Quality quality)
+{
+  CacheCell * c = cell(index);
+
+  if (c == nullptr || c->sequence.load(memory_order_acquire) == 0)
+    return false;
+
+  // the age is checked with the cell taken, so an update racing with it wins...
+  unsigned long long sequence = take(*c);
+  bool old = ValueCache::age(c->value) >= age;
+
+  if (old)
+    c->value.quality = quality;
+
+  c->sequence.store(sequence + 2, memory_order_release);
+
+  return old;
+}
+
+
+bool ValueCache::get(int index, CachedValue & value) const
+{
+  CacheCell const * c = cell(index);
+
+  if (c == nullptr)
+    return false;
+
+  while (true)
+  {
+    unsigned long long before = c->sequence.load(memory_order_acquire);
+
+    if (before == 0)
+      return false;
+
+    // a writer owns the cell...
+    if (before & 1)
+    {
+      relax();
+      continue;
+    }
+
+    value = c->value;
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if (c->sequence.load(memory_order_relaxed) == before)
+      return true;
+  }
+}
+
+
+size_t ValueCache::capacity() const
+{
+  return size;
+}
+
+
+long long ValueCache::age(CachedValue const & cached)
+{
+  chrono::steady_clock::duration elapsed(chrono::steady_clock::now().time_since_epoch().count() - cached.timestamp);
+
+  return chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+}
+
+
+CacheCell * ValueCache::cell(int index)
+{
+  if (index < 0 || static_cast<size_t>(index) >= size)
+    return nullptr;
+
+  return &shards[index >> CACHE_SHARD_BITS][index & ((1 << CACHE_SHARD_BITS) - 1)];
+}
+
+
+CacheCell const * ValueCache::cell(int index) const
+{
+  return const_cast<ValueCache *>(this)->cell(index);
+}
+
+
+void ValueCache::store(CacheCell & cell, CachedValue const & value)
+{
+  unsigned long long sequence = take(cell);
+
+  cell.value = value;
+
+  cell.sequence.store(sequence + 2, memory_order_release);
+}
+
+
+unsigned long long ValueCache::take(CacheCell & cell)
+{
+  // the data change callback is the usual writer, but a WRITE may race with
+  // it, so the cell is taken with a CAS instead of a plain increment...
+  unsigned long long sequence = cell.sequence.load(memory_order_relaxed);
+
+  while ((sequence & 1) || !cell.sequence.compare_exchange_weak(sequence, sequence + 1, memory_order_acquire))
+  {
+    relax();
+    sequence = cell.sequence.load(memory_order_relaxed);
+  }
+
+  atomic_thread_fence(memory_order_release);
+
+  return sequence;
+}
+
+
+void formatCachedValue(CachedValue const & cached, string & output)
+{
+  output.append(cached.text);
+  output.push_back('|');
+  appendInteger(output, cached.quality);
+  output.push_back('|');
+  appendInteger(output, ValueCache::age(cached));
+}
+
+
+string formatCachedValue(CachedValue const & cached)
+{
+  string output;
+  formatCachedValue(cached, output);
+
+  return output;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <boost/align/aligned_allocator.hpp>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+static unsigned const CACHE_SIZE = 131072;
+static unsigned const CACHE_SHARD_BITS = 12;
+static unsigned const CACHE_LINE_SIZE = 64;
+static unsigned const VALUE_TEXT_SIZE = 36;
+
+// last known value of an item. Trivially copyable so it can be copied in and out
+// of a seqlock cell. Text values longer than VALUE_TEXT_SIZE - 1 are truncated...
+struct CachedValue
+{
+  double number;
+  long long timestamp;
+  Quality quality;
+  char text[VALUE_TEXT_SIZE];
+};
+
+// a cell takes exactly one cache line so writers of neighbour items don't
+// invalidate each other's readers. A zero sequence means the cell was never written,
+// at 64 bits it never wraps back to it...
+struct CacheCell
+{
+  atomic<unsigned long long> sequence;
+  CachedValue value;
+
+  CacheCell() : sequence(0) {}
+};
+
+static_assert(sizeof(CacheCell) == CACHE_LINE_SIZE, "a cache cell must fill exactly one cache line");
+
+// last value store indexed by the item index. The cells are split in shards of
+// 2^CACHE_SHARD_BITS cells that are all allocated up front, so the layout never
+// changes. Each cell is protected by a seqlock: readers never block nor write to
+// shared memory, writers take the cell by making its sequence odd.
+class ValueCache
+{
+public:
+  ValueCache(size_t capacity);
+
+  // stores a new value. Returns true if the value or the quality differs from the stored one...
+  bool update(int index, Value const & value, Quality quality);
+
+  // makes the stored value as fresh as if it had just been updated with itself...
+  void touch(int index);
+
+  // sets the quality of a value not updated nor touched for age ms, keeping its
+  // value and age. Returns false if the value is newer or there is none...
+  bool expire(int index, long long age, Quality quality);
+
+  // gets a consistent copy of the value. Returns false if there is no value...
+  bool get(int index, CachedValue & value) const;
+
+  size_t capacity() const;
+
+  static long long age(CachedValue const & cached);
+
+private:
+  typedef vector<CacheCell, boost::alignment::aligned_allocator<CacheCell, CACHE_LINE_SIZE>> Shard;
+
+  vector<Shard> shards;
+  size_t size;
+
+  CacheCell * cell(int index);
+  CacheCell const * cell(int index) const;
+
+  void store(CacheCell & cell, CachedValue const & value);
+
+  // makes the sequence odd so the cell is the caller's, returns the even sequence it had...
+  static unsigned long long take(CacheCell & cell);
+};
+
+
+// the READ response of a cached value: text|quality|age...
+void formatCachedValue(CachedValue const & cached, string & output);
+string formatCachedValue(CachedValue const & cached);
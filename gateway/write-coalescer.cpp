@@ -0,0 +1,108 @@
+#include "write-coalescer.h"
+
+WriteCoalescer::WriteCoalescer(BatchWriteHandler writeFn, long long windowMs) :
+writeFunc(writeFn),
+window(windowMs),
+stopping(false)
+{
+  writer = boost::thread(&WriteCoalescer::run, this);
+}
+
+
+WriteCoalescer::~WriteCoalescer()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mtx);
+    stopping = true;
+  }
+
+  cv.notify_one();
+  writer.join();
+}
+
+
+boost::shared_future<Status> WriteCoalescer::submit(ItemInfo const & item, Value const & value)
+{
+  boost::unique_lock<boost::mutex> lock(mtx);
+
+  auto found = pending.find(item.index);
+
+  if (found == pending.end())
+  {
+    PendingWrite write{ item, value, make_shared<boost::promise<Status>>(), boost::shared_future<Status>() };
+    write.future = write.result->get_future().share();
+
+    found = pending.emplace(item.index, write).first;
+    cv.notify_one();
+  }
+  else
+  {
+    // a newer value replaces the pending one, both requests get the same result...
+    found->second.value = value;
+  }
+
+  return found->second.future;
+}
+
+
+void WriteCoalescer::run()
+{
+  vector<ItemInfo> items;
+  vector<Value> values;
+  vector<Status> results;
+  vector<shared_ptr<boost::promise<Status>>> promises;
+
+  while (true)
+  {
+    {
+      boost::unique_lock<boost::mutex> lock(mtx);
+
+      while (pending.empty() && !stopping)
+        cv.wait(lock);
+
+      if (pending.empty())
+        return;
+    }
+
+    // lets the burst build up...
+    if (window.count() > 0)
+      boost::this_thread::sleep_for(window);
+
+    {
+      boost::unique_lock<boost::mutex> lock(mtx);
+
+      for (auto p = pending.begin(); p != pending.end(); ++p)
+      {
+        items.push_back(p->second.item);
+        values.push_back(move(p->second.value));
+        promises.push_back(p->second.result);
+      }
+
+      pending.clear();
+    }
+
+    // a batch that throws fails all its writes, the next batches still go...
+    try
+    {
+      writeFunc(items, values, results);
+    }
+    catch (exception & e)
+    {
+      cerr << "Write Coalescer - Batch write error - " << e.what() << endl;
+      results.clear();
+    }
+    catch (...)
+    {
+      cerr << "Write Coalescer - Batch write error" << endl;
+      results.clear();
+    }
+
+    for (size_t i = 0; i < promises.size(); i++)
+      promises[i]->set_value(i < results.size() ? results[i] : STATUS_FAIL);
+
+    items.clear();
+    values.clear();
+    results.clear();
+    promises.clear();
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <boost/thread.hpp>
+#include <boost/thread/future.hpp>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "opc_types.h"
+
+using namespace opc;
+using namespace std;
+
+typedef function<void(vector<ItemInfo> const & items, vector<Value> const & values, vector<Status> & results)> BatchWriteHandler;
+
+// collects the writes requested over a short window and sends them to the server
+// in a single batch. Only the last value of each item is written, and every request
+// waiting on that item completes with the item's result. A batch whose handler
+// throws completes all its requests with STATUS_FAIL.
+class WriteCoalescer
+{
+public:
+  WriteCoalescer(BatchWriteHandler writeFn, long long windowMs);
+  ~WriteCoalescer();
+
+  // queues a write and returns the future result of the batch it ends up in...
+  boost::shared_future<Status> submit(ItemInfo const & item, Value const & value);
+
+private:
+  struct PendingWrite
+  {
+    ItemInfo item;
+    Value value;
+    shared_ptr<boost::promise<Status>> result;
+    boost::shared_future<Status> future;
+  };
+
+  BatchWriteHandler writeFunc;
+  boost::chrono::milliseconds window;
+
+  boost::mutex mtx;
+  boost::condition_variable cv;
+  unordered_map<int, PendingWrite> pending;
+  bool stopping;
+
+  boost::thread writer;
+
+  void run();
+};
@@ -0,0 +1,434 @@
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include "targetver.h"
+#endif
+
+using namespace std;
+using boost::asio::ip::tcp;
+
+typedef chrono::steady_clock Clock;
+
+static size_t const READ_SIZE = 4096;
+
+// time given to the connections to be set up before the first one is due...
+static long long const START_DELAY = 100000;
+
+// a SUBSCRIBE isn't answered, the next request waits a bit so the proxy doesn't read
+// both at once...
+static long long const SUBSCRIBE_GAP = 1000;
+
+// a request of a captured session, offset in microseconds from the capture start...
+struct Request
+{
+  long long offset;
+  string message;
+};
+
+// what a captured session did. A session already open when the capture started
+// connects with its first request, one still open when it stopped disconnects after
+// its last one...
+struct Script
+{
+  unsigned long session;
+  long long connect;
+  long long disconnect;
+  vector<Request> requests;
+};
+
+// latencies in microseconds, by command...
+typedef map<string, vector<long long>> Latencies;
+
+struct Totals
+{
+  boost::mutex mtx;
+  Latencies latencies;
+  unsigned long long connections;
+  unsigned long long refused;
+  unsigned long long errors;
+  unsigned long long lost;
+  Clock::time_point last;
+};
+
+
+bool loadCapture(string const & path, vector<Script> & scripts)
+{
+  ifstream file(path.c_str(), ios::binary);
+
+  if (!file.good())
+    return false;
+
+  map<unsigned long, Script> sessions;
+  string line;
+
+  // offset \t session \t event [\t request]...
+  while (getline(file, line))
+  {
+    size_t first = line.find('\t');
+    size_t second = first == string::npos ? string::npos : line.find('\t', first + 1);
+
+    if (second == string::npos || second + 1 >= line.size())
+      continue;
+
+    long long offset = atoll(line.c_str());
+    unsigned long session = strtoul(line.c_str() + first + 1, nullptr, 10);
+    char event = line[second + 1];
+
+    auto s = sessions.find(session);
+
+    if (s == sessions.end())
+      s = sessions.insert(make_pair(session, Script{ session, offset, -1, vector<Request>() })).first;
+
+    if (event == 'R' && second + 3 <= line.size())
+      s->second.requests.push_back(Request{ offset, line.substr(second + 3) });
+    else if (event == 'D')
+      s->second.disconnect = offset;
+  }
+
+  for (auto s = sessions.begin(); s != sessions.end(); ++s)
+    scripts.push_back(s->second);
+
+  return true;
+}
+
+
+// plays one captured session: connects, sends each request at its time and waits for
+// its response, then disconnects. A response is what comes back after the request; on
+// a framed session (after SUBSCRIBE or WRITE_ASYNC) it is the first line that isn't a
+// pushed CHANGE, WRITE_DONE or SUBSCRIBE_FAIL. A SUBSCRIBE only gets a response when it fails, so it
+// isn't waited for.
+class Client : public enable_shared_from_this<Client>
+{
+public:
+  Client(boost::asio::io_service & service, tcp::endpoint const & endpoint, Script const & script, Clock::time_point start, double speed, Totals & totals) :
+    socket(service),
+    timer(service),
+    endpoint(endpoint),
+    script(script),
+    start(start),
+    speed(speed),
+    totals(totals),
+    next(0),
+    framed(false),
+    errors(0)
+  {
+  }
+
+  void run()
+  {
+    wait_until(script.connect, &Client::connect);
+  }
+
+private:
+  tcp::socket socket;
+  boost::asio::steady_timer timer;
+  tcp::endpoint endpoint;
+  Script const & script;
+  Clock::time_point start;
+  double speed;
+  Totals & totals;
+
+  size_t next;
+  bool framed;
+  Clock::time_point sent;
+  char buffer[READ_SIZE];
+  string received;
+  Latencies latencies;
+  unsigned long long errors;
+
+  void wait_until(long long offset, void (Client::*then)())
+  {
+    // the capture times are scaled by the speed, 0 goes as fast as possible...
+    Clock::time_point due = speed > 0 ? start + chrono::microseconds(static_cast<long long>(offset / speed)) : start;
+
+    timer.expires_at(due);
+    timer.async_wait(boost::bind(&Client::on_time, shared_from_this(), then, boost::asio::placeholders::error));
+  }
+
+  void on_time(void (Client::*then)(), boost::system::error_code const & error)
+  {
+    if (!error)
+      (this->*then)();
+  }
+
+  void connect()
+  {
+    socket.async_connect(endpoint, boost::bind(&Client::on_connect, shared_from_this(), boost::asio::placeholders::error));
+  }
+
+  void on_connect(boost::system::error_code const & error)
+  {
+    if (error)
+    {
+      boost::unique_lock<boost::mutex> lock(totals.mtx);
+      totals.refused++;
+      totals.lost += script.requests.size();
+      return;
+    }
+
+    socket.set_option(tcp::no_delay(true));
+
+    send_next();
+  }
+
+  void send_next()
+  {
+    if (next < script.requests.size())
+      wait_until(script.requests[next].offset, &Client::send);
+    else if (script.disconnect >= 0)
+      wait_until(script.disconnect, &Client::finish);
+    else
+      finish();
+  }
+
+  void send()
+  {
+    string const & message = script.requests[next].message;
+
+    sent = Clock::now();
+    boost::asio::async_write(socket, boost::asio::buffer(message), boost::bind(&Client::on_write, shared_from_this(), boost::asio::placeholders::error));
+  }
+
+  void on_write(boost::system::error_code const & error)
+  {
+    if (error)
+      return fail();
+
+    string const & message = script.requests[next].message;
+
+    if (message.compare(0, 10, "SUBSCRIBE|") == 0)
+    {
+      framed = true;
+      next++;
+
+      timer.expires_from_now(chrono::microseconds(SUBSCRIBE_GAP));
+      timer.async_wait(boost::bind(&Client::on_time, shared_from_this(), &Client::send_next, boost::asio::placeholders::error));
+      return;
+    }
+
+    if (message.compare(0, 12, "WRITE_ASYNC|") == 0)
+      framed = true;
+
+    read_response();
+  }
+
+  void read_response()
+  {
+    if (take_response())
+    {
+      next++;
+      return send_next();
+    }
+
+    socket.async_read_some(boost::asio::buffer(buffer), boost::bind(&Client::on_read, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+  }
+
+  void on_read(boost::system::error_code const & error, size_t length)
+  {
+    if (error)
+      return fail();
+
+    received.append(buffer, length);
+    read_response();
+  }
+
+  bool take_response()
+  {
+    string response;
+
+    if (!framed)
+    {
+      if (received.empty())
+        return false;
+
+      response.swap(received);
+    }
+    else
+    {
+      for (;;)
+      {
+        size_t end = received.find('\n');
+
+        if (end == string::npos)
+          return false;
+
+        response = received.substr(0, end);
+        received.erase(0, end + 1);
+
+        // a failed SUBSCRIBE answers late...
+        if (response.compare(0, 15, "SUBSCRIBE_FAIL|") == 0)
+          errors++;
+        else if (response.compare(0, 7, "CHANGE|") != 0 && response.compare(0, 6, "ALARM|") != 0
+          && response.compare(0, 11, "WRITE_DONE|") != 0)
+          break;
+      }
+    }
+
+    string const & message = script.requests[next].message;
+    string command = message.substr(0, message.find('|'));
+
+    latencies[command].push_back(chrono::duration_cast<chrono::microseconds>(Clock::now() - sent).count());
+
+    if (response.find("_FAIL") != string::npos || response == "INVALID")
+      errors++;
+
+    return true;
+  }
+
+  void fail()
+  {
+    boost::unique_lock<boost::mutex> lock(totals.mtx);
+    totals.lost += script.requests.size() - next;
+    lock.unlock();
+
+    finish();
+  }
+
+  void finish()
+  {
+    boost::system::error_code ignored;
+    socket.close(ignored);
+
+    boost::unique_lock<boost::mutex> lock(totals.mtx);
+
+    for (auto l = latencies.begin(); l != latencies.end(); ++l)
+    {
+      vector<long long> & all = totals.latencies[l->first];
+      all.insert(all.end(), l->second.begin(), l->second.end());
+    }
+
+    totals.connections++;
+    totals.errors += errors;
+    totals.last = max(totals.last, Clock::now());
+  }
+};
+
+
+long long percentile(vector<long long> const & sorted, double fraction)
+{
+  size_t position = static_cast<size_t>(fraction * sorted.size());
+
+  return sorted[min(position, sorted.size() - 1)];
+}
+
+
+void printLatencies(string const & name, vector<long long> & latencies, double seconds)
+{
+  if (latencies.empty())
+    return;
+
+  sort(latencies.begin(), latencies.end());
+
+  cout << name << ": requests " << latencies.size()
+    << ", req/s " << (seconds > 0 ? latencies.size() / seconds : 0)
+    << ", p50 " << percentile(latencies, 0.5)
+    << " us, p99 " << percentile(latencies, 0.99)
+    << " us, p999 " << percentile(latencies, 0.999)
+    << " us, max " << latencies.back() << " us" << endl;
+}
+
+
+int main(int argc, char * argv[])
+{
+  if (argc < 2)
+  {
+    cout << "usage: load-replay capture [-h host] [-p port] [-s speed] [-n threads]" << endl;
+    cout << "  speed 1 replays at the captured pace, N is N times faster and 0 as fast as possible" << endl;
+    return 1;
+  }
+
+  string host = "127.0.0.1";
+  string port = "9002";
+  double speed = 1;
+  unsigned threads = max(boost::thread::hardware_concurrency(), 1u);
+
+  for (int i = 2; i + 1 < argc; i += 2)
+  {
+    if (strcmp(argv[i], "-h") == 0)
+      host = argv[i + 1];
+    else if (strcmp(argv[i], "-p") == 0)
+      port = argv[i + 1];
+    else if (strcmp(argv[i], "-s") == 0)
+      speed = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "-n") == 0)
+      threads = max(atoi(argv[i + 1]), 1);
+  }
+
+  vector<Script> scripts;
+
+  if (!loadCapture(argv[1], scripts))
+  {
+    cout << "Cannot read the capture " << argv[1] << endl;
+    return 1;
+  }
+
+  boost::asio::io_service service;
+  tcp::resolver resolver(service);
+  tcp::endpoint endpoint = *resolver.resolve(tcp::resolver::query(tcp::v4(), host, port));
+
+  // the capture may have started late, the replay starts with its first event...
+  long long first = 0;
+
+  for (auto s = scripts.begin(); s != scripts.end(); ++s)
+    first = s == scripts.begin() ? s->connect : min(first, s->connect);
+
+  for (auto s = scripts.begin(); s != scripts.end(); ++s)
+  {
+    s->connect -= first;
+
+    if (s->disconnect >= 0)
+      s->disconnect -= first;
+
+    for (auto r = s->requests.begin(); r != s->requests.end(); ++r)
+      r->offset -= first;
+  }
+
+  Totals totals;
+  totals.connections = 0;
+  totals.refused = 0;
+  totals.errors = 0;
+  totals.lost = 0;
+
+  Clock::time_point start = Clock::now() + chrono::microseconds(START_DELAY);
+  totals.last = start;
+
+  for (auto s = scripts.begin(); s != scripts.end(); ++s)
+    make_shared<Client>(service, endpoint, *s, start, speed, totals)->run();
+
+  boost::thread_group pool;
+
+  for (unsigned i = 0; i < threads; i++)
+    pool.create_thread(boost::bind(&boost::asio::io_service::run, &service));
+
+  pool.join_all();
+
+  double seconds = chrono::duration_cast<chrono::microseconds>(totals.last - start).count() / 1e6;
+  vector<long long> all;
+
+  for (auto l = totals.latencies.begin(); l != totals.latencies.end(); ++l)
+    all.insert(all.end(), l->second.begin(), l->second.end());
+
+  cout << "sessions: " << scripts.size() << ", closed: " << totals.connections << ", refused: " << totals.refused
+    << ", failed responses: " << totals.errors << ", lost requests: " << totals.lost << ", seconds: " << seconds << endl;
+
+  printLatencies("ALL", all, seconds);
+
+  for (auto l = totals.latencies.begin(); l != totals.latencies.end(); ++l)
+    printLatencies(l->first, l->second, seconds);
+
+  return 0;
+}
@@ -23,6 +23,11 @@ namespace opc
   }
 
 
+  OPCClient::OPCClient(LogHandler logFunc, DataChangeHandler dataChangeFunc, WriteCompleteHandler writeCompleteFunc) : opcServer(nullptr), logger(logFunc), dwCookie(0), connected(false), dataChangeFunc(dataChangeFunc), writeCompleteFunc(writeCompleteFunc)
+  {
+  }
+
+
   void OPCClient::Connect(string const & serverName)
   {
     if (connected)
@@ -174,7 +179,7 @@ namespace opc
       /*szAccessPath*/        ap,
       /*szItemID*/            id,
       /*bActive*/             true,
-      /*hClient*/             1,
+      /*hClient*/             static_cast<OPCHANDLE>(itemsVector.size()),
       /*dwBlobSize*/          0,
       /*pBlob*/               NULL,
       /*vtRequestedDataType*/ type,
@@ -192,11 +197,12 @@ namespace opc
       // creates the item info...
       addedInfo.id = itemId;
       addedInfo.handle = result[0].hServer;
-      addedInfo.dataType = (VARENUM)result[0].vtCanonicalDataType;
+      addedInfo.dataType = (ValueType)result[0].vtCanonicalDataType;
 
-      // adds the item handle to the map...
+      // adds the item handle to the map. The index is also the client handle
+      // sent by the server on data changes...
+      addedInfo.index = itemsVector.size();
       itemsVector.push_back(addedInfo);
-      addedInfo.index = itemsVector.size() - 1;
 
       itemsById.emplace(itemId, addedInfo);
 
@@ -255,8 +261,13 @@ namespace opc
           return inf.handle == it->second.handle && inf.id == it->second.id;
         });
 
+        // keeps the slot so the indexes of the other items remain valid. An empty slot
+        // has no index...
         if (v != itemsVector.end())
-          itemsVector.erase(v);
+        {
+          *v = ItemInfo();
+          v->index = -1;
+        }
 
         it = itemsById.erase(it);
       }
@@ -306,8 +317,13 @@ namespace opc
         return inf.handle == item.handle && inf.id == item.id;
       });
 
+      // keeps the slot so the indexes of the other items remain valid. An empty slot
+      // has no index...
       if (v != itemsVector.end())
-        itemsVector.erase(v);
+      {
+        *v = ItemInfo();
+        v->index = -1;
+      }
 
       itemsById.erase(item.id);
     }
@@ -382,8 +398,11 @@ namespace opc
     }
 
     value.handle = readValue[0].hClient;
-    value.value = readValue[0].vDataValue;
-    value.quality = readValue[0].wQuality;
+    toValue(readValue[0].vDataValue, value.value);
+    value.quality = static_cast<Quality>(readValue[0].wQuality);
+    value.timestamp = toTicks(readValue[0].ftTimeStamp);
+
+    VariantClear(&readValue[0].vDataValue);
 
     //Release memeory allocated by the OPC server:
     CoTaskMemFree(errors);
@@ -429,9 +448,17 @@ namespace opc
     //get a pointer to the IOPCSyncIOInterface:
     IOPCSyncIO * syncIO = nullptr;
 
-    group->ptr->QueryInterface(__uuidof(syncIO), (void**)&syncIO);
+    HRESULT hr = group->ptr->QueryInterface(__uuidof(syncIO), (void**)&syncIO);
+
+    if (hr != S_OK)
+    {
+      msg << ">> !!! Could not obtain a pointer to IOPCSyncIO. Error: " << hr << endl;
+      logger(msg.str());
+
+      return hr;
+    }
 
-    HRESULT hr = syncIO->Write(1, const_cast<OPCHANDLE *>(&toWrite.handle), &value, &errors);
+    hr = syncIO->Write(1, const_cast<OPCHANDLE *>(&toWrite.handle), &value, &errors);
 
     if (hr != S_OK || &value == nullptr)
     {
@@ -453,6 +480,151 @@ namespace opc
   }
 
 
+  HRESULT OPCClient::Write(vector<ItemInfo> const & items, vector<VARIANT> & values, vector<HRESULT> & errors)
+  {
+    ostringstream msg;
+
+    errors.assign(items.size(), S_FALSE);
+
+    // only the items found in the internal dictionary are sent to the server...
+    vector<OPCHANDLE> handles;
+    vector<VARIANT> toWrite;
+    vector<size_t> positions;
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      auto found = itemsById.find(items[i].id);
+
+      if (found == itemsById.end() || found->second.handle != items[i].handle)
+      {
+        msg << ">> The item '" << items[i].id << "' wasn't found in the added list." << endl;
+        logger(msg.str());
+        msg.str("");
+
+        continue;
+      }
+
+      handles.push_back(found->second.handle);
+      toWrite.push_back(values[i]);
+      positions.push_back(i);
+    }
+
+    if (handles.empty())
+      return S_FALSE;
+
+    // to store error code(s)
+    HRESULT * itemErrors = nullptr;
+
+    //get a pointer to the IOPCSyncIOInterface:
+    IOPCSyncIO * syncIO = nullptr;
+
+    HRESULT hr = group->ptr->QueryInterface(__uuidof(syncIO), (void**)&syncIO);
+
+    if (hr != S_OK)
+    {
+      msg << ">> !!! Could not obtain a pointer to IOPCSyncIO. Error: " << hr << endl;
+      logger(msg.str());
+
+      for (size_t i = 0; i < positions.size(); i++)
+        errors[positions[i]] = hr;
+
+      return hr;
+    }
+
+    hr = syncIO->Write(static_cast<DWORD>(handles.size()), &handles[0], &toWrite[0], &itemErrors);
+
+    if (FAILED(hr) || itemErrors == nullptr)
+    {
+      msg << ">> !! An error occurred while trying to write " << handles.size() << " items. Error code: " << hr << endl;
+      logger(msg.str());
+
+      for (size_t i = 0; i < positions.size(); i++)
+        errors[positions[i]] = hr;
+    }
+    else
+    {
+      for (size_t i = 0; i < positions.size(); i++)
+        errors[positions[i]] = itemErrors[i];
+    }
+
+    //Release memeory allocated by the OPC server:
+    CoTaskMemFree(itemErrors);
+    itemErrors = nullptr;
+
+    // release the reference to the IOPCSyncIO interface:
+    syncIO->Release();
+    syncIO = nullptr;
+
+    return hr;
+  }
+
+
+  HRESULT OPCClient::WriteAsync(ItemInfo const & item, VARIANT & value, DWORD transactionId)
+  {
+    ostringstream msg;
+
+    // checks if the itemId is already in the map. I yes, returns OK...
+    if (itemsById.count(item.id) == 0)
+    {
+      msg << ">> The item '" << item.id << "' wasn't found in the added list." << endl;
+      logger(msg.str());
+
+      return S_FALSE;
+    }
+
+    ItemInfo toWrite = itemsById[item.id];
+
+    if (toWrite.handle != item.handle)
+    {
+      msg << ">> The item's handle [" << item.handle << "] doesn't match the handle of the item in the internal dictionary." << endl;
+      logger(msg.str());
+
+      return S_FALSE;
+    }
+
+    // to store error code(s)
+    HRESULT * errors = nullptr;
+
+    // id the server gives to cancel the write, not used...
+    DWORD cancelId = 0;
+
+    //get a pointer to the IOPCAsyncIO2 interface:
+    IOPCAsyncIO2 * asyncIO = nullptr;
+
+    HRESULT hr = group->ptr->QueryInterface(__uuidof(asyncIO), (void**)&asyncIO);
+
+    if (hr != S_OK)
+    {
+      msg << ">> !!! Could not obtain a pointer to IOPCAsyncIO2. Error: " << hr << endl;
+      logger(msg.str());
+
+      return hr;
+    }
+
+    hr = asyncIO->Write(1, &toWrite.handle, &value, transactionId, &cancelId, &errors);
+
+    // S_FALSE means the item was rejected and no completion will come...
+    if (hr == S_FALSE && errors != nullptr)
+      hr = errors[0];
+
+    if (hr != S_OK)
+    {
+      msg << ">> !! An error occurred while trying to start a write to the item '" << toWrite.id << "'. Error code: " << hr << endl;
+      logger(msg.str());
+    }
+
+    //Release memeory allocated by the OPC server:
+    CoTaskMemFree(errors);
+    errors = nullptr;
+
+    // release the reference to the IOPCAsyncIO2 interface:
+    asyncIO->Release();
+    asyncIO = nullptr;
+
+    return hr;
+  }
+
+
   HRESULT OPCClient::SetDataCallback()
   {
     ostringstream msg;
@@ -483,7 +655,7 @@ namespace opc
     }
 
     // Now set up the Connection Point.
-    dataCallback = new OPCDataCallback(logger, dataChangeFunc, bind(&OPCClient::GetItemInfoByIndex, this, placeholders::_1));
+    dataCallback = new OPCDataCallback(logger, dataChangeFunc, bind(&OPCClient::GetItemInfoByIndex, this, placeholders::_1), writeCompleteFunc);
     dataCallback->AddRef();
     hr = connPoint->Advise(dataCallback, &dwCookie);
     if (hr != S_OK)
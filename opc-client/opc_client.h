@@ -37,6 +37,9 @@ namespace opc
     // data change function...
     DataChangeHandler dataChangeFunc;
 
+    // asynchronous write completion function...
+    WriteCompleteHandler writeCompleteFunc;
+
     // only allows one group and this is the reference to it...
     unique_ptr<Group> group;
 
@@ -82,6 +85,9 @@ namespace opc
     // destructor...
     ~OPCClient();
 
+    // constructor...
+    OPCClient(LogHandler logFunc, DataChangeHandler dataChangeFunc, WriteCompleteHandler writeCompleteFunc);
+
     // constructor...
     OPCClient::OPCClient(LogHandler logFunc, DataChangeHandler dataChangeFunc);
 
@@ -112,6 +118,12 @@ namespace opc
     // writes the value of an item...
     HRESULT Write(ItemInfo const & item, VARIANT & value);
 
+    // writes the values of several items in a single call. errors gets the result of each item...
+    HRESULT Write(vector<ItemInfo> const & items, vector<VARIANT> & values, vector<HRESULT> & errors);
+
+    // starts an asynchronous write. The write complete function gets the transaction id when it finishes...
+    HRESULT WriteAsync(ItemInfo const & item, VARIANT & value, DWORD transactionId);
+
     // starts monitoring data changes...
     HRESULT SetDataCallback();
 
@@ -23,6 +23,12 @@ namespace opc
   }
 
 
+  OPCDataCallback::OPCDataCallback(LogHandler logFunc, DataChangeHandler onDataChange, GetItemInfoHandler itemInfoHandler, WriteCompleteHandler onWriteComplete) :
+    logger(logFunc), refCounter(0), changeHandler(onDataChange), getItemInfo(itemInfoHandler), writeCompleteHandler(onWriteComplete)
+  {
+  }
+
+
   OPCDataCallback::~OPCDataCallback()
   {
   }
@@ -119,11 +125,18 @@ namespace opc
     ItemInfo info;
     for (DWORD dwItem = 0; dwItem < dwCount; dwItem++)
     {
-      info = getItemInfo(dwItem);
-
-      itemValueList.push_back(make_unique<ItemValue>(
-        ItemValue{ info.handle , pvValues[dwItem], pwQualities[dwItem] & OPC_QUALITY_MASK }
-      ));
+      // the client handle is the index of the item in the client's list...
+      info = getItemInfo(phClientItems[dwItem]);
+
+      // the values are converted here, the gateway never sees a VARIANT...
+      unique_ptr<ItemValue> value = make_unique<ItemValue>();
+      value->handle = info.handle;
+      toValue(pvValues[dwItem], value->value);
+      value->quality = static_cast<Quality>(pwQualities[dwItem] & OPC_QUALITY_MASK);
+      value->index = info.index;
+      value->timestamp = toTicks(pftTimeStamps[dwItem]);
+
+      itemValueList.push_back(move(value));
     }
 
     changeHandler(itemValueList);
@@ -135,8 +148,8 @@ namespace opc
   }
 
 
-  // The remaining methods of IOPCDataCallback are not implemented here, so
-  // we just use dummy functions that simply return S_OK.
+  // The remaining methods of IOPCDataCallback, but OnWriteComplete, are not
+  // implemented here, so we just use dummy functions that simply return S_OK.
   HRESULT STDMETHODCALLTYPE OPCDataCallback::OnReadComplete(
     DWORD dwTransID,
     OPCHANDLE hGroup,
@@ -161,6 +174,17 @@ namespace opc
     OPCHANDLE *phClientItems,
     HRESULT *pErrors)
   {
+    if (!writeCompleteHandler)
+      return S_OK;
+
+    // every write started by IOPCAsyncIO2::Write has a single item...
+    HRESULT result = hrMasterError;
+
+    if (dwCount > 0 && pErrors != NULL)
+      result = pErrors[0];
+
+    writeCompleteHandler(dwTransID, result);
+
     return S_OK;
   }
 
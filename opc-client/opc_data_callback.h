@@ -25,11 +25,13 @@ namespace opc
     LogHandler logger;
     DataChangeHandler changeHandler;
     GetItemInfoHandler getItemInfo;
+    WriteCompleteHandler writeCompleteHandler;
 
     static mutex onDataChangeMtx;
 
   public:
     OPCDataCallback(LogHandler logFunc, DataChangeHandler onDataChange, GetItemInfoHandler itemInfoHandler);
+    OPCDataCallback(LogHandler logFunc, DataChangeHandler onDataChange, GetItemInfoHandler itemInfoHandler, WriteCompleteHandler onWriteComplete);
     ~OPCDataCallback();
 
     DWORD getCountRef();
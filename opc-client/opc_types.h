@@ -0,0 +1,415 @@
+#pragma once
+
+#ifndef OPCCLIENT_API
+#if !defined(_WIN32)
+#define OPCCLIENT_API
+#elif defined(OPCCLIENT_EXPORTS)
+#define OPCCLIENT_API __declspec(dllexport)
+#else
+#define OPCCLIENT_API __declspec(dllimport)
+#endif
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// the items, values and results as the gateway sees them, with no COM type. The
+// client converts the VARIANTs, HRESULTs and FILETIMEs of the server to these
+// (opc_utils.h), so everything but the client builds on any platform.
+namespace opc
+{
+  // the value types, numbered as their VARENUM...
+  enum ValueType
+  {
+    TYPE_EMPTY = 0,
+    TYPE_I2 = 2,
+    TYPE_I4 = 3,
+    TYPE_R4 = 4,
+    TYPE_R8 = 5,
+    TYPE_CY = 6,
+    TYPE_DATE = 7,
+    TYPE_STRING = 8,
+    TYPE_ERROR = 10,
+    TYPE_BOOL = 11,
+    TYPE_I1 = 16,
+    TYPE_UI1 = 17,
+    TYPE_UI2 = 18,
+    TYPE_UI4 = 19,
+    TYPE_I8 = 20,
+    TYPE_UI8 = 21,
+    TYPE_INT = 22,
+    TYPE_UINT = 23
+  };
+
+  // the result of a call, with the value of the HRESULT it stands for...
+  typedef int32_t Status;
+
+  static Status const STATUS_OK = 0;
+  static Status const STATUS_FALSE = 1;
+  static Status const STATUS_FAIL = static_cast<Status>(0x80004005);
+  static Status const STATUS_TYPE_MISMATCH = static_cast<Status>(0x80020005);
+  static Status const STATUS_OVERFLOW = static_cast<Status>(0x8002000A);
+
+  typedef uint32_t ItemHandle;
+
+  // the quality of a value, only the good, uncertain and bad bits are kept...
+  typedef uint16_t Quality;
+
+  static Quality const QUALITY_BAD = 0x00;
+  static Quality const QUALITY_UNCERTAIN = 0x40;
+  static Quality const QUALITY_GOOD = 0xC0;
+  static Quality const QUALITY_MASK = 0xC0;
+
+  inline bool isSigned(ValueType type)
+  {
+    return type == TYPE_I1 || type == TYPE_I2 || type == TYPE_I4 || type == TYPE_INT || type == TYPE_I8 || type == TYPE_BOOL;
+  }
+
+
+  inline bool isUnsigned(ValueType type)
+  {
+    return type == TYPE_UI1 || type == TYPE_UI2 || type == TYPE_UI4 || type == TYPE_UINT || type == TYPE_UI8;
+  }
+
+
+  inline bool isReal(ValueType type)
+  {
+    return type == TYPE_R4 || type == TYPE_R8;
+  }
+
+
+  // whether the value is a number, in the union, or text...
+  inline bool isNumeric(ValueType type)
+  {
+    return isSigned(type) || isUnsigned(type) || isReal(type);
+  }
+
+
+  // a value of any type. The numbers are in the union by their type, a boolean is
+  // the integer 0 or 1. The strings and the types that aren't numbers (currency,
+  // dates, errors) are kept as their text...
+  struct Value
+  {
+    ValueType type;
+
+    union
+    {
+      long long integer;
+      unsigned long long natural;
+      double real;
+    };
+
+    string text;
+
+    Value() : type(TYPE_EMPTY), integer(0) {}
+  };
+
+  struct OPCCLIENT_API ItemValue
+  {
+    ItemHandle handle;
+    Value value;
+    Quality quality;
+    int index;
+
+    // 100 ns ticks since 1601, as the FILETIME given by the server...
+    unsigned long long timestamp;
+  };
+
+  inline bool operator ==(ItemValue const & lhs, ItemValue const & rhs)
+  {
+    return lhs.handle == rhs.handle;
+  }
+
+
+  struct OPCCLIENT_API ItemInfo
+  {
+    string id;
+    ItemHandle handle;
+    ValueType dataType;
+    int index;
+  };
+
+  inline bool operator ==(ItemInfo const & lhs, ItemInfo const & rhs)
+  {
+    return lhs.handle == rhs.handle && lhs.id == rhs.id;
+  }
+
+
+  typedef function<void(string const &)> LogHandler;
+
+
+  typedef function<void(vector<unique_ptr<ItemValue>> const &)> DataChangeHandler;
+
+
+  typedef function<ItemInfo(size_t)> GetItemInfoHandler;
+
+
+  typedef function<void(unsigned long transactionId, Status result)> WriteCompleteHandler;
+
+
+  // formats a real with printf in the C locale. Returns -1 if the text was truncated...
+  inline int formatReal(char * buffer, size_t size, char const * format, double value)
+  {
+#ifdef _MSC_VER
+    return _snprintf_s(buffer, size, _TRUNCATE, format, value);
+#else
+    int length = snprintf(buffer, size, format, value);
+
+    return length < 0 || static_cast<size_t>(length) >= size ? -1 : length;
+#endif
+  }
+
+
+  // writes the decimal digits of a number backwards, ending at end. Returns where they start...
+  inline char * writeDigits(unsigned long long magnitude, bool negative, char * end)
+  {
+    char * p = end;
+
+    do
+    {
+      *--p = static_cast<char>('0' + magnitude % 10);
+      magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (negative)
+      *--p = '-';
+
+    return p;
+  }
+
+
+  inline char * writeDigits(long long value, char * end)
+  {
+    unsigned long long magnitude = value < 0 ? 0ULL - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+
+    return writeDigits(magnitude, value < 0, end);
+  }
+
+
+  // writes the decimal digits of value at the end of output, without temporaries...
+  inline void appendInteger(string & output, long long value)
+  {
+    char digits[24];
+    char * end = digits + sizeof(digits);
+
+    output.append(writeDigits(value, end), end);
+  }
+
+
+  // writes a double with the precision of the R8 values, NaN is written as nothing...
+  inline void appendNumber(string & output, double value)
+  {
+    if (value != value)
+      return;
+
+    char digits[32];
+    int length = formatReal(digits, sizeof(digits), "%.15g", value);
+
+    if (length > 0)
+      output.append(digits, length);
+  }
+
+
+  // gets the value of a numeric value as a double. Returns false for the other types...
+  inline bool toDouble(Value const & value, double & output)
+  {
+    if (isSigned(value.type))
+      output = static_cast<double>(value.integer);
+    else if (isUnsigned(value.type))
+      output = static_cast<double>(value.natural);
+    else if (isReal(value.type))
+      output = value.real;
+    else
+      return false;
+
+    return true;
+  }
+
+
+  // formats a value into a buffer and returns the length of the text. Numbers are
+  // written straight into the buffer in the C locale. The text is truncated to
+  // size - 1 characters...
+  inline size_t formatValue(Value const & value, char * buffer, size_t size)
+  {
+    char digits[24];
+    char * end = digits + sizeof(digits);
+    char const * text;
+
+    if (value.type == TYPE_BOOL)
+    {
+      text = value.integer == 0 ? "False" : "True";
+      end = const_cast<char *>(text) + strlen(text);
+    }
+    else if (isSigned(value.type))
+    {
+      text = writeDigits(value.integer, end);
+    }
+    else if (isUnsigned(value.type))
+    {
+      text = writeDigits(value.natural, false, end);
+    }
+    else if (isReal(value.type))
+    {
+      int length = formatReal(buffer, size, value.type == TYPE_R4 ? "%.7g" : "%.15g", value.real);
+
+      // -1 means the text was truncated...
+      return length < 0 ? size - 1 : length;
+    }
+    else
+    {
+      text = value.text.c_str();
+      end = const_cast<char *>(text) + value.text.size();
+    }
+
+    size_t length = min(static_cast<size_t>(end - text), size - 1);
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+
+    return length;
+  }
+
+
+  inline string formatValue(Value const & value)
+  {
+    if (!isNumeric(value.type))
+      return value.text;
+
+    char buffer[32];
+    size_t length = formatValue(value, buffer, sizeof(buffer));
+
+    return string(buffer, length);
+  }
+
+
+  inline bool equalsIgnoringCase(char const * text, char const * other)
+  {
+    for (; *text != '\0' && *other != '\0'; ++text, ++other)
+    {
+      if (tolower(static_cast<unsigned char>(*text)) != tolower(static_cast<unsigned char>(*other)))
+        return false;
+    }
+
+    return *text == *other;
+  }
+
+
+  // parses the text straight into a value of the given type, so the server gets
+  // the type it expects. Numbers are parsed from a stack copy of the text, the
+  // other types keep the text for the server to convert. Returns
+  // STATUS_TYPE_MISMATCH or STATUS_OVERFLOW if the text is not a valid value...
+  inline Status parseValue(char const * text, size_t length, ValueType type, Value & output)
+  {
+    char buffer[64];
+
+    if (!isNumeric(type))
+    {
+      output.type = type == TYPE_EMPTY ? TYPE_STRING : type;
+      output.text.assign(text, length);
+      return STATUS_OK;
+    }
+
+    if (length == 0 || length >= sizeof(buffer))
+      return STATUS_TYPE_MISMATCH;
+
+    // the conversions skip leading spaces, a value has none...
+    if (isspace(static_cast<unsigned char>(text[0])))
+      return STATUS_TYPE_MISMATCH;
+
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+
+    char * end = nullptr;
+    errno = 0;
+
+    if (type == TYPE_BOOL)
+    {
+      if (strcmp(buffer, "1") == 0 || equalsIgnoringCase(buffer, "true"))
+        output.integer = 1;
+      else if (strcmp(buffer, "0") == 0 || equalsIgnoringCase(buffer, "false"))
+        output.integer = 0;
+      else
+        return STATUS_TYPE_MISMATCH;
+
+      output.type = TYPE_BOOL;
+      return STATUS_OK;
+    }
+
+    if (isReal(type))
+    {
+      double real = strtod(buffer, &end);
+
+      if (end != buffer + length)
+        return STATUS_TYPE_MISMATCH;
+
+      if (errno == ERANGE)
+        return STATUS_OVERFLOW;
+
+      // strtod also reads inf and nan, they aren't values of a device...
+      if (real != real || fabs(real) > DBL_MAX)
+        return STATUS_TYPE_MISMATCH;
+
+      if (type == TYPE_R4 && fabs(real) > FLT_MAX)
+        return STATUS_OVERFLOW;
+
+      output.real = type == TYPE_R4 ? static_cast<float>(real) : real;
+      output.type = type;
+      return STATUS_OK;
+    }
+
+    if (isUnsigned(type))
+    {
+      // strtoull accepts a sign and negates the value...
+      if (buffer[0] == '-')
+        return STATUS_OVERFLOW;
+
+      unsigned long long value = strtoull(buffer, &end, 10);
+
+      if (end != buffer + length)
+        return STATUS_TYPE_MISMATCH;
+
+      unsigned long long maximum = type == TYPE_UI1 ? UCHAR_MAX : type == TYPE_UI2 ? USHRT_MAX : type == TYPE_UI8 ? ULLONG_MAX : UINT_MAX;
+
+      if (errno == ERANGE || value > maximum)
+        return STATUS_OVERFLOW;
+
+      output.natural = value;
+      output.type = type;
+      return STATUS_OK;
+    }
+
+    long long value = strtoll(buffer, &end, 10);
+
+    if (end != buffer + length)
+      return STATUS_TYPE_MISMATCH;
+
+    long long minimum = type == TYPE_I1 ? SCHAR_MIN : type == TYPE_I2 ? SHRT_MIN : type == TYPE_I8 ? LLONG_MIN : INT_MIN;
+    long long maximum = type == TYPE_I1 ? SCHAR_MAX : type == TYPE_I2 ? SHRT_MAX : type == TYPE_I8 ? LLONG_MAX : INT_MAX;
+
+    if (errno == ERANGE || value < minimum || value > maximum)
+      return STATUS_OVERFLOW;
+
+    output.integer = value;
+    output.type = type;
+    return STATUS_OK;
+  }
+
+
+  inline Status parseValue(string const & input, ValueType type, Value & output)
+  {
+    return parseValue(input.data(), input.size(), type, output);
+  }
+}
@@ -8,9 +8,10 @@
 
 #include <comdef.h>
 #include <comutil.h>
-#include <functional>
+#include <cstdlib>
 #include <string>
 #include "opcda.h"
+#include "opc_types.h"
 
 using namespace std;
 
@@ -22,42 +23,6 @@ namespace opc
     unsigned long updateRate;
   };
 
-  struct OPCCLIENT_API ItemValue
-  {
-    OPCHANDLE handle;
-    VARIANT value;
-    DWORD quality;
-  };
-
-  inline bool operator ==(ItemValue const & lhs, ItemValue const & rhs)
-  {
-    return lhs.handle == rhs.handle;
-  }
-
-
-  struct OPCCLIENT_API ItemInfo
-  {
-    string id;
-    OPCHANDLE handle;
-    VARENUM dataType;
-    int index;
-  };
-
-  inline bool operator ==(ItemInfo const & lhs, ItemInfo const & rhs)
-  {
-    return lhs.handle == rhs.handle && lhs.id == rhs.id;
-  }
-
-
-  typedef function<void(string const &)> LogHandler;
-
-
-  typedef function<void(vector<unique_ptr<ItemValue>> const &)> DataChangeHandler;
-
-
-  typedef function<ItemInfo(size_t)> GetItemInfoHandler;
-
-
   static wchar_t * convertMBSToWCS(char const * value){
     size_t newSize = strlen(value) + 1;
     size_t convertedChars = 0;
@@ -82,4 +47,76 @@ namespace opc
     _bstr_t bt(input.c_str());
     reinterpret_cast<_variant_t &>(output) = bt;
   }
-}
\ No newline at end of file
+
+
+  // converts a value of the server. The numbers go to the union of their type, the
+  // rest to its text, and a type the gateway doesn't know (arrays...) is a string...
+  static void toValue(VARIANT & input, Value & output)
+  {
+    output.type = static_cast<ValueType>(input.vt);
+    output.text.clear();
+
+    switch (input.vt)
+    {
+    case VT_EMPTY: output.integer = 0; break;
+    case VT_I1: output.integer = input.cVal; break;
+    case VT_I2: output.integer = input.iVal; break;
+    case VT_I4: output.integer = input.lVal; break;
+    case VT_INT: output.integer = input.intVal; break;
+    case VT_I8: output.integer = input.llVal; break;
+    case VT_UI1: output.natural = input.bVal; break;
+    case VT_UI2: output.natural = input.uiVal; break;
+    case VT_UI4: output.natural = input.ulVal; break;
+    case VT_UINT: output.natural = input.uintVal; break;
+    case VT_UI8: output.natural = input.ullVal; break;
+    case VT_R4: output.real = input.fltVal; break;
+    case VT_R8: output.real = input.dblVal; break;
+    case VT_BOOL: output.integer = input.boolVal == VARIANT_FALSE ? 0 : 1; break;
+    case VT_BSTR: case VT_CY: case VT_DATE: case VT_ERROR:
+      output.text = fromVARIANT(input);
+      break;
+    default:
+      output.type = TYPE_STRING;
+      output.text = fromVARIANT(input);
+      break;
+    }
+  }
+
+
+  // converts a value for the server, which gets the type it asked for. The types
+  // kept as text go as a BSTR the server converts...
+  static void toVariant(Value const & input, VARIANT & output)
+  {
+    VariantInit(&output);
+
+    switch (input.type)
+    {
+    case TYPE_EMPTY: return;
+    case TYPE_I1: output.cVal = static_cast<CHAR>(input.integer); break;
+    case TYPE_I2: output.iVal = static_cast<SHORT>(input.integer); break;
+    case TYPE_I4: output.lVal = static_cast<LONG>(input.integer); break;
+    case TYPE_INT: output.intVal = static_cast<INT>(input.integer); break;
+    case TYPE_I8: output.llVal = input.integer; break;
+    case TYPE_UI1: output.bVal = static_cast<BYTE>(input.natural); break;
+    case TYPE_UI2: output.uiVal = static_cast<USHORT>(input.natural); break;
+    case TYPE_UI4: output.ulVal = static_cast<ULONG>(input.natural); break;
+    case TYPE_UINT: output.uintVal = static_cast<UINT>(input.natural); break;
+    case TYPE_UI8: output.ullVal = input.natural; break;
+    case TYPE_R4: output.fltVal = static_cast<float>(input.real); break;
+    case TYPE_R8: output.dblVal = input.real; break;
+    case TYPE_BOOL: output.boolVal = input.integer == 0 ? VARIANT_FALSE : VARIANT_TRUE; break;
+    default:
+      toVariant(input.text, output);
+      return;
+    }
+
+    output.vt = static_cast<VARTYPE>(input.type);
+  }
+
+
+  // FILETIME as the 100 ns ticks of the portable values...
+  static unsigned long long toTicks(FILETIME const & time)
+  {
+    return (static_cast<unsigned long long>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+  }
+}